@@ -0,0 +1,529 @@
+// Copyright (c) 2023 Namal Bambarasinghe
+//
+// This software is released under the MIT License.
+// https://opensource.org/licenses/MIT
+
+#include <na/ref_ptr.hpp>
+
+#include <benchmark/benchmark.h>
+
+#include <new>
+#include <vector>
+
+#define na_ref_ptr_benchmark_stringify_impl(x) #x
+#define na_ref_ptr_benchmark_stringify(x) na_ref_ptr_benchmark_stringify_impl(x)
+
+// Registers function<na::counter_policy> as "<suit>/function<counter_policy>"
+#define na_ref_ptr_benchmark(function, counter_policy)                                                                \
+    BENCHMARK_TEMPLATE(function, na::counter_policy)                                                                   \
+        ->Name(na_ref_ptr_benchmark_stringify(na_ref_ptr_benchmark_suit) "/" #function "<" #counter_policy ">")
+
+namespace na_ref_ptr_benchmark_suit
+{
+
+struct payload
+{
+    int a;
+    double b;
+};
+
+template <typename counter_policy> struct service : na::enable_ref_from_this<service<counter_policy>, counter_policy>
+{
+    int a = 1;
+};
+
+// Referables shared by all the threads of the multithreaded benchmarks
+template <typename counter_policy> na::referable<payload, counter_policy> shared_referable{{1, 2.0}};
+template <typename counter_policy> na::ref_ptr<payload, counter_policy> shared_ref_ptr{shared_referable<counter_policy>};
+
+constexpr std::size_t batch_size = 256;
+
+template <typename counter_policy> void construct_from_referable(benchmark::State &state)
+{
+    na::referable<payload, counter_policy> r{{1, 2.0}};
+
+    for (auto _ : state)
+    {
+        na::ref_ptr<payload, counter_policy> p = r;
+        benchmark::DoNotOptimize(p);
+    }
+}
+
+template <typename counter_policy> void copy_construct(benchmark::State &state)
+{
+    na::referable<payload, counter_policy> r{{1, 2.0}};
+    na::ref_ptr<payload, counter_policy> p = r;
+
+    for (auto _ : state)
+    {
+        na::ref_ptr<payload, counter_policy> q = p;
+        benchmark::DoNotOptimize(q);
+    }
+}
+
+template <typename counter_policy> void copy_construct_pooled(benchmark::State &state)
+{
+    na::referable_pool<payload, counter_policy> pool;
+    na::pooled_ref<payload, counter_policy> p = pool.ref(pool.emplace(1, 2.0));
+
+    for (auto _ : state)
+    {
+        na::pooled_ref<payload, counter_policy> q = p;
+        benchmark::DoNotOptimize(q);
+    }
+}
+
+template <typename counter_policy> void copy_assign(benchmark::State &state)
+{
+    na::referable<payload, counter_policy> r1{{1, 2.0}};
+    na::referable<payload, counter_policy> r2{{3, 4.0}};
+    na::ref_ptr<payload, counter_policy> p1 = r1;
+    na::ref_ptr<payload, counter_policy> p2 = r2;
+    na::ref_ptr<payload, counter_policy> q = p1;
+
+    for (auto _ : state)
+    {
+        q = p2;
+        benchmark::DoNotOptimize(q);
+        q = p1;
+        benchmark::DoNotOptimize(q);
+    }
+
+    state.SetItemsProcessed(state.iterations() * 2);
+}
+
+// Move constructs into a second slot and destroys the moved-from ref_ptr, which is what a container does on growth
+template <typename counter_policy> void move_construct(benchmark::State &state)
+{
+    using ptr_type = na::ref_ptr<payload, counter_policy>;
+
+    na::referable<payload, counter_policy> r{{1, 2.0}};
+    alignas(ptr_type) unsigned char storage[2][sizeof(ptr_type)];
+    ptr_type *from = new (storage[0]) ptr_type{r};
+    ptr_type *to = reinterpret_cast<ptr_type *>(storage[1]);
+
+    for (auto _ : state)
+    {
+        to = new (to) ptr_type{std::move(*from)};
+        from->~ptr_type();
+        std::swap(from, to);
+        benchmark::DoNotOptimize(from);
+    }
+
+    from->~ptr_type();
+}
+
+template <typename counter_policy> void move_assign(benchmark::State &state)
+{
+    na::referable<payload, counter_policy> r{{1, 2.0}};
+    na::ref_ptr<payload, counter_policy> p = r;
+    na::ref_ptr<payload, counter_policy> q;
+
+    for (auto _ : state)
+    {
+        q = std::move(p);
+        benchmark::DoNotOptimize(q);
+        p = std::move(q);
+        benchmark::DoNotOptimize(p);
+    }
+
+    state.SetItemsProcessed(state.iterations() * 2);
+}
+
+template <typename counter_policy> void destroy(benchmark::State &state)
+{
+    na::referable<payload, counter_policy> r{{1, 2.0}};
+    std::vector<na::ref_ptr<payload, counter_policy>> refs;
+    refs.reserve(batch_size);
+
+    for (auto _ : state)
+    {
+        state.PauseTiming();
+        for (std::size_t i = 0; i < batch_size; ++i)
+        {
+            refs.emplace_back(r);
+        }
+        state.ResumeTiming();
+
+        refs.clear();
+        benchmark::ClobberMemory();
+    }
+
+    state.SetItemsProcessed(state.iterations() * batch_size);
+}
+
+// Fans a referable out to a batch of ref_ptrs one by one and with make_refs/release_refs
+template <typename counter_policy> void fan_out(benchmark::State &state)
+{
+    na::referable<payload, counter_policy> r{{1, 2.0}};
+    std::vector<na::ref_ptr<payload, counter_policy>> refs(batch_size);
+
+    for (auto _ : state)
+    {
+        for (auto &p : refs)
+        {
+            p = r;
+        }
+        benchmark::ClobberMemory();
+
+        for (auto &p : refs)
+        {
+            p.reset();
+        }
+        benchmark::ClobberMemory();
+    }
+
+    state.SetItemsProcessed(state.iterations() * batch_size);
+}
+
+template <typename counter_policy> void fan_out_bulk(benchmark::State &state)
+{
+    na::referable<payload, counter_policy> r{{1, 2.0}};
+    std::vector<na::ref_ptr<payload, counter_policy>> refs(batch_size);
+
+    for (auto _ : state)
+    {
+        na::make_refs(r, refs.begin(), refs.end());
+        benchmark::ClobberMemory();
+
+        na::release_refs(refs.begin(), refs.end());
+        benchmark::ClobberMemory();
+    }
+
+    state.SetItemsProcessed(state.iterations() * batch_size);
+}
+
+template <typename counter_policy> void member_pointer_from_referable(benchmark::State &state)
+{
+    na::referable<payload, counter_policy> r{{1, 2.0}};
+
+    for (auto _ : state)
+    {
+        na::ref_ptr<double, counter_policy> p{r, &payload::b};
+        benchmark::DoNotOptimize(p);
+    }
+}
+
+template <typename counter_policy> void member_pointer_from_ref_ptr(benchmark::State &state)
+{
+    na::referable<payload, counter_policy> r{{1, 2.0}};
+    na::ref_ptr<payload, counter_policy> p = r;
+
+    for (auto _ : state)
+    {
+        na::ref_ptr<double, counter_policy> q{p, &payload::b};
+        benchmark::DoNotOptimize(q);
+    }
+}
+
+struct nested
+{
+    struct inner
+    {
+        payload p;
+    } in;
+};
+
+// Reaches r->in.p.b one member pointer at a time, adding a reference per step
+template <typename counter_policy> void member_pointer_chain(benchmark::State &state)
+{
+    na::referable<nested, counter_policy> r{nested{}};
+
+    for (auto _ : state)
+    {
+        na::ref_ptr<nested::inner, counter_policy> in{r, &nested::in};
+        na::ref_ptr<payload, counter_policy> p{in, &nested::inner::p};
+        na::ref_ptr<double, counter_policy> q{p, &payload::b};
+        benchmark::DoNotOptimize(q);
+    }
+}
+
+// Reaches r->in.p.b with a single reference
+template <typename counter_policy> void member_pointer_path(benchmark::State &state)
+{
+    na::referable<nested, counter_policy> r{nested{}};
+
+    for (auto _ : state)
+    {
+        na::ref_ptr<double, counter_policy> q{r, na::static_path<&nested::in, &nested::inner::p, &payload::b>{}};
+        benchmark::DoNotOptimize(q);
+    }
+}
+
+template <typename counter_policy> void ref_from_this(benchmark::State &state)
+{
+    service<counter_policy> s;
+
+    for (auto _ : state)
+    {
+        auto p = s.ref_from_this();
+        benchmark::DoNotOptimize(p);
+    }
+}
+
+template <typename counter_policy> void borrow(benchmark::State &state)
+{
+    na::referable<payload, counter_policy> r{{1, 2.0}};
+    na::ref_ptr<payload, counter_policy> p = r;
+
+    for (auto _ : state)
+    {
+        na::ref_view<payload, counter_policy> v = p.borrow();
+        benchmark::DoNotOptimize(v->a);
+    }
+}
+
+// Moves batch_size ref_ptrs back and forth between two buffers, the way a vector grows
+template <typename counter_policy, bool relocate> void move_batch(benchmark::State &state)
+{
+    using ref_type = na::ref_ptr<payload, counter_policy>;
+
+    na::referable<payload, counter_policy> r{{1, 2.0}};
+    alignas(ref_type) unsigned char storage[2][batch_size * sizeof(ref_type)];
+    ref_type *from = reinterpret_cast<ref_type *>(storage[0]);
+    ref_type *to = reinterpret_cast<ref_type *>(storage[1]);
+
+    for (std::size_t i = 0; i < batch_size; ++i)
+    {
+        std::construct_at(from + i, r);
+    }
+
+    for (auto _ : state)
+    {
+        if constexpr (relocate)
+        {
+            na::relocate_range(from, from + batch_size, to);
+        }
+        else
+        {
+            for (std::size_t i = 0; i < batch_size; ++i)
+            {
+                std::construct_at(to + i, std::move(from[i]));
+                std::destroy_at(from + i);
+            }
+        }
+
+        benchmark::DoNotOptimize(to);
+        std::swap(from, to);
+    }
+
+    std::destroy_n(from, batch_size);
+}
+
+template <typename counter_policy> void move_construct_batch(benchmark::State &state)
+{
+    move_batch<counter_policy, false>(state);
+}
+
+template <typename counter_policy> void relocate_batch(benchmark::State &state)
+{
+    move_batch<counter_policy, true>(state);
+}
+
+constexpr std::size_t scan_size = 4096;
+
+// Sums a field over an array of referables, each carrying its own counter
+template <typename counter_policy> void scan_referables(benchmark::State &state)
+{
+    std::vector<na::referable<payload, counter_policy>> values;
+    values.reserve(scan_size);
+    for (std::size_t i = 0; i < scan_size; ++i)
+    {
+        values.emplace_back(payload{1, 2.0});
+    }
+
+    for (auto _ : state)
+    {
+        int sum = 0;
+        for (const auto &value : values)
+        {
+            sum += value->a;
+        }
+        benchmark::DoNotOptimize(sum);
+    }
+}
+
+// Sums a field over a referable_array, whose elements share one counter
+template <typename counter_policy> void scan_referable_array(benchmark::State &state)
+{
+    na::referable_array<payload, counter_policy> values(scan_size, payload{1, 2.0});
+
+    for (auto _ : state)
+    {
+        int sum = 0;
+        for (const auto &value : values)
+        {
+            sum += value.a;
+        }
+        benchmark::DoNotOptimize(sum);
+    }
+}
+
+struct receiver
+{
+    int sum = 0;
+
+    void on_value(int v)
+    {
+        sum += v;
+    }
+};
+
+// Emits to 8 connected slots
+template <typename counter_policy> void signal_emit(benchmark::State &state)
+{
+    na::referable<receiver, counter_policy> r{receiver{}};
+    na::signal<int> sig;
+
+    for (int i = 0; i < 8; ++i)
+    {
+        sig.connect(na::ref_ptr<receiver, counter_policy>{r}, &receiver::on_value);
+    }
+
+    for (auto _ : state)
+    {
+        sig.emit(1);
+    }
+
+    benchmark::DoNotOptimize(r->sum);
+    sig.disconnect_all();
+}
+
+template <typename counter_policy> void construct_from_shared_referable(benchmark::State &state)
+{
+    for (auto _ : state)
+    {
+        na::ref_ptr<payload, counter_policy> p = shared_referable<counter_policy>;
+        benchmark::DoNotOptimize(p);
+    }
+}
+
+template <typename counter_policy> void copy_construct_shared(benchmark::State &state)
+{
+    for (auto _ : state)
+    {
+        na::ref_ptr<payload, counter_policy> q = shared_ref_ptr<counter_policy>;
+        benchmark::DoNotOptimize(q);
+    }
+}
+
+template <typename counter_policy>
+na::atomic_ref_ptr<payload, counter_policy> shared_atomic_ref_ptr{shared_ref_ptr<counter_policy>};
+
+template <typename counter_policy> void load_shared_atomic(benchmark::State &state)
+{
+    for (auto _ : state)
+    {
+        na::ref_ptr<payload, counter_policy> q = shared_atomic_ref_ptr<counter_policy>.load();
+        benchmark::DoNotOptimize(q);
+    }
+}
+
+template <typename counter_policy>
+na::versioned_referable<payload, counter_policy> shared_versioned_referable{payload{1, 2.0}};
+
+template <typename counter_policy> void load_shared_versioned(benchmark::State &state)
+{
+    for (auto _ : state)
+    {
+        na::ref_ptr<const payload, counter_policy> q = shared_versioned_referable<counter_policy>.load();
+        benchmark::DoNotOptimize(q);
+    }
+}
+
+// Thread 0 keeps copying a ref_ptr to the shared referable while the other threads read the value, which shows the
+// false sharing between the count and the value
+template <typename counter_policy> void read_while_copying(benchmark::State &state)
+{
+    const auto &p = shared_ref_ptr<counter_policy>;
+
+    if (state.thread_index() == 0)
+    {
+        for (auto _ : state)
+        {
+            na::ref_ptr<payload, counter_policy> q = p;
+            benchmark::DoNotOptimize(q);
+        }
+    }
+    else
+    {
+        for (auto _ : state)
+        {
+            benchmark::DoNotOptimize(p->a);
+        }
+    }
+}
+
+na_ref_ptr_benchmark(construct_from_referable, seq_cst_counter);
+na_ref_ptr_benchmark(construct_from_referable, relaxed_counter);
+na_ref_ptr_benchmark(construct_from_referable, unsynchronized_counter);
+
+na_ref_ptr_benchmark(copy_construct, seq_cst_counter);
+na_ref_ptr_benchmark(copy_construct, relaxed_counter);
+na_ref_ptr_benchmark(copy_construct, unsynchronized_counter);
+na_ref_ptr_benchmark(copy_construct, profiled_counter<>);
+
+na_ref_ptr_benchmark(copy_construct_pooled, seq_cst_counter);
+na_ref_ptr_benchmark(copy_construct_pooled, relaxed_counter);
+
+na_ref_ptr_benchmark(copy_assign, seq_cst_counter);
+na_ref_ptr_benchmark(copy_assign, relaxed_counter);
+na_ref_ptr_benchmark(copy_assign, unsynchronized_counter);
+
+na_ref_ptr_benchmark(move_construct, seq_cst_counter);
+na_ref_ptr_benchmark(move_construct, relaxed_counter);
+na_ref_ptr_benchmark(move_construct, unsynchronized_counter);
+
+na_ref_ptr_benchmark(move_assign, seq_cst_counter);
+na_ref_ptr_benchmark(move_assign, relaxed_counter);
+na_ref_ptr_benchmark(move_assign, unsynchronized_counter);
+
+na_ref_ptr_benchmark(destroy, seq_cst_counter);
+na_ref_ptr_benchmark(destroy, relaxed_counter);
+na_ref_ptr_benchmark(destroy, unsynchronized_counter);
+
+na_ref_ptr_benchmark(fan_out, seq_cst_counter);
+na_ref_ptr_benchmark(fan_out_bulk, seq_cst_counter);
+
+na_ref_ptr_benchmark(member_pointer_from_referable, seq_cst_counter);
+na_ref_ptr_benchmark(member_pointer_from_referable, relaxed_counter);
+na_ref_ptr_benchmark(member_pointer_from_referable, unsynchronized_counter);
+
+na_ref_ptr_benchmark(member_pointer_from_ref_ptr, seq_cst_counter);
+na_ref_ptr_benchmark(member_pointer_from_ref_ptr, relaxed_counter);
+na_ref_ptr_benchmark(member_pointer_from_ref_ptr, unsynchronized_counter);
+
+na_ref_ptr_benchmark(member_pointer_chain, seq_cst_counter);
+na_ref_ptr_benchmark(member_pointer_path, seq_cst_counter);
+
+na_ref_ptr_benchmark(ref_from_this, seq_cst_counter);
+na_ref_ptr_benchmark(ref_from_this, relaxed_counter);
+na_ref_ptr_benchmark(ref_from_this, unsynchronized_counter);
+
+na_ref_ptr_benchmark(borrow, seq_cst_counter);
+
+na_ref_ptr_benchmark(signal_emit, seq_cst_counter);
+
+na_ref_ptr_benchmark(move_construct_batch, seq_cst_counter);
+na_ref_ptr_benchmark(relocate_batch, seq_cst_counter);
+
+na_ref_ptr_benchmark(scan_referables, seq_cst_counter);
+na_ref_ptr_benchmark(scan_referable_array, seq_cst_counter);
+
+// unsynchronized_counter can not be shared between threads
+na_ref_ptr_benchmark(construct_from_shared_referable, seq_cst_counter)->ThreadRange(1, 16)->UseRealTime();
+na_ref_ptr_benchmark(construct_from_shared_referable, relaxed_counter)->ThreadRange(1, 16)->UseRealTime();
+na_ref_ptr_benchmark(construct_from_shared_referable, distributed_counter<>)->ThreadRange(1, 16)->UseRealTime();
+
+na_ref_ptr_benchmark(copy_construct_shared, seq_cst_counter)->ThreadRange(1, 16)->UseRealTime();
+na_ref_ptr_benchmark(copy_construct_shared, relaxed_counter)->ThreadRange(1, 16)->UseRealTime();
+na_ref_ptr_benchmark(copy_construct_shared, distributed_counter<>)->ThreadRange(1, 16)->UseRealTime();
+na_ref_ptr_benchmark(copy_construct_shared, profiled_counter<>)->ThreadRange(1, 16)->UseRealTime();
+
+na_ref_ptr_benchmark(load_shared_atomic, seq_cst_counter)->ThreadRange(1, 16)->UseRealTime();
+na_ref_ptr_benchmark(load_shared_versioned, seq_cst_counter)->ThreadRange(1, 16)->UseRealTime();
+
+na_ref_ptr_benchmark(read_while_copying, seq_cst_counter)->ThreadRange(2, 16)->UseRealTime();
+na_ref_ptr_benchmark(read_while_copying, isolated_counter<>)->ThreadRange(2, 16)->UseRealTime();
+
+} // namespace na_ref_ptr_benchmark_suit
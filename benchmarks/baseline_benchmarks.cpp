@@ -0,0 +1,180 @@
+// Copyright (c) 2023 Namal Bambarasinghe
+//
+// This software is released under the MIT License.
+// https://opensource.org/licenses/MIT
+
+// Raw pointer and std::shared_ptr equivalents of the ref_ptr benchmarks in all_benchmarks.inl
+
+#include <benchmark/benchmark.h>
+
+#include <memory>
+#include <new>
+#include <vector>
+
+namespace baseline
+{
+
+struct payload
+{
+    int a;
+    double b;
+};
+
+payload shared_value{1, 2.0};
+std::shared_ptr<payload> shared_shared_ptr = std::make_shared<payload>(payload{1, 2.0});
+
+constexpr std::size_t batch_size = 256;
+
+void raw_pointer_copy(benchmark::State &state)
+{
+    payload value{1, 2.0};
+    payload *p = &value;
+
+    for (auto _ : state)
+    {
+        payload *q = p;
+        benchmark::DoNotOptimize(q);
+    }
+}
+
+void raw_pointer_member_pointer(benchmark::State &state)
+{
+    payload value{1, 2.0};
+    payload *p = &value;
+
+    for (auto _ : state)
+    {
+        double *q = &(p->*(&payload::b));
+        benchmark::DoNotOptimize(q);
+    }
+}
+
+void shared_ptr_copy_construct(benchmark::State &state)
+{
+    auto p = std::make_shared<payload>(payload{1, 2.0});
+
+    for (auto _ : state)
+    {
+        std::shared_ptr<payload> q = p;
+        benchmark::DoNotOptimize(q);
+    }
+}
+
+void shared_ptr_copy_assign(benchmark::State &state)
+{
+    auto p1 = std::make_shared<payload>(payload{1, 2.0});
+    auto p2 = std::make_shared<payload>(payload{3, 4.0});
+    std::shared_ptr<payload> q = p1;
+
+    for (auto _ : state)
+    {
+        q = p2;
+        benchmark::DoNotOptimize(q);
+        q = p1;
+        benchmark::DoNotOptimize(q);
+    }
+
+    state.SetItemsProcessed(state.iterations() * 2);
+}
+
+void shared_ptr_move_construct(benchmark::State &state)
+{
+    using ptr_type = std::shared_ptr<payload>;
+
+    alignas(ptr_type) unsigned char storage[2][sizeof(ptr_type)];
+    ptr_type *from = new (storage[0]) ptr_type{std::make_shared<payload>(payload{1, 2.0})};
+    ptr_type *to = reinterpret_cast<ptr_type *>(storage[1]);
+
+    for (auto _ : state)
+    {
+        to = new (to) ptr_type{std::move(*from)};
+        from->~ptr_type();
+        std::swap(from, to);
+        benchmark::DoNotOptimize(from);
+    }
+
+    from->~ptr_type();
+}
+
+void shared_ptr_move_assign(benchmark::State &state)
+{
+    auto p = std::make_shared<payload>(payload{1, 2.0});
+    std::shared_ptr<payload> q;
+
+    for (auto _ : state)
+    {
+        q = std::move(p);
+        benchmark::DoNotOptimize(q);
+        p = std::move(q);
+        benchmark::DoNotOptimize(p);
+    }
+
+    state.SetItemsProcessed(state.iterations() * 2);
+}
+
+void shared_ptr_destroy(benchmark::State &state)
+{
+    auto p = std::make_shared<payload>(payload{1, 2.0});
+    std::vector<std::shared_ptr<payload>> refs;
+    refs.reserve(batch_size);
+
+    for (auto _ : state)
+    {
+        state.PauseTiming();
+        for (std::size_t i = 0; i < batch_size; ++i)
+        {
+            refs.emplace_back(p);
+        }
+        state.ResumeTiming();
+
+        refs.clear();
+        benchmark::ClobberMemory();
+    }
+
+    state.SetItemsProcessed(state.iterations() * batch_size);
+}
+
+void shared_ptr_aliasing(benchmark::State &state)
+{
+    auto p = std::make_shared<payload>(payload{1, 2.0});
+
+    for (auto _ : state)
+    {
+        std::shared_ptr<double> q{p, &p->b};
+        benchmark::DoNotOptimize(q);
+    }
+}
+
+void raw_pointer_copy_shared(benchmark::State &state)
+{
+    for (auto _ : state)
+    {
+        payload *q = &shared_value;
+        benchmark::DoNotOptimize(q);
+    }
+}
+
+void shared_ptr_copy_construct_shared(benchmark::State &state)
+{
+    for (auto _ : state)
+    {
+        std::shared_ptr<payload> q = shared_shared_ptr;
+        benchmark::DoNotOptimize(q);
+    }
+}
+
+BENCHMARK(raw_pointer_copy)->Name("baseline/raw_pointer_copy");
+BENCHMARK(raw_pointer_member_pointer)->Name("baseline/raw_pointer_member_pointer");
+BENCHMARK(shared_ptr_copy_construct)->Name("baseline/shared_ptr_copy_construct");
+BENCHMARK(shared_ptr_copy_assign)->Name("baseline/shared_ptr_copy_assign");
+BENCHMARK(shared_ptr_move_construct)->Name("baseline/shared_ptr_move_construct");
+BENCHMARK(shared_ptr_move_assign)->Name("baseline/shared_ptr_move_assign");
+BENCHMARK(shared_ptr_destroy)->Name("baseline/shared_ptr_destroy");
+BENCHMARK(shared_ptr_aliasing)->Name("baseline/shared_ptr_aliasing");
+BENCHMARK(raw_pointer_copy_shared)->Name("baseline/raw_pointer_copy_shared")->ThreadRange(1, 16)->UseRealTime();
+BENCHMARK(shared_ptr_copy_construct_shared)
+    ->Name("baseline/shared_ptr_copy_construct_shared")
+    ->ThreadRange(1, 16)
+    ->UseRealTime();
+
+} // namespace baseline
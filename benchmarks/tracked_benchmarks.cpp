@@ -0,0 +1,8 @@
+// Copyright (c) 2023 Namal Bambarasinghe
+//
+// This software is released under the MIT License.
+// https://opensource.org/licenses/MIT
+
+#define na_ref_ptr_tracked
+#define na_ref_ptr_benchmark_suit tracked
+#include "all_benchmarks.inl"
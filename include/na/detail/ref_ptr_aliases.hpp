@@ -0,0 +1,213 @@
+// Copyright (c) 2023 Namal Bambarasinghe
+//
+// This software is released under the MIT License.
+// https://opensource.org/licenses/MIT
+
+#ifndef NA_REF_PTR_ALIASES_HPP
+#define NA_REF_PTR_ALIASES_HPP
+
+// The names of the selected implementation, included by na/ref_ptr_core.hpp or na/ref_ptr.hpp after the
+// implementations they compile, must not be included directly. The aliases to the types the core header does not
+// define name them for the full header.
+
+namespace na
+{
+
+namespace detail
+{
+
+#if defined(na_ref_ptr_uncounted)
+namespace selected = uncounted;
+#elif defined(na_ref_ptr_counted)
+namespace selected = counted;
+#elif defined(na_ref_ptr_sampled)
+namespace selected = sampled;
+#else
+namespace selected = tracked;
+#endif
+
+} // namespace detail
+
+/// @brief Implementation tags for the basic_ aliases, see ref_ptr for the implementations. na/ref_ptr.hpp adds
+/// na::sampled and na::tracked.
+using uncounted = detail::uncounted::implementation;
+using counted = detail::counted::implementation;
+
+/// @brief The implementation selected by the na_ref_ptr_ macros, which the aliases without basic_ use.
+using default_implementation = detail::selected::implementation;
+
+template <typename type, typename counter_policy = seq_cst_counter>
+using referable = detail::selected::referable<type, counter_policy>;
+template <typename type, typename counter_policy = seq_cst_counter>
+using enable_ref_from_this = detail::selected::enable_ref_from_this<type, counter_policy>;
+template <typename type, typename counter_policy = seq_cst_counter>
+using ref_ptr = detail::selected::ref_ptr<type, counter_policy>;
+template <typename type, typename counter_policy = seq_cst_counter>
+using ref_view = detail::selected::ref_view<type, counter_policy>;
+template <typename type, typename counter_policy = seq_cst_counter>
+using weakly_referable = detail::selected::weakly_referable<type, counter_policy>;
+template <typename type, typename counter_policy = seq_cst_counter>
+using enable_weak_ref_from_this = detail::selected::enable_weak_ref_from_this<type, counter_policy>;
+template <typename type, typename counter_policy = seq_cst_counter>
+using weak_ref = detail::selected::weak_ref<type, counter_policy>;
+template <typename type, typename counter_policy = draining_counter>
+using draining_referable = detail::selected::draining_referable<type, counter_policy>;
+template <typename type, typename counter_policy = seq_cst_counter>
+using referable_pool = detail::selected::referable_pool<type, counter_policy>;
+template <typename type, typename counter_policy = seq_cst_counter>
+using pooled_ref = detail::selected::pooled_ref<type, counter_policy>;
+template <typename type, typename counter_policy = seq_cst_counter>
+using referable_array = detail::selected::referable_array<type, counter_policy>;
+template <typename type, typename counter_policy = seq_cst_counter>
+using atomic_ref_ptr = detail::selected::atomic_ref_ptr<type, counter_policy>;
+template <typename type, typename counter_policy = seq_cst_counter>
+using versioned_referable = detail::selected::versioned_referable<type, counter_policy>;
+template <typename... arg_types> using signal = detail::selected::signal<arg_types...>;
+using detail::selected::static_ref_cast;
+using detail::selected::dynamic_ref_cast;
+using detail::selected::const_ref_cast;
+
+template <typename type, typename implementation = default_implementation, typename counter_policy = seq_cst_counter>
+using basic_referable = typename implementation::template referable<type, counter_policy>;
+template <typename type, typename implementation = default_implementation, typename counter_policy = seq_cst_counter>
+using basic_enable_ref_from_this = typename implementation::template enable_ref_from_this<type, counter_policy>;
+template <typename type, typename implementation = default_implementation, typename counter_policy = seq_cst_counter>
+using basic_ref_ptr = typename implementation::template ref_ptr<type, counter_policy>;
+template <typename type, typename implementation = default_implementation, typename counter_policy = seq_cst_counter>
+using basic_ref_view = typename implementation::template ref_view<type, counter_policy>;
+template <typename type, typename implementation = default_implementation, typename counter_policy = seq_cst_counter>
+using basic_weakly_referable = typename implementation::template weakly_referable<type, counter_policy>;
+template <typename type, typename implementation = default_implementation, typename counter_policy = seq_cst_counter>
+using basic_enable_weak_ref_from_this =
+    typename implementation::template enable_weak_ref_from_this<type, counter_policy>;
+template <typename type, typename implementation = default_implementation, typename counter_policy = seq_cst_counter>
+using basic_weak_ref = typename implementation::template weak_ref<type, counter_policy>;
+template <typename type, typename implementation = default_implementation, typename counter_policy = draining_counter>
+using basic_draining_referable = typename implementation::template draining_referable<type, counter_policy>;
+template <typename type, typename implementation = default_implementation, typename counter_policy = seq_cst_counter>
+using basic_referable_pool = typename implementation::template referable_pool<type, counter_policy>;
+template <typename type, typename implementation = default_implementation, typename counter_policy = seq_cst_counter>
+using basic_pooled_ref = typename implementation::template pooled_ref<type, counter_policy>;
+template <typename type, typename implementation = default_implementation, typename counter_policy = seq_cst_counter>
+using basic_referable_array = typename implementation::template referable_array<type, counter_policy>;
+template <typename type, typename implementation = default_implementation, typename counter_policy = seq_cst_counter>
+using basic_atomic_ref_ptr = typename implementation::template atomic_ref_ptr<type, counter_policy>;
+template <typename type, typename implementation = default_implementation, typename counter_policy = seq_cst_counter>
+using basic_versioned_referable = typename implementation::template versioned_referable<type, counter_policy>;
+template <typename implementation, typename... arg_types>
+using basic_signal = typename implementation::template signal<arg_types...>;
+
+namespace detail
+{
+
+#if defined(__has_builtin)
+#if __has_builtin(__is_trivially_relocatable)
+#define na_ref_ptr_has_builtin_trivially_relocatable
+#endif
+#endif
+
+template <typename type> inline constexpr bool compiler_trivially_relocatable =
+#if defined(na_ref_ptr_has_builtin_trivially_relocatable)
+    __is_trivially_relocatable(type);
+#else
+    false;
+#endif
+
+#undef na_ref_ptr_has_builtin_trivially_relocatable
+
+} // namespace detail
+
+/// @brief Whether a value can be moved to new storage, ending the old object without destroying it, by copying its
+/// bytes.
+///
+/// Trivially copyable types and the types the compiler knows to be trivially relocatable are. The ref_ptrs and
+/// pooled_refs of the uncounted and counted implementations are specialized to be, since they only hold pointers and
+/// ids. The tracked ones link their own address into the reference lists and are not.
+template <typename type>
+struct is_trivially_relocatable
+    : std::bool_constant<std::is_trivially_copyable_v<type> || detail::compiler_trivially_relocatable<type>>
+{
+};
+
+template <typename type, typename counter_policy>
+struct is_trivially_relocatable<detail::uncounted::ref_ptr<type, counter_policy>> : std::true_type
+{
+};
+
+template <typename type, typename counter_policy>
+struct is_trivially_relocatable<detail::counted::ref_ptr<type, counter_policy>> : std::true_type
+{
+};
+
+template <typename type, typename counter_policy>
+struct is_trivially_relocatable<detail::uncounted::pooled_ref<type, counter_policy>> : std::true_type
+{
+};
+
+template <typename type, typename counter_policy>
+struct is_trivially_relocatable<detail::counted::pooled_ref<type, counter_policy>> : std::true_type
+{
+};
+
+template <typename type> inline constexpr bool is_trivially_relocatable_v = is_trivially_relocatable<type>::value;
+
+/// @brief Relocates a range of values into uninitialized storage. The values are moved to the new storage and the old
+/// objects end without being destroyed, so the old storage can be reused or freed.
+///
+/// Trivially relocatable values are copied with a single memmove. The ref_ptrs of the tracked and sampled
+/// implementations hand their places in the reference lists over to their new addresses in one pass, locking each
+/// shard once for consecutive ref_ptrs in the same shard. Other values are move constructed and destroyed one by one.
+/// The ranges may overlap, so this can also shift the elements of an array, for example to grow or erase from it. A
+/// range relocated onto itself is left as it is.
+/// @param first The first value to relocate
+/// @param last One past the last value
+/// @param dest The storage to relocate the first value to
+/// @return One past the last relocated value
+template <typename type> type *relocate_range(type *first, type *last, type *dest) noexcept
+{
+    const std::size_t count = static_cast<std::size_t>(last - first);
+
+    // The values are already there, and relocating a value onto itself would overwrite it while it is read
+    if (count == 0 || dest == first)
+    {
+        return dest + count;
+    }
+
+    if constexpr (is_trivially_relocatable_v<type>)
+    {
+        std::memmove(static_cast<void *>(dest), static_cast<const void *>(first), count * sizeof(type));
+    }
+    else if constexpr (requires { relocate(first, last, dest); })
+    {
+        // Found through argument dependent lookup
+        relocate(first, last, dest);
+    }
+    else
+    {
+        static_assert(std::is_nothrow_move_constructible_v<type>, "relocate_range can not undo a throwing move");
+
+        if (dest > first && dest < last)
+        {
+            // Shifting right, start from the end so that no value is overwritten before it is moved
+            for (std::size_t i = count; i != 0; --i)
+            {
+                std::construct_at(dest + i - 1, std::move(first[i - 1]));
+                std::destroy_at(first + i - 1);
+            }
+        }
+        else
+        {
+            for (std::size_t i = 0; i != count; ++i)
+            {
+                std::construct_at(dest + i, std::move(first[i]));
+                std::destroy_at(first + i);
+            }
+        }
+    }
+
+    return dest + count;
+}
+
+} // namespace na
+
+#endif // NA_REF_PTR_ALIASES_HPP
@@ -0,0 +1,555 @@
+// Copyright (c) 2023 Namal Bambarasinghe
+//
+// This software is released under the MIT License.
+// https://opensource.org/licenses/MIT
+
+#ifndef NA_REF_PTR_CORE_DEFINITIONS_HPP
+#define NA_REF_PTR_CORE_DEFINITIONS_HPP
+
+// The macros and the types that na/ref_ptr_core.hpp and na/ref_ptr.hpp share, must not be included directly
+
+#if !defined(na_ref_ptr_uncounted) && !defined(na_ref_ptr_counted) && !defined(na_ref_ptr_tracked) &&                 \
+    !defined(na_ref_ptr_sampled)
+
+// ref_ptr implementation is not defined, define the default below
+
+#ifdef NDEBUG
+#define na_ref_ptr_counted // defaults to counted in the release build
+#else
+#define na_ref_ptr_tracked // defaults to tracked in the debug build
+#endif
+
+#endif
+
+#if defined(na_ref_ptr_sampled) && !defined(na_ref_ptr_tracked)
+// The sampled implementation is the tracked implementation that only lists a sample of the references
+#define na_ref_ptr_tracked
+#endif
+
+// All the implementations are compiled in every translation unit, so the following must be defined the same in all of
+// them
+
+#if !defined(na_ref_ptr_sample_rate)
+// One in na_ref_ptr_sample_rate references is listed in the referable after free message
+#define na_ref_ptr_sample_rate 16
+#endif
+
+#if !defined(na_ref_ptr_tracked_shards)
+// Number of shards the tracked implementation splits the reference list of a referable into, an integer literal
+#define na_ref_ptr_tracked_shards 1
+#endif
+
+// The tracked and sampled implementations are compiled in an inline namespace named after the shard count, so that
+// translation units compiled with different shard counts get different types instead of silently breaking the one
+// definition rule, and fail to link where they pass the types to each other. MSVC also checks the count at link time.
+#define na_ref_ptr_shards_namespace_name(shards) tracked_shards_##shards
+#define na_ref_ptr_shards_namespace(shards) na_ref_ptr_shards_namespace_name(shards)
+
+#if defined(_MSC_VER)
+#define na_ref_ptr_shards_string_value(shards) #shards
+#define na_ref_ptr_shards_string(shards) na_ref_ptr_shards_string_value(shards)
+#pragma detect_mismatch("na_ref_ptr_tracked_shards", na_ref_ptr_shards_string(na_ref_ptr_tracked_shards))
+#endif
+
+// Defining na_ref_ptr_stack_traces makes the tracked and sampled implementations capture the stack where each listed
+// reference is added, and list the first na_ref_ptr_stack_trace_depth frames outside the library in the reports
+#if defined(na_ref_ptr_stack_traces) && !defined(na_ref_ptr_stack_trace_depth)
+#define na_ref_ptr_stack_trace_depth 8
+#endif
+
+// Defining na_ref_ptr_live_referables registers every tracked and sampled referable in a list for
+// write_live_referables(), which costs a lock and a list node per referable
+
+// Defining na_ref_ptr_deferred_releases makes the counted ref_ptrs destroyed inside a deferred_release_scope coalesce
+// their count decrements in a buffer of the thread
+
+#if !defined(na_ref_ptr_contention_sample_rate)
+// One in na_ref_ptr_contention_sample_rate operations of each thread on a profiled_counter is timed
+#define na_ref_ptr_contention_sample_rate 64
+#endif
+
+// The ref_ptrs of the uncounted and counted implementations are only pointers and can be passed in registers and
+// relocated by copying their bytes
+#if defined(__has_cpp_attribute)
+#if __has_cpp_attribute(clang::trivial_abi)
+#define na_ref_ptr_trivial_abi [[clang::trivial_abi]]
+#endif
+#endif
+#if !defined(na_ref_ptr_trivial_abi)
+#define na_ref_ptr_trivial_abi
+#endif
+
+// Defining na_ref_ptr_out_of_line_handler in all translation units declares the referable after free handler without
+// defining it, so that the reports compile to a single call. One translation unit defines na_ref_ptr_define_handler
+// too before including the header, and the handler is defined there.
+
+#include <atomic>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <exception>
+#include <iterator>
+#include <memory>
+#include <new>
+#include <string_view>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+
+namespace na
+{
+
+/// @brief Allocation free referable after free handler.
+/// @param context The context pointer given to set_referable_after_free_handler()
+/// @param message The referable after free message, only valid during the call
+using referable_after_free_handler_function = void (*)(void *context, std::string_view message);
+
+namespace detail
+{
+// Fixed instead of std::hardware_destructive_interference_size, which is not guaranteed to be stable across compiler
+// flags and therefore not suitable for a layout in a header
+inline constexpr std::size_t cache_line_size = 64;
+
+/// @brief Returns a small index of the calling thread. Threads are numbered in the order they first call this.
+inline std::size_t this_thread_index() noexcept
+{
+    static std::atomic_size_t next_index{0};
+    thread_local const std::size_t index = next_index.fetch_add(1, std::memory_order_relaxed);
+    return index;
+}
+
+// A published handler, never modified or freed after it is published so that it can be called without locking while
+// another thread replaces it. Replaced handlers stay reachable through previous.
+struct referable_after_free_handler_record
+{
+    referable_after_free_handler_function function;
+    void *context;
+    const referable_after_free_handler_record *previous;
+};
+
+#if defined(na_ref_ptr_out_of_line_handler) && !defined(na_ref_ptr_define_handler)
+
+extern std::atomic<const referable_after_free_handler_record *> referable_after_free_handler_instance;
+
+void publish_referable_after_free_handler(referable_after_free_handler_record *record) noexcept;
+
+/// @brief Calls the current referable after free handler without locking or allocating.
+/// @param message The referable after free message
+void report_referable_after_free(std::string_view message);
+
+#else
+
+#if defined(na_ref_ptr_out_of_line_handler)
+#define na_ref_ptr_handler_linkage
+#else
+#define na_ref_ptr_handler_linkage inline
+#endif
+
+na_ref_ptr_handler_linkage void default_referable_after_free_handler(void *, std::string_view message)
+{
+    std::fwrite(message.data(), 1, message.size(), stderr);
+#if defined(_MSC_VER)
+    __debugbreak();
+#endif
+    std::terminate();
+}
+
+na_ref_ptr_handler_linkage const referable_after_free_handler_record default_referable_after_free_handler_record{
+    default_referable_after_free_handler, nullptr, nullptr};
+
+na_ref_ptr_handler_linkage std::atomic<const referable_after_free_handler_record *>
+    referable_after_free_handler_instance{&default_referable_after_free_handler_record};
+
+na_ref_ptr_handler_linkage void publish_referable_after_free_handler(referable_after_free_handler_record *record) noexcept
+{
+    record->previous = referable_after_free_handler_instance.load(std::memory_order_relaxed);
+    while (!referable_after_free_handler_instance.compare_exchange_weak(record->previous, record,
+                                                                         std::memory_order_acq_rel))
+    {
+    }
+}
+
+/// @brief Calls the current referable after free handler without locking or allocating.
+/// @param message The referable after free message
+na_ref_ptr_handler_linkage void report_referable_after_free(std::string_view message)
+{
+    const auto *record = referable_after_free_handler_instance.load(std::memory_order_acquire);
+    record->function(record->context, message);
+}
+
+#undef na_ref_ptr_handler_linkage
+
+#endif
+
+/// @brief Applies the deferred decrements of a counter before it is checked for zero, when na_ref_ptr_deferred_releases
+/// is defined. Defined in na/ref_ptr.hpp, which na/ref_ptr_core.hpp includes then.
+#if defined(na_ref_ptr_deferred_releases)
+inline void flush_deferred_releases_of(const void *counter) noexcept;
+#else
+inline void flush_deferred_releases_of(const void *) noexcept
+{
+}
+#endif
+
+// Lets the uncounted implementation be explicitly converted from the ref_ptrs and referables of the other
+// implementations
+template <typename type> inline constexpr bool is_checked_ref_source = false;
+
+} // namespace detail
+
+// Customization point for the referable after free handler
+// By default the message is written to stderr and std::terminate() is called.
+
+/// @brief Set a custom allocation free referable after free handler
+///
+/// Each call allocates a small record for the handler that is never freed, since another thread may still be calling
+/// the handler it replaces. Set the handler once or a bounded number of times, not in a loop.
+/// @param function New referable after free handler
+/// @param context Pointer passed to every call of the handler
+inline void set_referable_after_free_handler(referable_after_free_handler_function function, void *context = nullptr)
+{
+    detail::publish_referable_after_free_handler(
+        new detail::referable_after_free_handler_record{function, context, nullptr});
+}
+
+/// @brief Counter policy that uses sequentially consistent atomic operations to count the references.
+///
+/// This is the default counter policy. Every add_ref and remove_ref is a sequentially consistent read-modify-write.
+class seq_cst_counter
+{
+  public:
+    constexpr explicit seq_cst_counter(std::size_t count = 0) noexcept : count{count}
+    {
+    }
+
+    void add_ref() noexcept
+    {
+        count.fetch_add(1, std::memory_order_seq_cst);
+    }
+
+    void remove_ref() noexcept
+    {
+        count.fetch_sub(1, std::memory_order_seq_cst);
+    }
+
+    void add_refs(std::size_t n) noexcept
+    {
+        count.fetch_add(n, std::memory_order_seq_cst);
+    }
+
+    void remove_refs(std::size_t n) noexcept
+    {
+        count.fetch_sub(n, std::memory_order_seq_cst);
+    }
+
+    std::size_t use_count() const noexcept
+    {
+        return count.load(std::memory_order_seq_cst);
+    }
+
+  private:
+    std::atomic_size_t count;
+};
+
+/// @brief Counter policy that increments with relaxed ordering and decrements with acquire-release ordering.
+///
+/// A new reference can only be created from an existing reference or from the referable itself, so the increment does
+/// not need to synchronize with anything. The decrement releases the accesses made through the reference so that the
+/// zero check in the referable destructor, which loads with acquire ordering, happens after them.
+class relaxed_counter
+{
+  public:
+    constexpr explicit relaxed_counter(std::size_t count = 0) noexcept : count{count}
+    {
+    }
+
+    void add_ref() noexcept
+    {
+        count.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    void remove_ref() noexcept
+    {
+        count.fetch_sub(1, std::memory_order_acq_rel);
+    }
+
+    void add_refs(std::size_t n) noexcept
+    {
+        count.fetch_add(n, std::memory_order_relaxed);
+    }
+
+    void remove_refs(std::size_t n) noexcept
+    {
+        count.fetch_sub(n, std::memory_order_acq_rel);
+    }
+
+    std::size_t use_count() const noexcept
+    {
+        return count.load(std::memory_order_acquire);
+    }
+
+  private:
+    std::atomic_size_t count;
+};
+
+/// @brief Counter policy that uses a plain std::size_t to count the references.
+///
+/// Only use this policy for referables that are confined to a single thread, i.e. the referable and all the ref_ptrs
+/// pointing to it are created, copied and destroyed on the same thread.
+class unsynchronized_counter
+{
+  public:
+    constexpr explicit unsynchronized_counter(std::size_t count = 0) noexcept : count{count}
+    {
+    }
+
+    void add_ref() noexcept
+    {
+        ++count;
+    }
+
+    void remove_ref() noexcept
+    {
+        --count;
+    }
+
+    void add_refs(std::size_t n) noexcept
+    {
+        count += n;
+    }
+
+    void remove_refs(std::size_t n) noexcept
+    {
+        count -= n;
+    }
+
+    std::size_t use_count() const noexcept
+    {
+        return count;
+    }
+
+  private:
+    std::size_t count;
+};
+
+/// @brief Counter policy that spreads the count over per-thread slots so that threads copying ref_ptrs to the same
+/// referable do not contend on a single cache line.
+///
+/// Threads are assigned to the slots in round robin order and count on their own slot. A reference can be removed by
+/// another thread than the one that added it, so a single slot can wrap around and only the sum of all the slots is
+/// meaningful. use_count() sums the slots, which is exact when no other thread is changing the count, as is the case
+/// in the referable destructor. Each slot takes a cache line.
+///
+/// @tparam slot_count The number of slots
+template <std::size_t slot_count = 16> class distributed_counter
+{
+  public:
+    explicit distributed_counter(std::size_t count = 0) noexcept
+    {
+        slots[0].count.store(count, std::memory_order_relaxed);
+    }
+
+    void add_ref() noexcept
+    {
+        slots[detail::this_thread_index() % slot_count].count.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    void remove_ref() noexcept
+    {
+        slots[detail::this_thread_index() % slot_count].count.fetch_sub(1, std::memory_order_release);
+    }
+
+    void add_refs(std::size_t n) noexcept
+    {
+        slots[detail::this_thread_index() % slot_count].count.fetch_add(n, std::memory_order_relaxed);
+    }
+
+    void remove_refs(std::size_t n) noexcept
+    {
+        slots[detail::this_thread_index() % slot_count].count.fetch_sub(n, std::memory_order_release);
+    }
+
+    std::size_t use_count() const noexcept
+    {
+        std::size_t count = 0;
+        for (const slot &s : slots)
+        {
+            count += s.count.load(std::memory_order_acquire);
+        }
+
+        return count;
+    }
+
+  private:
+    struct alignas(detail::cache_line_size) slot
+    {
+        std::atomic_size_t count{0};
+    };
+
+    slot slots[slot_count];
+};
+
+/// @brief Counter policy that places the count of another counter policy on its own cache line.
+///
+/// The count of a referable is stored right before the value, so every ref_ptr copy invalidates the cache line holding
+/// the first bytes of the value in all the other cores reading the value. isolated_counter pads the count to a full
+/// cache line so that the value starts on the next one.
+///
+/// @tparam counter_policy The counter policy used to count the references
+template <typename counter_policy = seq_cst_counter> class alignas(detail::cache_line_size) isolated_counter
+{
+  public:
+    explicit isolated_counter(std::size_t count = 0) noexcept : counter{count}
+    {
+    }
+
+    void add_ref() noexcept
+    {
+        counter.add_ref();
+    }
+
+    void remove_ref() noexcept
+    {
+        counter.remove_ref();
+    }
+
+    void add_refs(std::size_t n) noexcept
+    {
+        counter.add_refs(n);
+    }
+
+    void remove_refs(std::size_t n) noexcept
+    {
+        counter.remove_refs(n);
+    }
+
+    std::size_t use_count() const noexcept
+    {
+        return counter.use_count();
+    }
+
+  private:
+    counter_policy counter;
+};
+
+
+class draining_counter;
+
+/// @brief An index step of a path, selecting an element of an array, std::array, std::vector, std::span or another
+/// sized range with operator[]. The counted and tracked implementations check the index against the size and call the
+/// referable after free handler if it is out of range.
+struct index
+{
+    constexpr explicit index(std::size_t i) noexcept : value{i}
+    {
+    }
+
+    std::size_t value;
+};
+
+namespace detail
+{
+
+template <bool checked, typename object_type, typename member_type, typename class_type>
+    requires(!std::is_function_v<member_type>)
+constexpr auto *follow_path_step(object_type &object, member_type class_type::*member) noexcept
+{
+    return std::addressof(object.*member);
+}
+
+// Returns nullptr instead of indexing past the end if the handler returns
+template <bool checked, typename object_type>
+constexpr auto *follow_path_step(object_type &object, index i) noexcept
+{
+    if constexpr (checked)
+    {
+        if (i.value >= std::size(object))
+        {
+            report_referable_after_free("Index out of range in a ref_ptr path");
+            return static_cast<decltype(std::addressof(object[i.value]))>(nullptr);
+        }
+    }
+
+    return std::addressof(object[i.value]);
+}
+
+} // namespace detail
+
+/// @brief A path from a value to one of its sub objects through member pointers and indexes, for constructing a
+/// ref_ptr to the sub object with a single reference.
+///
+/// ref_ptr<int>{r, path{&a::b, &b::c, index{3}}} points r->b.c[3].
+/// @tparam step_types The member pointer and index types of the steps.
+template <typename... step_types> class path
+{
+  public:
+    constexpr explicit path(step_types... steps) noexcept : steps{steps...}
+    {
+    }
+
+    /// @brief Follows the path from a value.
+    /// @tparam checked Whether the indexes are checked.
+    /// @param root The value the path starts at.
+    /// @return A pointer to the sub object at the end of the path, nullptr if a checked index is out of range.
+    template <bool checked, typename root_type> constexpr auto *resolve(root_type &root) const noexcept
+    {
+        return resolve_from<checked, 0>(root);
+    }
+
+  private:
+    template <bool checked, std::size_t step, typename object_type>
+    constexpr auto *resolve_from(object_type &object) const noexcept
+    {
+        if constexpr (step == sizeof...(step_types))
+        {
+            return std::addressof(object);
+        }
+        else
+        {
+            auto *next = detail::follow_path_step<checked>(object, std::get<step>(steps));
+            using result_type = decltype(resolve_from<checked, step + 1>(*next));
+
+            if constexpr (checked)
+            {
+                if (next == nullptr)
+                {
+                    return static_cast<result_type>(nullptr);
+                }
+            }
+
+            return resolve_from<checked, step + 1>(*next);
+        }
+    }
+
+    std::tuple<step_types...> steps;
+};
+
+/// @brief A path of member pointers given as template arguments, so that the offset of the sub object is a constant.
+///
+/// ref_ptr<int>{r, static_path<&a::b, &b::c>{}} points r->b.c.
+/// @tparam members The member pointers of the steps.
+template <auto... members> struct static_path
+{
+    /// @brief Follows the path from a value.
+    /// @param root The value the path starts at.
+    /// @return A pointer to the sub object at the end of the path.
+    template <bool checked, typename root_type> static constexpr auto *resolve(root_type &root) noexcept
+    {
+        return std::addressof((root .* ... .* members));
+    }
+};
+
+namespace detail
+{
+
+template <typename type> inline constexpr bool is_path = false;
+template <typename... step_types> inline constexpr bool is_path<path<step_types...>> = true;
+template <auto... members> inline constexpr bool is_path<static_path<members...>> = true;
+
+} // namespace detail
+
+} // namespace na
+
+#endif // NA_REF_PTR_CORE_DEFINITIONS_HPP
@@ -0,0 +1,2427 @@
+// Copyright (c) 2023 Namal Bambarasinghe
+//
+// This software is released under the MIT License.
+// https://opensource.org/licenses/MIT
+
+// The referables, ref_ptrs, ref_views and casts of one implementation of na::ref_ptr, selected by defining
+// na_ref_ptr_uncounted, na_ref_ptr_counted, na_ref_ptr_sampled (together with na_ref_ptr_tracked) or
+// na_ref_ptr_tracked. na/ref_ptr_core.hpp includes this file for the uncounted and counted implementations and
+// na/ref_ptr.hpp for the other two, so it has no include guard and must not be included directly.
+
+#if defined(na_ref_ptr_uncounted)
+#define na_ref_ptr_implementation uncounted
+#elif defined(na_ref_ptr_counted)
+#define na_ref_ptr_implementation counted
+#elif defined(na_ref_ptr_sampled)
+#define na_ref_ptr_implementation sampled
+#else
+#define na_ref_ptr_implementation tracked
+#endif
+
+namespace na::detail
+{
+
+#if defined(na_ref_ptr_tracked)
+inline namespace na_ref_ptr_shards_namespace(na_ref_ptr_tracked_shards)
+{
+#endif
+
+namespace na_ref_ptr_implementation
+{
+
+// The implementations that count the references also check the indexes of ref_ptr paths
+#if defined(na_ref_ptr_counted) || defined(na_ref_ptr_tracked)
+inline constexpr bool checks_paths = true;
+#else
+inline constexpr bool checks_paths = false;
+#endif
+
+#if defined(na_ref_ptr_tracked)
+
+/// @brief Interns source locations into a process wide table so that references only store a 32-bit id.
+///
+/// The table is a fixed size open addressing hash table that is never cleared. Interning a source location that is
+/// already in the table is lock free. Id 0 is reserved for the unknown location, which is also used once the table is
+/// full.
+class source_location_table
+{
+  public:
+    static std::uint32_t intern(const std::source_location &loc) noexcept
+    {
+        const std::size_t hash = std::hash<const void *>{}(loc.file_name()) ^ (loc.line() * 0x9E3779B1u) ^ loc.column();
+
+        for (std::size_t probe = 0; probe < max_probes; ++probe)
+        {
+            const auto id = static_cast<std::uint32_t>((hash + probe) % (capacity - 1) + 1);
+            entry &e = entries[id];
+
+            auto state = e.state.load(std::memory_order_acquire);
+            if (state == empty && e.state.compare_exchange_strong(state, writing, std::memory_order_acquire))
+            {
+                e.location = loc;
+                e.state.store(ready, std::memory_order_release);
+                return id;
+            }
+
+            // Another thread is writing this entry, the location is only valid once it is ready
+            while (state == writing)
+            {
+                state = e.state.load(std::memory_order_acquire);
+            }
+
+            if (e.location.line() == loc.line() && e.location.column() == loc.column() &&
+                e.location.file_name() == loc.file_name())
+            {
+                return id;
+            }
+        }
+
+        return 0;
+    }
+
+    static std::source_location get(std::uint32_t id) noexcept
+    {
+        return id == 0 ? std::source_location{} : entries[id].location;
+    }
+
+    /// @brief The number of ids, the ids are below it.
+    static constexpr std::size_t capacity = 1 << 14;
+
+  private:
+    static constexpr std::size_t max_probes = 64;
+
+    enum entry_state : std::uint32_t
+    {
+        empty,
+        writing,
+        ready
+    };
+
+    struct entry
+    {
+        std::atomic<std::uint32_t> state{empty};
+        std::source_location location;
+    };
+
+    static entry entries[capacity];
+};
+
+inline source_location_table::entry source_location_table::entries[source_location_table::capacity];
+
+/// @brief The links of a tracked ref_ptr in the reference list of its referable, with the id of its source location
+/// and the shard it is linked into.
+///
+/// On 64-bit targets each link is a word with the address of the other node in the lower 48 bits, like atomic_ref_ptr
+/// and with the same limits on the addresses, and the upper 16 bits of the links hold the location id and the shard,
+/// so the node is no larger than the two links.
+class ref_list_node
+{
+  public:
+    ref_list_node() = default;
+
+    ref_list_node(const std::source_location &loc) noexcept
+    {
+        set_location(source_location_table::intern(loc));
+    }
+
+#if UINTPTR_MAX > UINT32_MAX
+    ref_list_node *prev() const noexcept
+    {
+        return node_of(prev_word);
+    }
+
+    ref_list_node *next() const noexcept
+    {
+        return node_of(next_word);
+    }
+
+    void set_prev(ref_list_node *node) noexcept
+    {
+        prev_word = (prev_word & ~address_mask) | to_word(node);
+    }
+
+    void set_next(ref_list_node *node) noexcept
+    {
+        next_word = (next_word & ~address_mask) | to_word(node);
+    }
+
+    /// @brief The id of the source location in the source_location_table.
+    std::uint32_t location() const noexcept
+    {
+        return static_cast<std::uint32_t>(prev_word >> id_shift);
+    }
+
+    void set_location(std::uint32_t id) noexcept
+    {
+        prev_word = (prev_word & address_mask) | std::uint64_t{id} << id_shift;
+    }
+
+    std::uint32_t shard() const noexcept
+    {
+        return static_cast<std::uint32_t>(next_word >> id_shift);
+    }
+
+    void set_shard(std::uint32_t index) noexcept
+    {
+        next_word = (next_word & address_mask) | std::uint64_t{index} << id_shift;
+    }
+#else
+    ref_list_node *prev() const noexcept
+    {
+        return prev_node;
+    }
+
+    ref_list_node *next() const noexcept
+    {
+        return next_node;
+    }
+
+    void set_prev(ref_list_node *node) noexcept
+    {
+        prev_node = node;
+    }
+
+    void set_next(ref_list_node *node) noexcept
+    {
+        next_node = node;
+    }
+
+    /// @brief The id of the source location in the source_location_table.
+    std::uint32_t location() const noexcept
+    {
+        return location_id;
+    }
+
+    void set_location(std::uint32_t id) noexcept
+    {
+        location_id = id;
+    }
+
+    std::uint32_t shard() const noexcept
+    {
+        return shard_index;
+    }
+
+    void set_shard(std::uint32_t index) noexcept
+    {
+        shard_index = index;
+    }
+#endif
+
+#if defined(na_ref_ptr_stack_traces)
+    std::uint32_t trace = 0; // id in the stack_trace_table
+#endif
+
+  private:
+#if UINTPTR_MAX > UINT32_MAX
+    static constexpr int id_shift = 48;
+    static constexpr std::uint64_t address_mask = (std::uint64_t{1} << id_shift) - 1;
+
+    static_assert(source_location_table::capacity <= (std::size_t{1} << (64 - id_shift)),
+                  "the location ids must fit in the upper bits of a link");
+    static_assert(na_ref_ptr_tracked_shards <= (1 << (64 - id_shift)), "the shards must fit in the upper bits of a link");
+
+    static std::uint64_t to_word(ref_list_node *node) noexcept
+    {
+        const auto w = reinterpret_cast<std::uint64_t>(node);
+        assert((w & ~address_mask) == 0 && "the address of the list node must fit in 48 bits");
+        return w;
+    }
+
+    static ref_list_node *node_of(std::uint64_t w) noexcept
+    {
+        return reinterpret_cast<ref_list_node *>(w & address_mask);
+    }
+
+    std::uint64_t prev_word = 0; // with the location id
+    std::uint64_t next_word = 0; // with the shard
+#else
+    ref_list_node *prev_node = nullptr;
+    ref_list_node *next_node = nullptr;
+    std::uint32_t location_id = 0;
+    std::uint32_t shard_index = 0;
+#endif
+};
+
+/// @brief Returns the reference list shard of the calling thread. Threads are assigned to the shards in round robin
+/// order.
+inline std::uint32_t this_thread_shard() noexcept
+{
+    return static_cast<std::uint32_t>(this_thread_index() % na_ref_ptr_tracked_shards);
+}
+
+#if defined(na_ref_ptr_sampled)
+
+/// @brief Decides whether the next reference created by the calling thread is listed. Every na_ref_ptr_sample_rate th
+/// reference of each thread is listed.
+inline bool sample_this_ref() noexcept
+{
+    thread_local std::size_t ref_index = 0;
+    return ++ref_index % na_ref_ptr_sample_rate == 0;
+}
+
+#endif
+
+/// @brief Counts the references to a referable and keeps a list of them for the referable after free message.
+///
+/// The list is split into na_ref_ptr_tracked_shards shards, each with its own mutex, so that threads copying and
+/// destroying ref_ptrs to the same referable do not serialize on a single mutex. A ref_ptr is linked into the shard of
+/// the thread that created it and remembers the shard so that it can be unlinked from any thread.
+template <typename counter_policy> class ref_counter
+{
+  public:
+    explicit ref_counter(size_t count, const std::source_location loc)
+        : ref_count{count}, location{source_location_table::intern(loc)}
+    {
+#if defined(na_ref_ptr_live_referables)
+        live_node.owner = this;
+        live_node.write_report = write_live_report;
+        live_referable_registry::add(&live_node);
+#endif
+
+        if constexpr (is_profiled_counter<counter_policy>)
+        {
+            contention_registry::set_location(&ref_count.contention(), loc);
+        }
+    }
+
+    ref_counter(const ref_counter &) = delete;
+    ref_counter &operator=(const ref_counter &) = delete;
+
+#if defined(na_ref_ptr_live_referables)
+    ~ref_counter()
+    {
+        live_referable_registry::remove(&live_node);
+    }
+#endif
+
+    void add_ref(ref_list_node *node) noexcept
+    {
+        ref_count.add_ref();
+
+#if defined(na_ref_ptr_sampled)
+        if (!sample_this_ref())
+        {
+            return;
+        }
+#endif
+
+        node->set_shard(this_thread_shard());
+#if defined(na_ref_ptr_stack_traces)
+        node->trace = stack_trace_table::capture();
+#endif
+        list_shard &shard = shards[node->shard()];
+
+        shard_lock lock{*this, shard.mutex};
+
+        node->set_next(shard.head.next());
+        node->set_prev(&shard.head);
+
+        if (node->next() != nullptr)
+        {
+            node->next()->set_prev(node);
+        }
+
+        shard.head.set_next(node);
+    }
+
+    void remove_ref(ref_list_node *node) noexcept
+    {
+#if defined(na_ref_ptr_sampled)
+        // References that were not sampled are not linked
+        if (node->prev() == nullptr)
+        {
+            ref_count.remove_ref();
+            return;
+        }
+#endif
+
+        {
+            shard_lock lock{*this, shards[node->shard()].mutex};
+
+            node->prev()->set_next(node->next());
+
+            if (node->next() != nullptr)
+            {
+                node->next()->set_prev(node->prev());
+            }
+
+            node->set_prev(nullptr);
+            node->set_next(nullptr);
+        }
+
+        ref_count.remove_ref();
+    }
+
+    /// @brief Adds the references of a range of nodes with a single count update.
+    ///
+    /// The nodes are chained before taking the lock and the chain is spliced into the shard of the calling thread, so
+    /// adding any number of references takes a single lock.
+    /// @param first The first reference
+    /// @param last One past the last reference
+    /// @param node_of Returns the list node of a reference
+    template <typename iterator, typename projection>
+    void add_refs(iterator first, iterator last, projection node_of) noexcept
+    {
+        const std::uint32_t shard_index = this_thread_shard();
+#if defined(na_ref_ptr_stack_traces)
+        // All the references of the range are added from the same stack
+        const std::uint32_t trace = stack_trace_table::capture();
+#endif
+        ref_list_node *chain_first = nullptr;
+        ref_list_node *chain_last = nullptr;
+        std::size_t count = 0;
+
+        for (; first != last; ++first, ++count)
+        {
+#if defined(na_ref_ptr_sampled)
+            if (!sample_this_ref())
+            {
+                continue;
+            }
+#endif
+
+            ref_list_node *node = node_of(*first);
+            node->set_shard(shard_index);
+#if defined(na_ref_ptr_stack_traces)
+            node->trace = trace;
+#endif
+            node->set_prev(chain_last);
+            node->set_next(nullptr);
+
+            if (chain_last != nullptr)
+            {
+                chain_last->set_next(node);
+            }
+            else
+            {
+                chain_first = node;
+            }
+
+            chain_last = node;
+        }
+
+        ref_count.add_refs(count);
+
+        if (chain_first == nullptr)
+        {
+            return;
+        }
+
+        list_shard &shard = shards[shard_index];
+
+        shard_lock lock{*this, shard.mutex};
+
+        chain_first->set_prev(&shard.head);
+        chain_last->set_next(shard.head.next());
+
+        if (chain_last->next() != nullptr)
+        {
+            chain_last->next()->set_prev(chain_last);
+        }
+
+        shard.head.set_next(chain_first);
+    }
+
+    /// @brief Removes the references of a range of nodes with a single count update.
+    ///
+    /// The lock of a shard is held while consecutive nodes are in the same shard, so removing references added
+    /// together takes a single lock.
+    /// @param first The first reference
+    /// @param last One past the last reference
+    /// @param node_of Returns the list node of a reference
+    template <typename iterator, typename projection>
+    void remove_refs(iterator first, iterator last, projection node_of) noexcept
+    {
+        std::unique_lock<std::mutex> lock;
+        std::uint32_t locked_shard = 0;
+        std::size_t count = 0;
+
+        for (; first != last; ++first, ++count)
+        {
+            ref_list_node *node = node_of(*first);
+
+#if defined(na_ref_ptr_sampled)
+            if (node->prev() == nullptr)
+            {
+                continue;
+            }
+#endif
+
+            if (!lock.owns_lock() || node->shard() != locked_shard)
+            {
+                // Only one shard is locked at a time, a thread removing references of the same shards in another
+                // order would deadlock otherwise
+                lock = {};
+                lock = std::unique_lock{shards[node->shard()].mutex};
+                locked_shard = node->shard();
+            }
+
+            node->prev()->set_next(node->next());
+
+            if (node->next() != nullptr)
+            {
+                node->next()->set_prev(node->prev());
+            }
+
+            node->set_prev(nullptr);
+            node->set_next(nullptr);
+        }
+
+        if (lock.owns_lock())
+        {
+            lock.unlock();
+        }
+
+        ref_count.remove_refs(count);
+    }
+
+    /// @brief Hands the reference of a moved-from node over to the node it is moved to without changing the count.
+    ///
+    /// The new node takes the place of the old node in its shard, so moving a reference takes a single lock. It keeps
+    /// the location and the stack trace the reference was created with, so that a report names where it was taken
+    /// rather than every place it was moved through.
+    void move_ref(ref_list_node *from, ref_list_node *to) noexcept
+    {
+        to->set_location(from->location());
+#if defined(na_ref_ptr_stack_traces)
+        to->trace = from->trace;
+#endif
+
+#if defined(na_ref_ptr_sampled)
+        if (from->prev() == nullptr)
+        {
+            return;
+        }
+#endif
+
+        shard_lock lock{*this, shards[from->shard()].mutex};
+
+        to->set_prev(from->prev());
+        to->set_next(from->next());
+        to->set_shard(from->shard());
+
+        to->prev()->set_next(to);
+        if (to->next() != nullptr)
+        {
+            to->next()->set_prev(to);
+        }
+
+        from->set_prev(nullptr);
+        from->set_next(nullptr);
+    }
+
+    /// @brief Same as move_ref() for a node that is relocated, keeping the lock of the shard in lock so that
+    /// relocating consecutive references in the same shard takes the lock once.
+    void relocate_ref(ref_list_node *from, ref_list_node *to, std::unique_lock<std::mutex> &lock) noexcept
+    {
+        to->set_location(from->location());
+        to->set_shard(from->shard());
+#if defined(na_ref_ptr_stack_traces)
+        to->trace = from->trace;
+#endif
+
+#if defined(na_ref_ptr_sampled)
+        if (from->prev() == nullptr)
+        {
+            return;
+        }
+#endif
+
+        std::mutex &mutex = shards[from->shard()].mutex;
+        if (lock.mutex() != &mutex)
+        {
+            // Only one shard is locked at a time, a thread relocating references to the same referables in another
+            // order would deadlock otherwise
+            lock = {};
+            lock = std::unique_lock{mutex};
+        }
+
+        to->set_prev(from->prev());
+        to->set_next(from->next());
+
+        to->prev()->set_next(to);
+        if (to->next() != nullptr)
+        {
+            to->next()->set_prev(to);
+        }
+
+        from->set_prev(nullptr);
+        from->set_next(nullptr);
+    }
+
+    std::size_t use_count() const
+    {
+        return ref_count.use_count();
+    }
+
+    const counter_policy &policy() const noexcept
+    {
+        return ref_count;
+    }
+
+    /// @brief Calls the referable after free handler with the references grouped by the source location that created
+    /// them. The message is formatted into a stack buffer and truncated if it does not fit.
+    void report_after_free() const noexcept
+    {
+        char buffer[report_buffer_size];
+        report_writer writer{buffer, sizeof(buffer)};
+
+        const std::source_location loc = source_location_table::get(location);
+
+        writer << "Referable after free detected.\n"
+                  "The referable was destroyed while there were still references to it.\n"
+                  "The number of references is "
+               << ref_count.use_count()
+               << ".\n"
+                  "The referable destroyed:\n"
+                  "  "
+               << loc.file_name() << ":" << loc.line() << "\n"
+#if defined(na_ref_ptr_sampled)
+               << "Sampled active references (1 in " << na_ref_ptr_sample_rate << "):\n";
+#else
+               << "Active references:\n";
+#endif
+
+        write_references(writer, "  ");
+        report_referable_after_free(writer.text());
+    }
+
+  private:
+    // Shards are padded to a cache line each so that threads working on different shards do not false share
+    struct alignas(na_ref_ptr_tracked_shards > 1 ? cache_line_size : alignof(std::mutex)) list_shard
+    {
+        mutable std::mutex mutex;
+        ref_list_node head;
+    };
+
+    // Locks the mutex of a shard. With a profiled_counter the sampled locks are timed for the contention profile.
+    class shard_lock
+    {
+      public:
+        shard_lock(const ref_counter &counter, std::mutex &mutex) noexcept : mutex{mutex}
+        {
+            if constexpr (is_profiled_counter<counter_policy>)
+            {
+                if (sample_contention<contention_operation::lock>())
+                {
+                    contention = &counter.ref_count.contention();
+                    start = read_cycle_counter();
+                    mutex.lock();
+                    acquired = read_cycle_counter();
+                    return;
+                }
+            }
+
+            mutex.lock();
+        }
+
+        shard_lock(const shard_lock &) = delete;
+        shard_lock &operator=(const shard_lock &) = delete;
+
+        ~shard_lock()
+        {
+            mutex.unlock();
+
+            if constexpr (is_profiled_counter<counter_policy>)
+            {
+                if (contention != nullptr)
+                {
+                    contention->add_lock(acquired - start, read_cycle_counter() - acquired);
+                }
+            }
+        }
+
+      private:
+        std::mutex &mutex;
+        contention_state *contention = nullptr;
+        std::uint64_t start = 0;
+        std::uint64_t acquired = 0;
+    };
+
+    static constexpr std::size_t report_buffer_size = 8192;
+    static constexpr std::size_t max_report_locations = 256;
+
+    struct location_count
+    {
+        std::uint32_t location;
+#if defined(na_ref_ptr_stack_traces)
+        std::uint32_t trace;
+#endif
+        std::size_t count;
+    };
+
+    // Writes a line per source location that created references, the locations with the most references first
+    void write_references(report_writer &writer, std::string_view indent) const noexcept
+    {
+        location_count counts[max_report_locations] = {};
+        std::size_t unlisted = 0;
+
+        for (const list_shard &shard : shards)
+        {
+            std::scoped_lock lock{shard.mutex};
+
+            for (const ref_list_node *node = shard.head.next(); node != nullptr; node = node->next())
+            {
+                if (!count_location(counts, *node))
+                {
+                    ++unlisted;
+                }
+            }
+        }
+
+        std::sort(std::begin(counts), std::end(counts),
+                  [](const location_count &a, const location_count &b) { return a.count > b.count; });
+
+        for (const location_count &c : counts)
+        {
+            if (c.count == 0)
+            {
+                break;
+            }
+
+            const std::source_location loc = source_location_table::get(c.location);
+            writer << indent << loc.file_name() << ":" << loc.line();
+            write_reference_count(writer, c.count);
+#if defined(na_ref_ptr_stack_traces)
+            stack_trace_table::write(c.trace, writer, indent);
+#endif
+        }
+
+        if (unlisted != 0)
+        {
+            writer << indent << "other locations";
+            write_reference_count(writer, unlisted);
+        }
+    }
+
+    // Counts a reference in the open addressing table of locations, returns false if the table is full. With stack
+    // traces the references are counted by location and trace.
+    static bool count_location(location_count (&counts)[max_report_locations], const ref_list_node &node) noexcept
+    {
+#if defined(na_ref_ptr_stack_traces)
+        const std::size_t hash = node.location() * 0x9E3779B1u ^ node.trace;
+#else
+        const std::size_t hash = node.location();
+#endif
+
+        for (std::size_t probe = 0; probe < max_report_locations; ++probe)
+        {
+            location_count &c = counts[(hash + probe) % max_report_locations];
+
+            if (c.count == 0)
+            {
+                c.location = node.location();
+#if defined(na_ref_ptr_stack_traces)
+                c.trace = node.trace;
+#endif
+            }
+
+#if defined(na_ref_ptr_stack_traces)
+            if (c.location == node.location() && c.trace == node.trace)
+#else
+            if (c.location == node.location())
+#endif
+            {
+                ++c.count;
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+    static void write_reference_count(report_writer &writer, std::size_t count) noexcept
+    {
+        writer << " (" << count << (count == 1 ? " reference)\n" : " references)\n");
+    }
+
+#if defined(na_ref_ptr_live_referables)
+    static void write_live_report(const void *owner, report_writer &writer) noexcept
+    {
+        const auto &counter = *static_cast<const ref_counter *>(owner);
+        const std::source_location loc = source_location_table::get(counter.location);
+
+        writer << "  " << loc.file_name() << ":" << loc.line();
+        write_reference_count(writer, counter.use_count());
+        counter.write_references(writer, "    ");
+    }
+#endif
+
+    counter_policy ref_count;
+    std::uint32_t location; // id in the source_location_table
+    list_shard shards[na_ref_ptr_tracked_shards];
+#if defined(na_ref_ptr_live_referables)
+    live_referable_node live_node;
+#endif
+};
+
+#endif
+
+template <typename type, typename counter_policy> class ref_ptr;
+template <typename type, typename counter_policy> class ref_view;
+class ref_batch;
+class ref_cast;
+
+// Defined in ref_ptr_implementation.hpp, which only na/ref_ptr.hpp includes
+template <typename type, typename counter_policy> class weakly_referable;
+template <typename type, typename counter_policy> class enable_weak_ref_from_this;
+template <typename type, typename counter_policy> class weak_ref;
+template <typename type, typename counter_policy> class draining_referable;
+template <typename type, typename counter_policy> class referable_pool;
+template <typename type, typename counter_policy> class pooled_ref;
+template <typename type, typename counter_policy> class referable_array;
+template <typename type, typename counter_policy> class atomic_ref_ptr;
+template <typename type, typename counter_policy> class versioned_referable;
+template <typename... arg_types> class signal;
+
+/// @brief referable<type> type boxes a value so that safe references can be made to the contained value using
+/// ref_ptr.
+///
+/// There are two advantages of using referable over raw references,
+/// 1. The intention is clear and visible that the contained value is going to be referred to by other parts of the
+/// program.
+/// 2. All references are runtime checked to ensure that the referred object is not destroyed before the references
+/// pointing at it.
+///
+/// @tparam type The contained value type
+/// @tparam counter_policy The policy used to count the references, one of seq_cst_counter, relaxed_counter or
+/// unsynchronized_counter
+template <typename type, typename counter_policy> class referable
+{
+  public:
+    /// @brief Constructs a referable object by copying the value.
+    /// @param val The value to copy into the referable object
+    /// @param loc The source location of the referable object
+    referable(const type &val
+#if defined(na_ref_ptr_tracked)
+              ,
+              const std::source_location &loc = std::source_location::current()
+#endif
+                  )
+        :
+#if defined(na_ref_ptr_counted)
+          ref_count{0},
+#elif defined(na_ref_ptr_tracked)
+          ref_count(0, loc),
+#endif
+          value{val}
+    {
+    }
+
+    /// @brief Constructs a referable object by moving the value.
+    /// @param val The value to move into the referable object.
+    /// @param loc The source location of the referable object.
+    referable(type &&val
+#if defined(na_ref_ptr_tracked)
+              ,
+              const std::source_location &loc = std::source_location::current()
+#endif
+                  )
+        :
+#if defined(na_ref_ptr_counted)
+          ref_count{0},
+#elif defined(na_ref_ptr_tracked)
+          ref_count(0, loc),
+#endif
+          value{std::move(val)}
+    {
+    }
+
+    /// @brief Destroys the referable object, raises an error if there are any ref_ptr objects still referring the
+    /// object.
+    ~referable()
+    {
+#if defined(na_ref_ptr_counted)
+        flush_deferred_releases_of(&ref_count);
+        if (ref_count.use_count() != 0)
+        {
+            detail::report_referable_after_free("Referable after free detected");
+        }
+#elif defined(na_ref_ptr_tracked)
+        if (ref_count.use_count() != 0)
+        {
+            ref_count.report_after_free();
+        }
+#endif
+    }
+
+    /// @brief Constructs a referable object by copying the value from another referable object.
+    /// @tparam other_type The value type of the other referable object
+    /// @param other The other referable object
+    template <typename other_type, typename other_policy>
+    referable(const referable<other_type, other_policy> &other
+#if defined(na_ref_ptr_tracked)
+              ,
+              const std::source_location &loc = std::source_location::current()
+#endif
+                  )
+        :
+#if defined(na_ref_ptr_counted)
+          ref_count(0),
+#elif defined(na_ref_ptr_tracked)
+          ref_count(0, loc),
+#endif
+          value(other.value)
+    {
+    }
+
+    /// @brief Constructs a referable object by moving the value from another referable object.
+    /// @tparam other_type The value type of the other referable object
+    /// @param other The other referable object
+    template <typename other_type, typename other_policy>
+    referable(referable<other_type, other_policy> &&other
+#if defined(na_ref_ptr_tracked)
+              ,
+              const std::source_location &loc = std::source_location::current()
+#endif
+                  )
+        :
+#if defined(na_ref_ptr_counted)
+          ref_count(0),
+#elif defined(na_ref_ptr_tracked)
+          ref_count(0, loc),
+#endif
+          value(std::move(other.value))
+    {
+    }
+
+    /// @brief Assigns the value from another referable object.
+    /// @param other The other referable object
+    /// @return A reference to this referable object
+    referable &operator=(const referable &other)
+    {
+        if(this == &other)
+        {
+            return *this;
+        }
+
+        value = other.value;
+        return *this;
+    }
+
+    /// @brief Assigns the value from another referable object.
+    /// @tparam other_type The value type of the other referable object
+    /// @param other The other referable object
+    /// @return A reference to this referable object
+    template <typename other_type, typename other_policy>
+    referable &operator=(const referable<other_type, other_policy> &other)
+    {
+        value = other.value;
+        return *this;
+    }
+
+    /// @brief Assigns the value from another referable object by moving the value.
+    /// @param other The other referable object
+    /// @return A reference to this referable object
+    referable &operator=(referable &&other)
+    {
+        value = std::move(other.value);
+        return *this;
+    }
+
+    /// @brief Assigns the value from another referable object by moving the value.
+    /// @tparam other_type The value type of the other referable object
+    /// @param other The other referable object
+    /// @return A reference to this referable object
+    template <typename other_type, typename other_policy>
+    referable &operator=(referable<other_type, other_policy> &&other)
+    {
+        value = std::move(other.value);
+        return *this;
+    }
+
+    /// @brief Accesses the value.
+    /// @return A pointer to the value
+    constexpr const type *operator->() const noexcept
+    {
+        return &value;
+    }
+
+    /// @brief Accesses the value.
+    /// @return A pointer to the value
+    constexpr type *operator->() noexcept
+    {
+        return &value;
+    }
+
+    /// @brief Accesses the value.
+    /// @return A reference to the value
+    constexpr const type &operator*() const & noexcept
+    {
+        return value;
+    }
+
+    /// @brief Accesses the value.
+    /// @return A reference to the value
+    constexpr type &operator*() & noexcept
+    {
+        return value;
+    }
+
+    /// @brief Accesses the value.
+    /// @return A reference to the value
+    constexpr const type &&operator*() const && noexcept
+    {
+        return value;
+    }
+
+    /// @brief Accesses the value.
+    /// @return A reference to the value
+    constexpr type &&operator*() && noexcept
+    {
+        return value;
+    }
+
+  private:
+    template <typename, typename> friend class referable;
+    template <typename, typename> friend class ref_ptr;
+    template <typename, typename> friend class weak_ref;
+    template <typename, typename> friend class draining_referable;
+    template <typename, typename> friend class versioned_referable;
+    friend class ref_batch;
+
+#if defined(na_ref_ptr_counted)
+    mutable counter_policy ref_count;
+#elif defined(na_ref_ptr_tracked)
+    mutable ref_counter<counter_policy> ref_count;
+#endif // na_ref_ptr_counted
+#if defined(na_ref_ptr_statistics) && (defined(na_ref_ptr_counted) || defined(na_ref_ptr_tracked))
+    [[no_unique_address]] statistics_probe<type> statistics;
+#endif
+
+    type value;
+};
+
+/// @brief enable_ref_from_this<type> allow creating ref_ptr aware value types.
+///
+/// Publicly deriving from enable_ref_from_this<type> makes the value type a referable so that ref_ptr<type> can be
+/// constructed by passing a reference to the value.
+/// Moreover, from within the value type, ref_from_this() can be called to create a ref_ptr<type> to the value.
+///
+/// @tparam type The value type of the derived class
+/// @tparam counter_policy The policy used to count the references
+template <class type, typename counter_policy> class enable_ref_from_this
+{
+  public:
+    /// @brief Copy constructor.
+    /// @param other The other enable_ref_from_this object
+    enable_ref_from_this([[maybe_unused]] const enable_ref_from_this &other
+#if defined(na_ref_ptr_tracked)
+                         ,
+                         const std::source_location &loc = std::source_location::current()
+#endif
+                             )
+#if defined(na_ref_ptr_counted)
+        : ref_count{0}
+#elif defined(na_ref_ptr_tracked)
+        : ref_count(0, loc)
+#endif
+    {
+    }
+
+    /// @brief Move constructor.
+    /// @param other The other enable_ref_from_this object
+    enable_ref_from_this([[maybe_unused]] enable_ref_from_this &&other
+#if defined(na_ref_ptr_tracked)
+                         ,
+                         const std::source_location &loc = std::source_location::current()
+#endif
+                             )
+#if defined(na_ref_ptr_counted)
+        : ref_count{0}
+#elif defined(na_ref_ptr_tracked)
+        : ref_count(0, loc)
+#endif
+    {
+    }
+
+    /// @brief Assignment operator.
+    /// @param other The other enable_ref_from_this object
+    enable_ref_from_this &operator=([[maybe_unused]] const enable_ref_from_this &)
+    {
+        return *this;
+    }
+
+    /// @brief Move assignment operator.
+    /// @param other The other enable_ref_from_this object
+    enable_ref_from_this &operator=([[maybe_unused]] enable_ref_from_this &&)
+    {
+        return *this;
+    }
+
+    /// @brief Destroys the enable_ref_from_this object, raises an error if there are any ref_ptr objects still
+    /// referring the object.
+    ~enable_ref_from_this()
+    {
+#if defined(na_ref_ptr_counted)
+        flush_deferred_releases_of(&ref_count);
+        if (ref_count.use_count() != 0)
+        {
+            detail::report_referable_after_free("Referable after free detected");
+        }
+#elif defined(na_ref_ptr_tracked)
+        if (ref_count.use_count() != 0)
+        {
+            ref_count.report_after_free();
+        }
+#endif
+    }
+
+    /// @brief Creates a ref_ptr<type> to the value.
+    /// @return A ref_ptr<type> pointing the value.
+    ref_ptr<type, counter_policy> ref_from_this()
+    {
+        return {*this};
+    }
+
+    /// @brief Creates a ref_ptr<type> to the value.
+    /// @return A ref_ptr<type> pointing the value.
+    ref_ptr<const type, counter_policy> ref_from_this() const
+    {
+        return {*this};
+    }
+
+  protected:
+    enable_ref_from_this()
+#if defined(na_ref_ptr_counted)
+        : ref_count{0}
+#elif defined(na_ref_ptr_tracked)
+        : ref_count(0, std::source_location::current())
+#endif
+          {};
+
+  private:
+    template <typename, typename> friend class ref_ptr;
+    template <typename, typename> friend class weak_ref;
+    friend class ref_batch;
+
+#if defined(na_ref_ptr_counted)
+    mutable counter_policy ref_count;
+#elif defined(na_ref_ptr_tracked)
+    mutable ref_counter<counter_policy> ref_count;
+#endif // na_ref_ptr_counted or na_ref_ptr_tracked
+#if defined(na_ref_ptr_statistics) && (defined(na_ref_ptr_counted) || defined(na_ref_ptr_tracked))
+    [[no_unique_address]] statistics_probe<type> statistics;
+#endif
+};
+
+/// @brief ref_ptr<type> is a smart pointer that can be used to safely point to a value owned by another object.
+///
+/// A ref_ptr<type> can be constructed to point to an object boxed in a referable<type> object or an object of type that
+/// is derived from enable_ref_from_this<type>.
+///
+/// Moreover, a ref_ptr<type> can also point to a sub object of such an object.
+///
+/// ref_ptr<type> has four different implementations.
+/// 1. Counted implementation: ref_ptr<type> counts the number of references at runtime. This variation is the default
+/// in the release mode.
+/// 2. Tracked implementation: ref_ptr<type> keeps track of all the ref_ptrs alive so that referable after free does
+/// list all the references for easy debugging. This variation is the default in the debug mode.
+/// 3. Sampled implementation: ref_ptr<type> counts all the references like the counted implementation but only keeps
+/// track of one in na_ref_ptr_sample_rate (defaults to 16) references, so the referable after free message lists a
+/// sample of the references at close to the cost of the counted implementation.
+/// 4. Uncounted implementation: ref_ptr<type> does not count or keep track of references. This variation has zero
+/// overhead compared to a raw pointer or reference. If the program can be validated to have correct RAII in the debug
+/// mode then this implementation can be enabled in the release mode to achieve optimal performance. Recommended to be
+/// used only if last bit of performance is important or the performance gain achieved by disabling the reference
+/// counting can be justified.
+///
+/// All four implementations are available in every translation unit that includes na/ref_ptr.hpp as
+/// na::basic_ref_ptr<type, implementation>, using the na::counted, na::tracked, na::sampled and na::uncounted
+/// implementation tags, and the counted and uncounted ones where only na/ref_ptr_core.hpp is included.
+/// na::ref_ptr<type> is the implementation selected with the following macros before including the header file:
+/// 1. na_ref_ptr_counted: Counted implementation
+/// 2. na_ref_ptr_tracked: Tracked implementation
+/// 3. na_ref_ptr_sampled: Sampled implementation
+/// 4. na_ref_ptr_uncounted: Uncounted implementation
+///
+/// A ref_ptr of another implementation, or a referable of another implementation, can be explicitly converted to an
+/// uncounted ref_ptr to skip the checks on a hot path. No other conversion between the implementations exists, since
+/// the other implementations need the count of the referable.
+///
+/// The tracked implementation keeps the list of references of each referable in na_ref_ptr_tracked_shards shards
+/// (defaults to 1). Define it to the expected number of threads sharing a referable to avoid serializing them.
+///
+/// The counter policy selects how the counted and tracked implementations count the references:
+/// 1. seq_cst_counter: Sequentially consistent atomic counter. This is the default.
+/// 2. relaxed_counter: Atomic counter with relaxed increments and acquire-release decrements.
+/// 3. unsynchronized_counter: Non-atomic counter for referables that never leave a single thread.
+/// 4. distributed_counter: Per-thread slots for referables that are copied by many threads at the same time.
+/// 5. isolated_counter: Another counter policy padded to its own cache line, for values read by many threads.
+/// 6. draining_counter: Notifies when the count reaches zero, for draining_referable.
+/// 7. profiled_counter: Another counter policy whose contention is measured, see get_contention_profile().
+///
+/// @tparam type The type of the value pointed to by the ref_ptr.
+/// @tparam counter_policy The policy used to count the references.
+#if defined(na_ref_ptr_tracked)
+template <typename type, typename counter_policy> class ref_ptr
+#else
+template <typename type, typename counter_policy> class na_ref_ptr_trivial_abi ref_ptr
+#endif
+{
+  public:
+    /// @brief Constructs an empty ref_ptr.
+    ref_ptr(
+#if defined(na_ref_ptr_tracked)
+        const std::source_location &loc = std::source_location::current()
+#endif
+            )
+        :
+#if defined(na_ref_ptr_counted) || defined(na_ref_ptr_tracked)
+          ref_count{nullptr},
+#endif
+#if defined(na_ref_ptr_tracked)
+          list_node{loc},
+#endif
+          value{nullptr}
+    {
+    }
+
+#if defined(na_ref_ptr_uncounted)
+    /// @brief Explicitly converts a ref_ptr or a referable of another implementation to an uncounted ref_ptr. The
+    /// uncounted ref_ptr does not count as a reference, so the checks of the other implementation do not cover it.
+    /// @tparam other_type The type of the ref_ptr or referable of the other implementation.
+    /// @param other The ref_ptr or referable of the other implementation.
+    template <typename other_type>
+        requires is_checked_ref_source<std::remove_const_t<other_type>>
+    explicit ref_ptr(other_type &other) noexcept : value{other.operator->()}
+    {
+    }
+#endif
+
+    /// @brief Constructs a ref_ptr pointing to a referable<type> object.
+    /// @tparam ref_type The value type of the referable object.
+    /// @param ref The referable object.
+    template <typename ref_type>
+    ref_ptr(referable<ref_type, counter_policy> &ref
+#if defined(na_ref_ptr_tracked)
+            ,
+            const std::source_location &loc = std::source_location::current()
+#endif
+                )
+        :
+#if defined(na_ref_ptr_counted) || defined(na_ref_ptr_tracked)
+          ref_count{&ref.ref_count},
+#endif
+#if defined(na_ref_ptr_tracked)
+          list_node{loc},
+#endif
+          value{&ref.value}
+    {
+        add_ref();
+    }
+
+    /// @brief Constructs a ref_ptr pointing to a referable<type> object.
+    /// @tparam ref_type The value type of the referable object.
+    /// @param ref The referable object.
+    template <typename ref_type>
+    ref_ptr(const referable<ref_type, counter_policy> &ref
+#if defined(na_ref_ptr_tracked)
+            ,
+            const std::source_location &loc = std::source_location::current()
+#endif
+                )
+        :
+#if defined(na_ref_ptr_counted) || defined(na_ref_ptr_tracked)
+          ref_count{&ref.ref_count},
+#endif
+#if defined(na_ref_ptr_tracked)
+          list_node{loc},
+#endif
+          value{&ref.value}
+    {
+        add_ref();
+    }
+
+    /// @brief Constructs a ref_ptr pointing to a sub object of a referable<type> object.
+    /// @tparam ref_type The value type of the referable object.
+    /// @param ref The referable object.
+    /// @param mem_var_ptr The member pointer to the sub object.
+    template <typename ref_type, typename value_type>
+    ref_ptr(referable<ref_type, counter_policy> &ref, value_type ref_type::*mem_var_ptr
+#if defined(na_ref_ptr_tracked)
+            ,
+            const std::source_location &loc = std::source_location::current()
+#endif
+                )
+        :
+#if defined(na_ref_ptr_counted) || defined(na_ref_ptr_tracked)
+          ref_count{&ref.ref_count},
+#endif
+#if defined(na_ref_ptr_tracked)
+          list_node{loc},
+#endif
+          value{&(ref.value.*mem_var_ptr)}
+    {
+        add_ref();
+    }
+
+    /// @brief Constructs a ref_ptr pointing to a sub object of a referable<type> object reached through a path of
+    /// member pointers and indexes, adding a single reference.
+    /// @tparam ref_type The value type of the referable object.
+    /// @param ref The referable object.
+    /// @param sub_object_path The path to the sub object, a na::path or a na::static_path.
+    template <typename ref_type, typename path_type>
+        requires is_path<path_type>
+    ref_ptr(referable<ref_type, counter_policy> &ref, const path_type &sub_object_path
+#if defined(na_ref_ptr_tracked)
+            ,
+            const std::source_location &loc = std::source_location::current()
+#endif
+                )
+        :
+#if defined(na_ref_ptr_counted) || defined(na_ref_ptr_tracked)
+          ref_count{&ref.ref_count},
+#endif
+#if defined(na_ref_ptr_tracked)
+          list_node{loc},
+#endif
+          value{sub_object_path.template resolve<checks_paths>(ref.value)}
+    {
+#if defined(na_ref_ptr_counted) || defined(na_ref_ptr_tracked)
+        // An index out of range leaves the ref_ptr empty
+        if (value == nullptr)
+        {
+            ref_count = nullptr;
+            return;
+        }
+#endif
+        add_ref();
+    }
+
+    /// @brief Constructs a ref_ptr pointing to a sub object of a referable<type> object.
+    /// @tparam ref_type The value type of the referable object.
+    /// @param ref The referable object.
+    /// @param mem_var_ptr The member pointer to the sub object.
+    template <typename ref_type, typename value_type>
+    ref_ptr(const referable<ref_type, counter_policy> &ref, value_type ref_type::*mem_var_ptr
+#if defined(na_ref_ptr_tracked)
+            ,
+            const std::source_location &loc = std::source_location::current()
+#endif
+                )
+        :
+#if defined(na_ref_ptr_counted) || defined(na_ref_ptr_tracked)
+          ref_count{&ref.ref_count},
+#endif
+#if defined(na_ref_ptr_tracked)
+          list_node{loc},
+#endif
+          value{&(ref.value.*mem_var_ptr)}
+    {
+        add_ref();
+    }
+
+    /// @brief Constructs a ref_ptr pointing to a sub object of a referable<type> object reached through a path of
+    /// member pointers and indexes, adding a single reference.
+    /// @tparam ref_type The value type of the referable object.
+    /// @param ref The referable object.
+    /// @param sub_object_path The path to the sub object, a na::path or a na::static_path.
+    template <typename ref_type, typename path_type>
+        requires is_path<path_type>
+    ref_ptr(const referable<ref_type, counter_policy> &ref, const path_type &sub_object_path
+#if defined(na_ref_ptr_tracked)
+            ,
+            const std::source_location &loc = std::source_location::current()
+#endif
+                )
+        :
+#if defined(na_ref_ptr_counted) || defined(na_ref_ptr_tracked)
+          ref_count{&ref.ref_count},
+#endif
+#if defined(na_ref_ptr_tracked)
+          list_node{loc},
+#endif
+          value{sub_object_path.template resolve<checks_paths>(ref.value)}
+    {
+#if defined(na_ref_ptr_counted) || defined(na_ref_ptr_tracked)
+        // An index out of range leaves the ref_ptr empty
+        if (value == nullptr)
+        {
+            ref_count = nullptr;
+            return;
+        }
+#endif
+        add_ref();
+    }
+
+    /// @brief Deleted constructor from a temporary referable object.
+    /// @tparam ref_type The value type of the referable object.
+    /// @param ref The temporary referable object.
+    template <typename ref_type> ref_ptr(referable<ref_type, counter_policy> &&ref) = delete;
+
+    /// @brief Constructs a ref_ptr pointing to an object of type that is derived from enable_ref_from_this.
+    /// @tparam ref_type The value type of enable_ref_from_this.
+    /// @param ref The enable_ref_from_this object.
+    template <typename ref_type>
+    ref_ptr(enable_ref_from_this<ref_type, counter_policy> &ref
+#if defined(na_ref_ptr_tracked)
+            ,
+            const std::source_location &loc = std::source_location::current()
+#endif
+                )
+        :
+#if defined(na_ref_ptr_counted) || defined(na_ref_ptr_tracked)
+          ref_count{&ref.ref_count},
+#endif
+#if defined(na_ref_ptr_tracked)
+          list_node{loc},
+#endif
+          value{&static_cast<ref_type &>(ref)}
+    {
+        static_assert(std::is_base_of_v<enable_ref_from_this<ref_type, counter_policy>, ref_type>);
+        add_ref();
+    }
+
+    /// @brief Constructs a ref_ptr pointing to an object of type that is derived from enable_ref_from_this.
+    /// @tparam ref_type The value type of enable_ref_from_this.
+    /// @param ref The enable_ref_from_this object.
+    template <typename ref_type>
+    ref_ptr(const enable_ref_from_this<ref_type, counter_policy> &ref
+#if defined(na_ref_ptr_tracked)
+            ,
+            const std::source_location &loc = std::source_location::current()
+#endif
+                )
+        :
+#if defined(na_ref_ptr_counted) || defined(na_ref_ptr_tracked)
+          ref_count{&ref.ref_count},
+#endif
+#if defined(na_ref_ptr_tracked)
+          list_node{loc},
+#endif
+          value{&static_cast<const ref_type &>(ref)}
+    {
+        static_assert(std::is_base_of_v<enable_ref_from_this<ref_type, counter_policy>, ref_type>);
+        add_ref();
+    }
+
+    /// @brief Constructs a ref_ptr pointing to a sub object of type that is derived from enable_ref_from_this.
+    /// @tparam ref_type The value type of enable_ref_from_this.
+    /// @tparam value_type The value type of the sub object.
+    /// @param ref The enable_ref_from_this object.
+    /// @param mem_var_ptr The member pointer to the sub object.
+    template <typename ref_type, typename value_type>
+    ref_ptr(enable_ref_from_this<ref_type, counter_policy> &ref, value_type ref_type::*mem_var_ptr
+#if defined(na_ref_ptr_tracked)
+            ,
+            const std::source_location &loc = std::source_location::current()
+#endif
+                )
+        :
+#if defined(na_ref_ptr_counted) || defined(na_ref_ptr_tracked)
+          ref_count{&ref.ref_count},
+#endif
+#if defined(na_ref_ptr_tracked)
+          list_node{loc},
+#endif
+          value{&(ref.value->*mem_var_ptr)}
+    {
+        add_ref();
+    }
+
+    /// @brief Constructs a ref_ptr pointing to a sub object of type that is derived from enable_ref_from_this.
+    /// @tparam ref_type The value type of enable_ref_from_this.
+    /// @tparam value_type The value type of the sub object.
+    /// @param ref The enable_ref_from_this object.
+    /// @param mem_var_ptr The member pointer to the sub object.
+    template <typename ref_type, typename value_type>
+    ref_ptr(const enable_ref_from_this<ref_type, counter_policy> &ref, value_type ref_type::*mem_var_ptr
+#if defined(na_ref_ptr_tracked)
+            ,
+            const std::source_location &loc = std::source_location::current()
+#endif
+                )
+        :
+#if defined(na_ref_ptr_counted) || defined(na_ref_ptr_tracked)
+          ref_count{&ref.ref_count},
+#endif
+#if defined(na_ref_ptr_tracked)
+          list_node{loc},
+#endif
+          value{&(ref.value->*mem_var_ptr)}
+    {
+        add_ref();
+    }
+
+    /// @brief Deleted constructor from a temporary enable_ref_from_this object.
+    /// @tparam ref_type The value type of enable_ref_from_this.
+    /// @param ref the temporary enable_ref_from_this object.
+    template <typename ref_type> ref_ptr(enable_ref_from_this<ref_type, counter_policy> &&ref) = delete;
+
+    /// @brief Copy constructor.
+    /// @param other The other ref_ptr object.
+    ref_ptr(const ref_ptr &other
+#if defined(na_ref_ptr_tracked)
+            ,
+            const std::source_location &loc = std::source_location::current()
+#endif
+                )
+        :
+#if defined(na_ref_ptr_counted) || defined(na_ref_ptr_tracked)
+          ref_count{other.ref_count},
+#endif
+#if defined(na_ref_ptr_tracked)
+          list_node{loc},
+#endif
+          value{other.value}
+    {
+#if defined(na_ref_ptr_counted) || defined(na_ref_ptr_tracked)
+        if (ref_count != nullptr)
+        {
+            add_ref();
+        }
+#endif
+    }
+
+    /// @brief Move constructor.
+    /// @param other The other ref_ptr object.
+    ref_ptr(ref_ptr &&other
+#if defined(na_ref_ptr_tracked)
+            ,
+            const std::source_location &loc = std::source_location::current()
+#endif
+                ) noexcept
+        :
+#if defined(na_ref_ptr_counted) || defined(na_ref_ptr_tracked)
+          ref_count{other.ref_count},
+#endif
+#if defined(na_ref_ptr_tracked)
+          list_node{loc},
+#endif
+          value{other.value}
+    {
+#if defined(na_ref_ptr_tracked)
+        if (ref_count != nullptr)
+        {
+            ref_count->move_ref(&other.list_node, &list_node);
+        }
+#endif
+#if defined(na_ref_ptr_counted) || defined(na_ref_ptr_tracked)
+        other.ref_count = nullptr;
+#endif
+        other.value = nullptr;
+    }
+
+    /// @brief Constructs a ref_ptr from another ref_ptr.
+    /// @tparam other_type The value type of the tother ref_ptr.
+    /// @param other The other ref_ptr object.
+    template <typename other_type>
+    ref_ptr(const ref_ptr<other_type, counter_policy> &other
+#if defined(na_ref_ptr_tracked)
+            ,
+            const std::source_location &loc = std::source_location::current()
+#endif
+                )
+        :
+#if defined(na_ref_ptr_counted) || defined(na_ref_ptr_tracked)
+          ref_count{other.ref_count},
+#endif
+#if defined(na_ref_ptr_tracked)
+          list_node{loc},
+#endif
+          value{other.value}
+    {
+#if defined(na_ref_ptr_counted) || defined(na_ref_ptr_tracked)
+        if (ref_count != nullptr)
+        {
+            add_ref();
+        }
+#endif
+    }
+
+    /// @brief Constructs a ref_ptr to a sub object of another ref_ptr.
+    /// @tparam other_type The value type of the tother ref_ptr.
+    /// @tparam value_type The value type of the sub object.
+    /// @param other The other ref_ptr object.
+    /// @param mem_var_ptr The member pointer to the sub object.
+    template <typename other_type, typename value_type>
+    ref_ptr(const ref_ptr<other_type, counter_policy> &other, value_type other_type::*mem_var_ptr
+#if defined(na_ref_ptr_tracked)
+            ,
+            const std::source_location &loc = std::source_location::current()
+#endif
+                )
+        :
+#if defined(na_ref_ptr_counted) || defined(na_ref_ptr_tracked)
+          ref_count{other.ref_count},
+#endif
+#if defined(na_ref_ptr_tracked)
+          list_node{loc},
+#endif
+          value{&(other.value->*mem_var_ptr)}
+    {
+#if defined(na_ref_ptr_counted) || defined(na_ref_ptr_tracked)
+        if (ref_count != nullptr)
+        {
+            add_ref();
+        }
+#endif
+    }
+
+    /// @brief Constructs a ref_ptr to a sub object of another ref_ptr reached through a path of member pointers and
+    /// indexes, adding a single reference.
+    /// @tparam other_type The value type of the other ref_ptr.
+    /// @param other The other ref_ptr object.
+    /// @param sub_object_path The path to the sub object, a na::path or a na::static_path.
+    template <typename other_type, typename path_type>
+        requires is_path<path_type>
+    ref_ptr(const ref_ptr<other_type, counter_policy> &other, const path_type &sub_object_path
+#if defined(na_ref_ptr_tracked)
+            ,
+            const std::source_location &loc = std::source_location::current()
+#endif
+                )
+        :
+#if defined(na_ref_ptr_counted) || defined(na_ref_ptr_tracked)
+          ref_count{other.ref_count},
+#endif
+#if defined(na_ref_ptr_tracked)
+          list_node{loc},
+#endif
+          value{other.value == nullptr ? nullptr : sub_object_path.template resolve<checks_paths>(*other.value)}
+    {
+#if defined(na_ref_ptr_counted) || defined(na_ref_ptr_tracked)
+        // An empty source or an index out of range leaves the ref_ptr empty
+        if (value == nullptr)
+        {
+            ref_count = nullptr;
+            return;
+        }
+
+        add_ref();
+#endif
+    }
+
+    /// @brief Constructs a ref_ptr from another ref_ptr.
+    /// @tparam other_type The value type of the tother ref_ptr.
+    /// @param other The other ref_ptr object.
+    template <typename other_type>
+    ref_ptr(ref_ptr<other_type, counter_policy> &&other
+#if defined(na_ref_ptr_tracked)
+            ,
+            const std::source_location &loc = std::source_location::current()
+#endif
+                )
+        :
+#if defined(na_ref_ptr_counted) || defined(na_ref_ptr_tracked)
+          ref_count{other.ref_count},
+#endif
+#if defined(na_ref_ptr_tracked)
+          list_node{loc},
+#endif
+          value{other.value}
+    {
+#if defined(na_ref_ptr_tracked)
+        if (ref_count != nullptr)
+        {
+            ref_count->move_ref(&other.list_node, &list_node);
+        }
+#endif
+        take_statistics<other_type>();
+#if defined(na_ref_ptr_counted) || defined(na_ref_ptr_tracked)
+        other.ref_count = nullptr;
+#endif
+        other.value = nullptr;
+    }
+
+    /// @brief Constructs a ref_ptr to a sub object of another ref_ptr.
+    /// @tparam other_type The value type of the tother ref_ptr.
+    /// @tparam value_type The value type of the sub object.
+    /// @param other The other ref_ptr object.
+    /// @param mem_var_ptr The member pointer to the sub object.
+    template <typename other_type, typename value_type>
+    ref_ptr(ref_ptr<other_type, counter_policy> &&other, value_type other_type::*mem_var_ptr
+#if defined(na_ref_ptr_tracked)
+            ,
+            const std::source_location &loc = std::source_location::current()
+#endif
+                )
+        :
+#if defined(na_ref_ptr_counted) || defined(na_ref_ptr_tracked)
+          ref_count{other.ref_count},
+#endif
+#if defined(na_ref_ptr_tracked)
+          list_node{loc},
+#endif
+          value{&(other.value->*mem_var_ptr)}
+    {
+#if defined(na_ref_ptr_tracked)
+        if (ref_count != nullptr)
+        {
+            ref_count->move_ref(&other.list_node, &list_node);
+        }
+#endif
+        take_statistics<other_type>();
+#if defined(na_ref_ptr_counted) || defined(na_ref_ptr_tracked)
+        other.ref_count = nullptr;
+#endif
+        other.value = nullptr;
+    }
+
+    /// @brief Constructs a ref_ptr to a sub object of another ref_ptr reached through a path of member pointers and
+    /// indexes, taking over the reference of the other ref_ptr.
+    /// @tparam other_type The value type of the other ref_ptr.
+    /// @param other The other ref_ptr object.
+    /// @param sub_object_path The path to the sub object, a na::path or a na::static_path.
+    template <typename other_type, typename path_type>
+        requires is_path<path_type>
+    ref_ptr(ref_ptr<other_type, counter_policy> &&other, const path_type &sub_object_path
+#if defined(na_ref_ptr_tracked)
+            ,
+            const std::source_location &loc = std::source_location::current()
+#endif
+                )
+        :
+#if defined(na_ref_ptr_counted) || defined(na_ref_ptr_tracked)
+          ref_count{other.ref_count},
+#endif
+#if defined(na_ref_ptr_tracked)
+          list_node{loc},
+#endif
+          value{other.value == nullptr ? nullptr : sub_object_path.template resolve<checks_paths>(*other.value)}
+    {
+        // An empty source or an index out of range leaves the ref_ptr empty, and the source keeps its reference
+        if (value == nullptr)
+        {
+#if defined(na_ref_ptr_counted) || defined(na_ref_ptr_tracked)
+            ref_count = nullptr;
+#endif
+            return;
+        }
+
+#if defined(na_ref_ptr_tracked)
+        if (ref_count != nullptr)
+        {
+            ref_count->move_ref(&other.list_node, &list_node);
+        }
+#endif
+        take_statistics<other_type>();
+#if defined(na_ref_ptr_counted) || defined(na_ref_ptr_tracked)
+        other.ref_count = nullptr;
+#endif
+        other.value = nullptr;
+    }
+
+    /// @brief Assigns the value from another ref_ptr.
+    /// @param other The other ref_ptr object.
+    /// @return A reference to this ref_ptr.
+    ref_ptr &operator=(const ref_ptr &other)
+    {
+        if (this == &other)
+        {
+            return *this;
+        }
+
+#if defined(na_ref_ptr_counted) || defined(na_ref_ptr_tracked)
+        if (this->ref_count != nullptr)
+        {
+            remove_ref();
+        }
+
+        this->ref_count = other.ref_count;
+        if (ref_count != nullptr)
+        {
+            add_ref();
+        }
+#endif
+
+        this->value = other.value;
+
+        return *this;
+    }
+
+    /// @brief Assigns the value from another ref_ptr.
+    /// @tparam other_type The value type of the other ref_ptr
+    /// @param other The other ref_ptr object.
+    /// @return A reference to this ref_ptr.
+    template <typename other_type> ref_ptr &operator=(const ref_ptr<other_type, counter_policy> &other)
+    {
+#if defined(na_ref_ptr_counted) || defined(na_ref_ptr_tracked)
+        if (this->ref_count != nullptr)
+        {
+            remove_ref();
+        }
+
+        this->ref_count = other.ref_count;
+        if (ref_count != nullptr)
+        {
+            add_ref();
+        }
+#endif
+
+        this->value = other.value;
+
+        return *this;
+    }
+
+    /// @brief Assigns the value from another ref_ptr.
+    /// @param other The other ref_ptr object.
+    /// @return A reference to this ref_ptr.
+    ref_ptr &operator=(ref_ptr &&other)
+    {
+        if (this == &other)
+        {
+            return *this;
+        }
+
+        move_assign(other);
+        return *this;
+    }
+
+    /// @brief Assigns the value from another ref_ptr.
+    /// @tparam other_type The value type of the other ref_ptr
+    /// @param other The other ref_ptr object.
+    /// @return A reference to this ref_ptr.
+    template <typename other_type> ref_ptr &operator=(ref_ptr<other_type, counter_policy> &&other)
+    {
+        move_assign(other);
+        return *this;
+    }
+
+    /// @brief Remove this reference to the object and destroys the ref_ptr.
+    ~ref_ptr()
+    {
+#if defined(na_ref_ptr_counted) || defined(na_ref_ptr_tracked)
+        if (ref_count != nullptr)
+        {
+            remove_ref();
+        }
+#endif
+    }
+
+    /// @brief Borrows a view of the value that does not count as a reference.
+    ///
+    /// The view must not outlive this ref_ptr or be used after this ref_ptr is reset or reassigned. The tracked
+    /// implementation checks on every dereference that this ref_ptr was not reset or reassigned. It cannot detect a
+    /// ref_view that outlives its ref_ptr, since that would read the destroyed ref_ptr.
+    /// @return A ref_view pointing the value pointed by the ref_ptr.
+    ref_view<type, counter_policy> borrow() noexcept
+    {
+        return {*this};
+    }
+
+    /// @brief Borrows a view of the value that does not count as a reference.
+    /// @return A ref_view pointing the value pointed by the ref_ptr.
+    ref_view<const type, counter_policy> borrow() const noexcept
+    {
+        return {*this};
+    }
+
+    /// @brief Remove this reference to the pointed object.
+    void reset() noexcept
+    {
+#if defined(na_ref_ptr_counted) || defined(na_ref_ptr_tracked)
+        if (ref_count != nullptr)
+        {
+            remove_ref();
+            ref_count = nullptr;
+        }
+#endif
+        value = nullptr;
+    }
+
+    /// @brief Tests whether the ref_ptr is pointing to a valid object.
+    operator bool() const noexcept
+    {
+        return value != nullptr;
+    }
+
+    /// @brief Returns the use count of the referable. 0 is returned if ref_ptr is not pointing to a valid object.
+    /// @return The use count of the referable.
+    std::size_t use_count() const
+    {
+#ifdef na_ref_ptr_counted
+        if (ref_count != nullptr)
+        {
+            return ref_count->use_count();
+        }
+#elif defined(na_ref_ptr_tracked)
+        if (ref_count != nullptr)
+        {
+            return ref_count->use_count();
+        }
+#endif
+        return 0;
+    }
+
+    /// @brief Accesses the value pointed by the ref_ptr.
+    /// @return A pointer to the value pointed by the ref_ptr.
+    constexpr const type *operator->() const noexcept
+    {
+        return value;
+    }
+
+    /// @brief Accesses the value pointed by the ref_ptr.
+    /// @return A pointer to the value pointed by the ref_ptr.
+    constexpr type *operator->() noexcept
+    {
+        return value;
+    }
+
+    /// @brief Accesses the value pointed by the ref_ptr.
+    /// @return A reference to the value pointed by the ref_ptr.
+    constexpr const type &operator*() const & noexcept
+    {
+        return *value;
+    }
+
+    /// @brief Accesses the value pointed by the ref_ptr.
+    /// @return A reference to the value pointed by the ref_ptr.
+    constexpr type &operator*() & noexcept
+    {
+        return *value;
+    }
+
+    /// @brief Accesses the value pointed by the ref_ptr.
+    /// @return A reference to the value pointed by the ref_ptr.
+    constexpr const type &&operator*() const && noexcept
+    {
+        return *value;
+    }
+
+    /// @brief Accesses the value pointed by the ref_ptr.
+    /// @return A reference to the value pointed by the ref_ptr.
+    constexpr type &&operator*() && noexcept
+    {
+        return *value;
+    }
+
+  private:
+    template <typename other_type> void move_assign(ref_ptr<other_type, counter_policy> &other) noexcept
+    {
+#if defined(na_ref_ptr_tracked)
+        if (ref_count != nullptr && ref_count == other.ref_count)
+        {
+            // Both refer to the same referable, keep the node of this ref_ptr linked and drop the other one
+            other.remove_ref();
+        }
+        else
+        {
+            if (ref_count != nullptr)
+            {
+                remove_ref();
+            }
+
+            ref_count = other.ref_count;
+            if (ref_count != nullptr)
+            {
+                ref_count->move_ref(&other.list_node, &list_node);
+            }
+
+            take_statistics<other_type>();
+        }
+
+        other.ref_count = nullptr;
+#elif defined(na_ref_ptr_counted)
+        if (ref_count != nullptr)
+        {
+            remove_ref();
+        }
+
+        ref_count = other.ref_count;
+        other.ref_count = nullptr;
+        take_statistics<other_type>();
+#endif
+
+        value = other.value;
+        other.value = nullptr;
+    }
+
+    void add_ref()
+    {
+#if defined(na_ref_ptr_counted)
+        ref_count->add_ref();
+#elif defined(na_ref_ptr_tracked)
+        ref_count->add_ref(&list_node);
+#endif // na_ref_ptr_counted or na_ref_ptr_tracked
+#if defined(na_ref_ptr_statistics) && (defined(na_ref_ptr_counted) || defined(na_ref_ptr_tracked))
+        count_statistics<type>(statistics_event::add_ref);
+#endif
+    }
+
+    // Counts a reference taken over from a ref_ptr to another type as removed from that type and added to this one, so
+    // that the statistics of both types stay balanced
+    template <typename other_type> void take_statistics() const noexcept
+    {
+#if defined(na_ref_ptr_statistics) && (defined(na_ref_ptr_counted) || defined(na_ref_ptr_tracked))
+        if constexpr (!std::is_same_v<std::remove_cv_t<other_type>, std::remove_cv_t<type>>)
+        {
+            if (ref_count != nullptr)
+            {
+                count_statistics<other_type>(statistics_event::remove_ref);
+                count_statistics<type>(statistics_event::add_ref);
+            }
+        }
+#endif
+    }
+
+    void remove_ref()
+    {
+#if defined(na_ref_ptr_counted) && defined(na_ref_ptr_deferred_releases)
+        if (!release_buffer::defer(ref_count))
+        {
+            ref_count->remove_ref();
+        }
+#elif defined(na_ref_ptr_counted)
+        ref_count->remove_ref();
+#elif defined(na_ref_ptr_tracked)
+        ref_count->remove_ref(&list_node);
+#endif // na_ref_ptr_counted or na_ref_ptr_tracked
+#if defined(na_ref_ptr_statistics) && (defined(na_ref_ptr_counted) || defined(na_ref_ptr_tracked))
+        count_statistics<type>(statistics_event::remove_ref);
+#endif
+    }
+
+    template <typename, typename> friend class ref_ptr;
+    template <typename, typename> friend class ref_view;
+    template <typename, typename> friend class weak_ref;
+    template <typename, typename> friend class atomic_ref_ptr;
+    template <typename, typename> friend class referable_array;
+    template <typename, typename> friend class versioned_referable;
+    friend class ref_batch;
+    friend class ref_cast;
+
+#if defined(na_ref_ptr_counted)
+    using counter_type = counter_policy;
+#elif defined(na_ref_ptr_tracked)
+    using counter_type = ref_counter<counter_policy>;
+#endif
+
+    // Points to val and takes the reference over from other without changing the count
+    template <typename other_type>
+    ref_ptr(ref_ptr<other_type, counter_policy> &&other, type *val
+#if defined(na_ref_ptr_tracked)
+            ,
+            const std::source_location &loc
+#endif
+            ) noexcept
+        :
+#if defined(na_ref_ptr_counted) || defined(na_ref_ptr_tracked)
+          ref_count{other.ref_count},
+#endif
+#if defined(na_ref_ptr_tracked)
+          list_node{loc},
+#endif
+          value{val}
+    {
+#if defined(na_ref_ptr_tracked)
+        if (ref_count != nullptr)
+        {
+            ref_count->move_ref(&other.list_node, &list_node);
+        }
+#endif
+        take_statistics<other_type>();
+#if defined(na_ref_ptr_counted) || defined(na_ref_ptr_tracked)
+        other.ref_count = nullptr;
+#endif
+        other.value = nullptr;
+    }
+
+#if defined(na_ref_ptr_tracked)
+    struct relocation_tag
+    {
+    };
+
+    // Takes the place of a relocated ref_ptr in the reference list, keeping its location
+    ref_ptr(relocation_tag, ref_ptr &from, std::unique_lock<std::mutex> &lock) noexcept
+        : ref_count{from.ref_count}, value{from.value}
+    {
+        if (ref_count != nullptr)
+        {
+            ref_count->relocate_ref(&from.list_node, &list_node, lock);
+        }
+
+        // The old storage is left empty, the ref_views borrowed from it are not detected since it could be reused
+        from.ref_count = nullptr;
+        from.value = nullptr;
+    }
+
+    /// @brief Relocates a range of ref_ptrs in a single pass, see na::relocate_range().
+    friend void relocate(ref_ptr *first, ref_ptr *last, ref_ptr *dest) noexcept
+    {
+        const std::size_t count = static_cast<std::size_t>(last - first);
+        const bool backward = dest > first && dest < last;
+        std::unique_lock<std::mutex> lock;
+
+        for (std::size_t i = 0; i != count; ++i)
+        {
+            const std::size_t index = backward ? count - 1 - i : i;
+            ::new (static_cast<void *>(dest + index)) ref_ptr{relocation_tag{}, first[index], lock};
+        }
+    }
+#endif
+
+    // Adds a reference to a referable that is known to be alive
+    ref_ptr(
+#if defined(na_ref_ptr_counted) || defined(na_ref_ptr_tracked)
+        counter_type *count,
+#endif
+        type *val
+#if defined(na_ref_ptr_tracked)
+        ,
+        const std::source_location &loc
+#endif
+        )
+        :
+#if defined(na_ref_ptr_counted) || defined(na_ref_ptr_tracked)
+          ref_count{count},
+#endif
+#if defined(na_ref_ptr_tracked)
+          list_node{loc},
+#endif
+          value{val}
+    {
+#if defined(na_ref_ptr_counted) || defined(na_ref_ptr_tracked)
+        add_ref();
+#endif
+    }
+
+#if defined(na_ref_ptr_counted) || defined(na_ref_ptr_tracked)
+    counter_type *ref_count;
+#endif // na_ref_ptr_counted or na_ref_ptr_tracked
+#if defined(na_ref_ptr_tracked)
+    ref_list_node list_node;
+#endif // na_ref_ptr_tracked
+
+    type *value;
+};
+
+/// @brief ref_view<type> is a non counting view of the value pointed by a ref_ptr<type>.
+///
+/// A ref_view is borrowed from a ref_ptr using ref_ptr::borrow() and costs the same as a raw pointer to copy and
+/// dereference, so it can be passed through hot call chains while the ref_ptr it is borrowed from keeps the reference.
+/// The view must not outlive that ref_ptr or be used after it is reset or reassigned. In the tracked implementation
+/// dereferencing the view checks that the ref_ptr still refers to the same referable and calls the referable after free
+/// handler if it does not. This check is best effort and only covers ref_ptrs that were reset or reassigned: a view of
+/// a destroyed or relocated ref_ptr would have to read memory the ref_ptr no longer owns, so it is not detected.
+///
+/// @tparam type The type of the value pointed to by the ref_view.
+/// @tparam counter_policy The counter policy of the ref_ptr the view is borrowed from.
+template <typename type, typename counter_policy> class ref_view
+{
+  public:
+    /// @brief Constructs an empty ref_view.
+    constexpr ref_view() noexcept = default;
+
+    /// @brief Borrows a view from a ref_ptr.
+    /// @tparam other_type The value type of the ref_ptr.
+    /// @param ptr The ref_ptr to borrow from.
+    template <typename other_type>
+    ref_view(const ref_ptr<other_type, counter_policy> &ptr) noexcept
+        :
+#if defined(na_ref_ptr_tracked)
+          parent_ref_count{&ptr.ref_count}, ref_count{ptr.ref_count},
+#endif
+          value{ptr.value}
+    {
+    }
+
+    /// @brief Constructs a ref_view from another ref_view.
+    /// @tparam other_type The value type of the other ref_view.
+    /// @param other The other ref_view.
+    template <typename other_type>
+    ref_view(const ref_view<other_type, counter_policy> &other) noexcept
+        :
+#if defined(na_ref_ptr_tracked)
+          parent_ref_count{other.parent_ref_count}, ref_count{other.ref_count},
+#endif
+          value{other.value}
+    {
+    }
+
+    /// @brief Tests whether the ref_view is pointing to a valid object.
+    operator bool() const noexcept
+    {
+        return value != nullptr;
+    }
+
+    /// @brief Accesses the value pointed by the ref_view.
+    /// @return A pointer to the value pointed by the ref_view.
+    type *operator->() const noexcept
+    {
+        return get();
+    }
+
+    /// @brief Accesses the value pointed by the ref_view.
+    /// @return A reference to the value pointed by the ref_view.
+    type &operator*() const noexcept
+    {
+        return *get();
+    }
+
+  private:
+    template <typename, typename> friend class ref_view;
+
+    type *get() const noexcept
+    {
+#if defined(na_ref_ptr_tracked)
+        if (value != nullptr && *parent_ref_count != ref_count)
+        {
+            report_referable_after_free("ref_view used after the ref_ptr it was borrowed from was reset or reassigned");
+        }
+#endif
+        return value;
+    }
+
+#if defined(na_ref_ptr_tracked)
+    ref_counter<counter_policy> *const *parent_ref_count = nullptr;
+    ref_counter<counter_policy> *ref_count = nullptr;
+#endif
+
+    type *value = nullptr;
+};
+
+/// @brief Builds the results of the ref_ptr casts.
+class ref_cast
+{
+  public:
+    template <typename other_type, typename counter_policy>
+    static other_type *value_of(const ref_ptr<other_type, counter_policy> &other) noexcept
+    {
+        return other.value;
+    }
+
+    // Adds a reference for the cast ref_ptr, empty if the cast value is null
+    template <typename type, typename other_type, typename counter_policy>
+    static ref_ptr<type, counter_policy> copy([[maybe_unused]] const ref_ptr<other_type, counter_policy> &other,
+                                              type *val
+#if defined(na_ref_ptr_tracked)
+                                              ,
+                                              const std::source_location &loc
+#endif
+    )
+    {
+        if (val == nullptr)
+        {
+            return ref_ptr<type, counter_policy>{
+#if defined(na_ref_ptr_tracked)
+                loc
+#endif
+            };
+        }
+
+        return ref_ptr<type, counter_policy>{
+#if defined(na_ref_ptr_counted) || defined(na_ref_ptr_tracked)
+            other.ref_count,
+#endif
+            val
+#if defined(na_ref_ptr_tracked)
+            ,
+            loc
+#endif
+        };
+    }
+
+    // Takes the reference over for the cast ref_ptr, other keeps it if the cast value is null
+    template <typename type, typename other_type, typename counter_policy>
+    static ref_ptr<type, counter_policy> move(ref_ptr<other_type, counter_policy> &&other, type *val
+#if defined(na_ref_ptr_tracked)
+                                              ,
+                                              const std::source_location &loc
+#endif
+                                              ) noexcept
+    {
+        if (val == nullptr)
+        {
+            return ref_ptr<type, counter_policy>{
+#if defined(na_ref_ptr_tracked)
+                loc
+#endif
+            };
+        }
+
+        return ref_ptr<type, counter_policy>{std::move(other), val
+#if defined(na_ref_ptr_tracked)
+                                             ,
+                                             loc
+#endif
+        };
+    }
+};
+
+/// @brief Casts the value pointed by a ref_ptr with static_cast, adding a reference for the result.
+/// @tparam type The value type of the result.
+/// @param other The ref_ptr to cast.
+/// @return A ref_ptr pointing the cast value.
+template <typename type, typename other_type, typename counter_policy>
+ref_ptr<type, counter_policy> static_ref_cast(const ref_ptr<other_type, counter_policy> &other
+#if defined(na_ref_ptr_tracked)
+                                              ,
+                                              const std::source_location &loc = std::source_location::current()
+#endif
+)
+{
+    return ref_cast::copy(other, static_cast<type *>(ref_cast::value_of(other))
+#if defined(na_ref_ptr_tracked)
+                          ,
+                          loc
+#endif
+    );
+}
+
+/// @brief Casts the value pointed by a ref_ptr with static_cast, moving the reference of other into the result without
+/// changing the count.
+/// @tparam type The value type of the result.
+/// @param other The ref_ptr to cast.
+/// @return A ref_ptr pointing the cast value.
+template <typename type, typename other_type, typename counter_policy>
+ref_ptr<type, counter_policy> static_ref_cast(ref_ptr<other_type, counter_policy> &&other
+#if defined(na_ref_ptr_tracked)
+                                              ,
+                                              const std::source_location &loc = std::source_location::current()
+#endif
+                                              ) noexcept
+{
+    return ref_cast::move(std::move(other), static_cast<type *>(ref_cast::value_of(other))
+#if defined(na_ref_ptr_tracked)
+                          ,
+                          loc
+#endif
+    );
+}
+
+/// @brief Casts the value pointed by a ref_ptr with dynamic_cast, adding a reference for the result. The result is
+/// empty if the cast fails.
+/// @tparam type The value type of the result.
+/// @param other The ref_ptr to cast.
+/// @return A ref_ptr pointing the cast value.
+template <typename type, typename other_type, typename counter_policy>
+ref_ptr<type, counter_policy> dynamic_ref_cast(const ref_ptr<other_type, counter_policy> &other
+#if defined(na_ref_ptr_tracked)
+                                               ,
+                                               const std::source_location &loc = std::source_location::current()
+#endif
+)
+{
+    return ref_cast::copy(other, dynamic_cast<type *>(ref_cast::value_of(other))
+#if defined(na_ref_ptr_tracked)
+                          ,
+                          loc
+#endif
+    );
+}
+
+/// @brief Casts the value pointed by a ref_ptr with dynamic_cast, moving the reference of other into the result without
+/// changing the count. The result is empty and other keeps its reference if the cast fails.
+/// @tparam type The value type of the result.
+/// @param other The ref_ptr to cast.
+/// @return A ref_ptr pointing the cast value.
+template <typename type, typename other_type, typename counter_policy>
+ref_ptr<type, counter_policy> dynamic_ref_cast(ref_ptr<other_type, counter_policy> &&other
+#if defined(na_ref_ptr_tracked)
+                                               ,
+                                               const std::source_location &loc = std::source_location::current()
+#endif
+                                               ) noexcept
+{
+    return ref_cast::move(std::move(other), dynamic_cast<type *>(ref_cast::value_of(other))
+#if defined(na_ref_ptr_tracked)
+                          ,
+                          loc
+#endif
+    );
+}
+
+/// @brief Casts the value pointed by a ref_ptr with const_cast, adding a reference for the result.
+/// @tparam type The value type of the result.
+/// @param other The ref_ptr to cast.
+/// @return A ref_ptr pointing the cast value.
+template <typename type, typename other_type, typename counter_policy>
+ref_ptr<type, counter_policy> const_ref_cast(const ref_ptr<other_type, counter_policy> &other
+#if defined(na_ref_ptr_tracked)
+                                             ,
+                                             const std::source_location &loc = std::source_location::current()
+#endif
+)
+{
+    return ref_cast::copy(other, const_cast<type *>(ref_cast::value_of(other))
+#if defined(na_ref_ptr_tracked)
+                          ,
+                          loc
+#endif
+    );
+}
+
+/// @brief Casts the value pointed by a ref_ptr with const_cast, moving the reference of other into the result without
+/// changing the count.
+/// @tparam type The value type of the result.
+/// @param other The ref_ptr to cast.
+/// @return A ref_ptr pointing the cast value.
+template <typename type, typename other_type, typename counter_policy>
+ref_ptr<type, counter_policy> const_ref_cast(ref_ptr<other_type, counter_policy> &&other
+#if defined(na_ref_ptr_tracked)
+                                             ,
+                                             const std::source_location &loc = std::source_location::current()
+#endif
+                                             ) noexcept
+{
+    return ref_cast::move(std::move(other), const_cast<type *>(ref_cast::value_of(other))
+#if defined(na_ref_ptr_tracked)
+                          ,
+                          loc
+#endif
+    );
+}
+
+/// @brief Names the types of this implementation for na::basic_ref_ptr and the other basic_ aliases.
+struct implementation
+{
+    template <typename type, typename counter_policy>
+    using referable = na_ref_ptr_implementation::referable<type, counter_policy>;
+    template <typename type, typename counter_policy>
+    using enable_ref_from_this = na_ref_ptr_implementation::enable_ref_from_this<type, counter_policy>;
+    template <typename type, typename counter_policy>
+    using ref_ptr = na_ref_ptr_implementation::ref_ptr<type, counter_policy>;
+    template <typename type, typename counter_policy>
+    using ref_view = na_ref_ptr_implementation::ref_view<type, counter_policy>;
+    template <typename type, typename counter_policy>
+    using weakly_referable = na_ref_ptr_implementation::weakly_referable<type, counter_policy>;
+    template <typename type, typename counter_policy>
+    using enable_weak_ref_from_this = na_ref_ptr_implementation::enable_weak_ref_from_this<type, counter_policy>;
+    template <typename type, typename counter_policy>
+    using weak_ref = na_ref_ptr_implementation::weak_ref<type, counter_policy>;
+    template <typename type, typename counter_policy>
+    using draining_referable = na_ref_ptr_implementation::draining_referable<type, counter_policy>;
+    template <typename type, typename counter_policy>
+    using referable_pool = na_ref_ptr_implementation::referable_pool<type, counter_policy>;
+    template <typename type, typename counter_policy>
+    using pooled_ref = na_ref_ptr_implementation::pooled_ref<type, counter_policy>;
+    template <typename type, typename counter_policy>
+    using referable_array = na_ref_ptr_implementation::referable_array<type, counter_policy>;
+    template <typename type, typename counter_policy>
+    using atomic_ref_ptr = na_ref_ptr_implementation::atomic_ref_ptr<type, counter_policy>;
+    template <typename type, typename counter_policy>
+    using versioned_referable = na_ref_ptr_implementation::versioned_referable<type, counter_policy>;
+    template <typename... arg_types> using signal = na_ref_ptr_implementation::signal<arg_types...>;
+};
+
+// ref_ptrs are stored in large containers of callbacks, keep them small. The tracked ref_ptr is 32 bytes on 64-bit
+// targets, the location and shard ids are kept in the upper bits of the list links.
+#if defined(na_ref_ptr_uncounted)
+static_assert(sizeof(ref_ptr<int, seq_cst_counter>) == sizeof(void *), "ref_ptr must be one pointer");
+#elif defined(na_ref_ptr_counted)
+static_assert(sizeof(ref_ptr<int, seq_cst_counter>) == 2 * sizeof(void *), "ref_ptr must be two pointers");
+#elif UINTPTR_MAX > UINT32_MAX && defined(na_ref_ptr_stack_traces)
+static_assert(sizeof(ref_ptr<int, seq_cst_counter>) == 5 * sizeof(void *),
+              "ref_ptr must be four pointers and a 32-bit id, padded");
+#elif UINTPTR_MAX > UINT32_MAX
+static_assert(sizeof(ref_ptr<int, seq_cst_counter>) == 4 * sizeof(void *), "ref_ptr must be four pointers");
+#elif defined(na_ref_ptr_stack_traces)
+static_assert(sizeof(ref_ptr<int, seq_cst_counter>) == 4 * sizeof(void *) + 3 * sizeof(std::uint32_t),
+              "ref_ptr must be four pointers and three 32-bit ids");
+#else
+static_assert(sizeof(ref_ptr<int, seq_cst_counter>) == 4 * sizeof(void *) + 2 * sizeof(std::uint32_t),
+              "ref_ptr must be four pointers and two 32-bit ids");
+#endif
+
+} // namespace na_ref_ptr_implementation
+
+#if defined(na_ref_ptr_tracked)
+} // namespace na_ref_ptr_shards_namespace(na_ref_ptr_tracked_shards)
+#endif
+
+} // namespace na::detail
+
+#undef na_ref_ptr_implementation
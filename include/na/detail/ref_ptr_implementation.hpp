@@ -0,0 +1,2161 @@
+// Copyright (c) 2023 Namal Bambarasinghe
+//
+// This software is released under the MIT License.
+// https://opensource.org/licenses/MIT
+
+// The types of one implementation of na::ref_ptr that build on the core types, selected like in
+// ref_ptr_core_implementation.hpp. na/ref_ptr.hpp includes this file once for each implementation after the core
+// types of all of them, so it has no include guard and must not be included directly.
+
+#if defined(na_ref_ptr_uncounted)
+#define na_ref_ptr_implementation uncounted
+#elif defined(na_ref_ptr_counted)
+#define na_ref_ptr_implementation counted
+#elif defined(na_ref_ptr_sampled)
+#define na_ref_ptr_implementation sampled
+#else
+#define na_ref_ptr_implementation tracked
+#endif
+
+namespace na::detail
+{
+
+#if defined(na_ref_ptr_tracked)
+inline namespace na_ref_ptr_shards_namespace(na_ref_ptr_tracked_shards)
+{
+#endif
+
+namespace na_ref_ptr_implementation
+{
+
+/// @brief weakly_referable<type> is a referable<type> that weak_refs can also refer to.
+///
+/// A weak_ref does not count as a reference, so the weakly_referable can be destroyed while weak_refs to it are alive.
+/// Those weak_refs then expire and weak_ref::lock() returns an empty ref_ptr.
+///
+/// @tparam type The contained value type
+/// @tparam counter_policy The policy used to count the references
+template <typename type, typename counter_policy> class weakly_referable : public referable<type, counter_policy>
+{
+  public:
+    using referable<type, counter_policy>::referable;
+    using referable<type, counter_policy>::operator=;
+
+    /// @brief Copy constructor, the weak_refs to other do not refer to the copy.
+    /// @param other The other weakly_referable object
+    /// @param loc The source location of the weakly_referable object
+    weakly_referable(const weakly_referable &other
+#if defined(na_ref_ptr_tracked)
+                     ,
+                     const std::source_location &loc = std::source_location::current()
+#endif
+                         )
+        : referable<type, counter_policy>(*other
+#if defined(na_ref_ptr_tracked)
+                                          ,
+                                          loc
+#endif
+          )
+    {
+    }
+
+    /// @brief Move constructor, the weak_refs to other do not refer to the new object.
+    /// @param other The other weakly_referable object
+    /// @param loc The source location of the weakly_referable object
+    weakly_referable(weakly_referable &&other
+#if defined(na_ref_ptr_tracked)
+                     ,
+                     const std::source_location &loc = std::source_location::current()
+#endif
+                         )
+        : referable<type, counter_policy>(std::move(*other)
+#if defined(na_ref_ptr_tracked)
+                                          ,
+                                          loc
+#endif
+          )
+    {
+    }
+
+    /// @brief Assigns the value from another weakly_referable object, the weak_refs to each object keep referring to
+    /// it.
+    /// @param other The other weakly_referable object
+    /// @return A reference to this weakly_referable object
+    weakly_referable &operator=(const weakly_referable &other)
+    {
+        referable<type, counter_policy>::operator=(other);
+        return *this;
+    }
+
+    /// @brief Assigns the value from another weakly_referable object by moving the value, the weak_refs to each object
+    /// keep referring to it.
+    /// @param other The other weakly_referable object
+    /// @return A reference to this weakly_referable object
+    weakly_referable &operator=(weakly_referable &&other)
+    {
+        referable<type, counter_policy>::operator=(std::move(other));
+        return *this;
+    }
+
+    /// @brief Expires the weak_refs and destroys the referable.
+    ~weakly_referable()
+    {
+        weak_slot_table::release(slot);
+    }
+
+    /// @brief Creates a weak_ref to the value.
+    /// @return A weak_ref pointing the value.
+    weak_ref<type, counter_policy> weak_ref_to() noexcept
+    {
+        return {*this};
+    }
+
+  private:
+    template <typename, typename> friend class weak_ref;
+
+    std::uint32_t slot = weak_slot_table::acquire();
+};
+
+/// @brief draining_referable<type> is a referable<type> whose destructor waits for the references held by other
+/// threads to be removed instead of calling the referable after free handler.
+///
+/// This is meant for shutdown paths where the owner of a service object knows that the ref_ptrs to it on other threads
+/// are about to go. The destructor blocks until the count reaches zero or the drain timeout expires, and the referable
+/// after free handler is only called after a timeout. A coroutine can instead co_await unreferenced() before
+/// destroying it, which suspends without blocking a thread. The uncounted implementation does not count the references
+/// and does not wait.
+///
+/// @tparam type The contained value type
+/// @tparam counter_policy The policy used to count the references, it must provide wait_for_zero()
+template <typename type, typename counter_policy> class draining_referable : public referable<type, counter_policy>
+{
+  public:
+    using referable<type, counter_policy>::referable;
+    using referable<type, counter_policy>::operator=;
+
+    /// @brief Awaitable that resumes the awaiting coroutine once the references to a draining_referable are removed.
+    class unreferenced_awaiter
+    {
+      public:
+        bool await_ready() const noexcept
+        {
+#if defined(na_ref_ptr_counted) || defined(na_ref_ptr_tracked)
+            return counter->use_count() == 0;
+#else
+            return true;
+#endif
+        }
+
+        bool await_suspend([[maybe_unused]] std::coroutine_handle<> handle) const noexcept
+        {
+#if defined(na_ref_ptr_counted) || defined(na_ref_ptr_tracked)
+            return counter->resume_at_zero(handle);
+#else
+            return false;
+#endif
+        }
+
+        void await_resume() const noexcept
+        {
+        }
+
+      private:
+        friend class draining_referable;
+
+        explicit unreferenced_awaiter(const counter_policy *counter) noexcept : counter{counter}
+        {
+        }
+
+        const counter_policy *counter;
+    };
+
+    /// @brief Waits in a coroutine for the references to be removed, for shutting down without blocking a thread.
+    ///
+    /// co_await suspends the coroutine until the count reaches zero and the coroutine is resumed on the thread that
+    /// removes the last reference, inside the ref_ptr destructor or reset() that removes it. A coroutine running on an
+    /// executor should reschedule itself on the executor after the co_await, and may then destroy the referable. Only
+    /// one coroutine can wait at a time.
+    /// @return An awaitable that is ready when there are no references.
+    unreferenced_awaiter unreferenced() const noexcept
+    {
+#if defined(na_ref_ptr_counted)
+        return unreferenced_awaiter{&this->ref_count};
+#elif defined(na_ref_ptr_tracked)
+        return unreferenced_awaiter{&this->ref_count.policy()};
+#else
+        return unreferenced_awaiter{nullptr};
+#endif
+    }
+
+    /// @brief Waits for the references to be removed and destroys the referable.
+    ~draining_referable()
+    {
+#if defined(na_ref_ptr_counted)
+        this->ref_count.wait_for_zero(drain_timeout);
+#elif defined(na_ref_ptr_tracked)
+        this->ref_count.policy().wait_for_zero(drain_timeout);
+#endif
+    }
+
+    /// @brief Sets how long the destructor waits for the references to be removed before calling the referable after
+    /// free handler. The destructor waits without a timeout by default.
+    /// @param timeout The longest time to wait.
+    void set_drain_timeout(std::chrono::nanoseconds timeout) noexcept
+    {
+        drain_timeout = timeout;
+    }
+
+  private:
+    std::chrono::nanoseconds drain_timeout = std::chrono::nanoseconds::max();
+};
+
+/// @brief referable_array<type> is a fixed size array of values that ref_ptrs to its elements refer to.
+///
+/// The elements are stored contiguously without a counter each, and all the ref_ptrs to them count against the one
+/// counter of the array, so the elements can be scanned like a plain array. The destructor checks that count once for
+/// the whole array and calls the referable after free handler if any element is still referred to.
+///
+/// @tparam type The element type
+/// @tparam counter_policy The policy used to count the references
+template <typename type, typename counter_policy> class referable_array
+{
+  public:
+    /// @brief Constructs a referable_array of default constructed elements.
+    /// @param count The number of elements.
+    /// @param loc The source location of the referable_array.
+    explicit referable_array(std::size_t count
+#if defined(na_ref_ptr_tracked)
+                             ,
+                             const std::source_location &loc = std::source_location::current()
+#endif
+                             )
+        :
+#if defined(na_ref_ptr_counted)
+          ref_count{0},
+#elif defined(na_ref_ptr_tracked)
+          ref_count(0, loc),
+#endif
+          values{make_storage(count,
+                              [count](type *elements) { std::uninitialized_value_construct_n(elements, count); })}
+    {
+    }
+
+    /// @brief Constructs a referable_array of copies of a value.
+    /// @param count The number of elements.
+    /// @param val The value to copy into the elements.
+    /// @param loc The source location of the referable_array.
+    referable_array(std::size_t count, const type &val
+#if defined(na_ref_ptr_tracked)
+                    ,
+                    const std::source_location &loc = std::source_location::current()
+#endif
+                    )
+        :
+#if defined(na_ref_ptr_counted)
+          ref_count{0},
+#elif defined(na_ref_ptr_tracked)
+          ref_count(0, loc),
+#endif
+          values{make_storage(count,
+                              [count, &val](type *elements) { std::uninitialized_fill_n(elements, count, val); })}
+    {
+    }
+
+    /// @brief Constructs a referable_array from a list of values.
+    /// @param list The values to copy into the elements.
+    /// @param loc The source location of the referable_array.
+    referable_array(std::initializer_list<type> list
+#if defined(na_ref_ptr_tracked)
+                    ,
+                    const std::source_location &loc = std::source_location::current()
+#endif
+                    )
+        :
+#if defined(na_ref_ptr_counted)
+          ref_count{0},
+#elif defined(na_ref_ptr_tracked)
+          ref_count(0, loc),
+#endif
+          values{make_storage(list.size(),
+                              [&list](type *elements) { std::uninitialized_copy(list.begin(), list.end(), elements); })}
+    {
+    }
+
+    /// @brief Constructs a referable_array from a range of values.
+    /// @param first The first value to copy into the elements.
+    /// @param last One past the last value.
+    /// @param loc The source location of the referable_array.
+    template <std::input_iterator iterator>
+    referable_array(iterator first, iterator last
+#if defined(na_ref_ptr_tracked)
+                    ,
+                    const std::source_location &loc = std::source_location::current()
+#endif
+                    )
+        :
+#if defined(na_ref_ptr_counted)
+          ref_count{0},
+#elif defined(na_ref_ptr_tracked)
+          ref_count(0, loc),
+#endif
+          values{make_storage(first, last)}
+    {
+    }
+
+    // The ref_ptrs point into the elements, so they can not be copied or moved to another array
+    referable_array(const referable_array &) = delete;
+    referable_array &operator=(const referable_array &) = delete;
+
+    /// @brief Destroys the elements, raises an error if there are any ref_ptr objects still referring an element.
+    ~referable_array()
+    {
+#if defined(na_ref_ptr_counted)
+        flush_deferred_releases_of(&ref_count);
+        if (ref_count.use_count() != 0)
+        {
+            detail::report_referable_after_free("Referable after free detected");
+        }
+#elif defined(na_ref_ptr_tracked)
+        if (ref_count.use_count() != 0)
+        {
+            ref_count.report_after_free();
+        }
+#endif
+    }
+
+    /// @brief Creates a ref_ptr to an element.
+    /// @param index The index of the element.
+    /// @param loc The source location of the ref_ptr.
+    /// @return A ref_ptr pointing the element, empty if the index is reported out of range.
+    ref_ptr<type, counter_policy> ref(std::size_t index
+#if defined(na_ref_ptr_tracked)
+                                      ,
+                                      const std::source_location &loc = std::source_location::current()
+#endif
+    )
+    {
+        if (!check_index(index))
+        {
+            return {};
+        }
+
+        return {
+#if defined(na_ref_ptr_counted) || defined(na_ref_ptr_tracked)
+            &ref_count,
+#endif
+            &values[index]
+#if defined(na_ref_ptr_tracked)
+            ,
+            loc
+#endif
+        };
+    }
+
+    /// @brief Creates a ref_ptr to a const element.
+    /// @param index The index of the element.
+    /// @param loc The source location of the ref_ptr.
+    /// @return A ref_ptr pointing the element, empty if the index is reported out of range.
+    ref_ptr<const type, counter_policy> ref(std::size_t index
+#if defined(na_ref_ptr_tracked)
+                                            ,
+                                            const std::source_location &loc = std::source_location::current()
+#endif
+    ) const
+    {
+        if (!check_index(index))
+        {
+            return {};
+        }
+
+        return {
+#if defined(na_ref_ptr_counted) || defined(na_ref_ptr_tracked)
+            &ref_count,
+#endif
+            &values[index]
+#if defined(na_ref_ptr_tracked)
+            ,
+            loc
+#endif
+        };
+    }
+
+    /// @brief Accesses an element.
+    /// @param index The index of the element.
+    /// @return A reference to the element.
+    constexpr type &operator[](std::size_t index) noexcept
+    {
+        return values[index];
+    }
+
+    /// @brief Accesses an element.
+    /// @param index The index of the element.
+    /// @return A reference to the element.
+    constexpr const type &operator[](std::size_t index) const noexcept
+    {
+        return values[index];
+    }
+
+    /// @brief Gets the number of elements.
+    /// @return The number of elements.
+    constexpr std::size_t size() const noexcept
+    {
+        return values.get_deleter().count;
+    }
+
+    /// @brief Accesses the contiguous elements.
+    /// @return A pointer to the first element.
+    constexpr type *data() noexcept
+    {
+        return values.get();
+    }
+
+    /// @brief Accesses the contiguous elements.
+    /// @return A pointer to the first element.
+    constexpr const type *data() const noexcept
+    {
+        return values.get();
+    }
+
+    constexpr type *begin() noexcept
+    {
+        return values.get();
+    }
+
+    constexpr type *end() noexcept
+    {
+        return values.get() + size();
+    }
+
+    constexpr const type *begin() const noexcept
+    {
+        return values.get();
+    }
+
+    constexpr const type *end() const noexcept
+    {
+        return values.get() + size();
+    }
+
+  private:
+    // Returns false instead of letting ref() point past the end if the handler returns
+    bool check_index([[maybe_unused]] std::size_t index) const noexcept
+    {
+        if constexpr (checks_paths)
+        {
+            if (index >= size())
+            {
+                report_referable_after_free("Index out of range in referable_array::ref()");
+                return false;
+            }
+        }
+
+        return true;
+    }
+
+#if defined(na_ref_ptr_counted)
+    mutable counter_policy ref_count;
+#elif defined(na_ref_ptr_tracked)
+    mutable ref_counter<counter_policy> ref_count;
+#endif // na_ref_ptr_counted
+#if defined(na_ref_ptr_statistics) && (defined(na_ref_ptr_counted) || defined(na_ref_ptr_tracked))
+    [[no_unique_address]] statistics_probe<type> statistics;
+#endif
+
+    // Destroys and frees the elements, the count is the size of the array
+    struct element_deleter
+    {
+        std::size_t count;
+
+        void operator()(type *elements) const noexcept
+        {
+            std::destroy_n(elements, count);
+            std::allocator<type>{}.deallocate(elements, count);
+        }
+    };
+
+    // Frees the memory of the elements if constructing them throws, the uninitialized algorithms destroy the elements
+    // they constructed
+    struct memory_deleter
+    {
+        std::size_t count;
+
+        void operator()(type *elements) const noexcept
+        {
+            std::allocator<type>{}.deallocate(elements, count);
+        }
+    };
+
+    using storage = std::unique_ptr<type[], element_deleter>;
+
+    template <typename construct_type> static storage make_storage(std::size_t count, construct_type construct)
+    {
+        std::unique_ptr<type, memory_deleter> memory{std::allocator<type>{}.allocate(count), memory_deleter{count}};
+        construct(memory.get());
+        return storage{memory.release(), element_deleter{count}};
+    }
+
+    template <typename iterator> static storage make_storage(iterator first, iterator last)
+    {
+        if constexpr (std::forward_iterator<iterator>)
+        {
+            return make_storage(static_cast<std::size_t>(std::distance(first, last)),
+                                [first, last](type *elements) { std::uninitialized_copy(first, last, elements); });
+        }
+        else
+        {
+            // A single pass range is read once to count it
+            const std::vector<type> read(first, last);
+            return make_storage(read.size(), [&read](type *elements) {
+                std::uninitialized_copy(read.begin(), read.end(), elements);
+            });
+        }
+    }
+
+    // Never resized, so the elements stay where the ref_ptrs point. A std::vector<bool> would pack the elements into
+    // bits that ref_ptrs can not point to, so the elements are kept in an array of their own.
+    storage values;
+};
+
+/// @brief enable_weak_ref_from_this<type> allow creating ref_ptr and weak_ref aware value types.
+///
+/// Like enable_ref_from_this<type>, and from within the value type weak_from_this() can be called to create a
+/// weak_ref<type> to the value. The weak_refs expire when this base class is destroyed, which is after the members of
+/// the derived class are destroyed, so the derived class must not be locked through a weak_ref while it is being
+/// destroyed.
+///
+/// @tparam type The value type of the derived class
+/// @tparam counter_policy The policy used to count the references
+template <class type, typename counter_policy>
+class enable_weak_ref_from_this : public enable_ref_from_this<type, counter_policy>
+{
+  public:
+    /// @brief Copy constructor, the weak_refs to other do not refer to the copy.
+    /// @param other The other enable_weak_ref_from_this object
+    enable_weak_ref_from_this(const enable_weak_ref_from_this &other) : enable_ref_from_this<type, counter_policy>{other}
+    {
+    }
+
+    /// @brief Move constructor, the weak_refs to other do not refer to the new object.
+    /// @param other The other enable_weak_ref_from_this object
+    enable_weak_ref_from_this(enable_weak_ref_from_this &&other)
+        : enable_ref_from_this<type, counter_policy>{std::move(other)}
+    {
+    }
+
+    /// @brief Assignment operator, the weak_refs to each object keep referring to it.
+    /// @param other The other enable_weak_ref_from_this object
+    enable_weak_ref_from_this &operator=(const enable_weak_ref_from_this &other)
+    {
+        enable_ref_from_this<type, counter_policy>::operator=(other);
+        return *this;
+    }
+
+    /// @brief Move assignment operator, the weak_refs to each object keep referring to it.
+    /// @param other The other enable_weak_ref_from_this object
+    enable_weak_ref_from_this &operator=(enable_weak_ref_from_this &&other)
+    {
+        enable_ref_from_this<type, counter_policy>::operator=(std::move(other));
+        return *this;
+    }
+
+    /// @brief Expires the weak_refs and destroys the enable_weak_ref_from_this object.
+    ~enable_weak_ref_from_this()
+    {
+        weak_slot_table::release(slot);
+    }
+
+    /// @brief Creates a weak_ref<type> to the value.
+    /// @return A weak_ref<type> pointing the value.
+    weak_ref<type, counter_policy> weak_from_this() noexcept
+    {
+        return {*this};
+    }
+
+    /// @brief Creates a weak_ref<type> to the value.
+    /// @return A weak_ref<type> pointing the value.
+    weak_ref<const type, counter_policy> weak_from_this() const noexcept
+    {
+        return {*this};
+    }
+
+  protected:
+    enable_weak_ref_from_this() = default;
+
+  private:
+    template <typename, typename> friend class weak_ref;
+
+    std::uint32_t slot = weak_slot_table::acquire();
+};
+
+/// @brief weak_ref<type> is a reference to a weakly_referable<type> or enable_weak_ref_from_this<type> object that
+/// expires instead of raising an error when the object is destroyed.
+///
+/// Holding or copying a weak_ref costs nothing at the referable, it only keeps the generation of the slot the object
+/// owns in the weak_slot_table. lock() checks the generation and returns a ref_ptr<type> to the object, or an empty
+/// ref_ptr<type> if the object is gone. Checking an expired weak_ref is a single atomic load.
+///
+/// @tparam type The type of the value pointed to by the weak_ref.
+/// @tparam counter_policy The policy used to count the references.
+template <typename type, typename counter_policy> class weak_ref
+{
+  public:
+    /// @brief Constructs an empty weak_ref.
+    constexpr weak_ref() noexcept = default;
+
+    /// @brief Constructs a weak_ref pointing to a weakly_referable<type> object.
+    /// @tparam ref_type The value type of the weakly_referable object.
+    /// @param ref The weakly_referable object.
+    template <typename ref_type>
+    weak_ref(weakly_referable<ref_type, counter_policy> &ref) noexcept
+        : slot{ref.slot}, generation{weak_slot_table::generation(ref.slot)},
+#if defined(na_ref_ptr_counted) || defined(na_ref_ptr_tracked)
+          ref_count{&ref.ref_count},
+#endif
+          value{&ref.value}
+    {
+    }
+
+    /// @brief Constructs a weak_ref pointing to an object of type that is derived from enable_weak_ref_from_this.
+    /// @tparam ref_type The value type of enable_weak_ref_from_this.
+    /// @param ref The enable_weak_ref_from_this object.
+    template <typename ref_type>
+    weak_ref(enable_weak_ref_from_this<ref_type, counter_policy> &ref) noexcept
+        : slot{ref.slot}, generation{weak_slot_table::generation(ref.slot)},
+#if defined(na_ref_ptr_counted) || defined(na_ref_ptr_tracked)
+          ref_count{&static_cast<enable_ref_from_this<ref_type, counter_policy> &>(ref).ref_count},
+#endif
+          value{&static_cast<ref_type &>(ref)}
+    {
+    }
+
+    /// @brief Constructs a weak_ref pointing to an object of type that is derived from enable_weak_ref_from_this.
+    /// @tparam ref_type The value type of enable_weak_ref_from_this.
+    /// @param ref The enable_weak_ref_from_this object.
+    template <typename ref_type>
+    weak_ref(const enable_weak_ref_from_this<ref_type, counter_policy> &ref) noexcept
+        : slot{ref.slot}, generation{weak_slot_table::generation(ref.slot)},
+#if defined(na_ref_ptr_counted) || defined(na_ref_ptr_tracked)
+          ref_count{&static_cast<const enable_ref_from_this<ref_type, counter_policy> &>(ref).ref_count},
+#endif
+          value{&static_cast<const ref_type &>(ref)}
+    {
+    }
+
+    /// @brief Constructs a weak_ref from another weak_ref.
+    /// @tparam other_type The value type of the other weak_ref.
+    /// @param other The other weak_ref.
+    template <typename other_type>
+    weak_ref(const weak_ref<other_type, counter_policy> &other) noexcept
+        : slot{other.slot}, generation{other.generation},
+#if defined(na_ref_ptr_counted) || defined(na_ref_ptr_tracked)
+          ref_count{other.ref_count},
+#endif
+          value{other.value}
+    {
+    }
+
+    /// @brief Tests whether the object pointed by the weak_ref is destroyed.
+    /// @return true if the weak_ref is empty or the object is destroyed.
+    bool expired() const noexcept
+    {
+        return value == nullptr || weak_slot_table::generation(slot) != generation;
+    }
+
+    /// @brief Creates a ref_ptr to the object if it is still alive.
+    /// @return A ref_ptr pointing the object, or an empty ref_ptr if the object is destroyed.
+    ref_ptr<type, counter_policy> lock(
+#if defined(na_ref_ptr_tracked)
+        const std::source_location &loc = std::source_location::current()
+#endif
+            ) const noexcept
+    {
+        if (value == nullptr || !weak_slot_table::pin(slot, generation))
+        {
+            return {
+#if defined(na_ref_ptr_tracked)
+                loc
+#endif
+            };
+        }
+
+        ref_ptr<type, counter_policy> ptr{
+#if defined(na_ref_ptr_counted) || defined(na_ref_ptr_tracked)
+            ref_count,
+#endif
+            value
+#if defined(na_ref_ptr_tracked)
+            ,
+            loc
+#endif
+        };
+
+        weak_slot_table::unpin(slot);
+        return ptr;
+    }
+
+    /// @brief Makes the weak_ref empty.
+    void reset() noexcept
+    {
+        value = nullptr;
+    }
+
+  private:
+    template <typename, typename> friend class weak_ref;
+
+    std::uint32_t slot = 0;
+    std::uint32_t generation = 0;
+#if defined(na_ref_ptr_counted) || defined(na_ref_ptr_tracked)
+    typename ref_ptr<type, counter_policy>::counter_type *ref_count = nullptr;
+#endif
+    type *value = nullptr;
+};
+
+/// @brief referable_pool<type> stores many small referables in slabs and hands out compact pooled_ref<type>
+/// references to them.
+///
+/// The values are stored in chunks of chunk_size slots that are never moved, and the counts of a chunk are kept in a
+/// dense array next to the values rather than inline with each value. A slot is identified by a 32-bit id, made of the
+/// pool id and the slot index, and a 32-bit generation, so a pooled_ref is half the size of a counted ref_ptr. Released
+/// slots are reused without allocating.
+///
+/// Releasing a slot checks its count just like destroying a referable, and the referable after free handler is called
+/// if pooled_refs to it are still alive. In the tracked implementation the message lists the pooled_refs and names the
+/// location the pool was created at.
+///
+/// emplace() and release() take a mutex, and pooled_refs find their pool without taking it. A process can have up to
+/// max_pools pools of each type and counter policy at a time, each holding up to max_slots values.
+///
+/// @tparam type The contained value type
+/// @tparam counter_policy The policy used to count the references
+template <typename type, typename counter_policy> class referable_pool
+{
+  public:
+    static constexpr std::uint32_t chunk_size = 1024;
+    static constexpr std::uint32_t max_slots = std::uint32_t{1} << 24;
+    static constexpr std::uint32_t max_pools = 255;
+
+    /// @brief Identifies a slot of the pool. A handle does not count as a reference.
+    struct handle
+    {
+        std::uint32_t id = invalid_id;
+        std::uint32_t generation = 0;
+
+        explicit operator bool() const noexcept
+        {
+            return id != invalid_id;
+        }
+    };
+
+    /// @brief Constructs an empty pool.
+    referable_pool(
+#if defined(na_ref_ptr_tracked)
+        const std::source_location &loc = std::source_location::current()
+#endif
+            )
+#if defined(na_ref_ptr_tracked)
+        : location{loc}
+#endif
+    {
+        std::scoped_lock lock{registry_mutex};
+
+        for (std::uint32_t i = 0; i < max_pools; ++i)
+        {
+            if (pools[i].load(std::memory_order_relaxed) == nullptr)
+            {
+                pool_id = i;
+                pools[i].store(this, std::memory_order_release);
+                return;
+            }
+        }
+
+        // More than max_pools pools of the same type alive at the same time
+        std::terminate();
+    }
+
+    referable_pool(const referable_pool &) = delete;
+    referable_pool &operator=(const referable_pool &) = delete;
+
+    /// @brief Releases the slots in use and destroys the pool.
+    ~referable_pool()
+    {
+        for (std::uint32_t index = 0; index < slot_count; ++index)
+        {
+            const auto generation = chunk_of(index).generations[index % chunk_size].load(std::memory_order_relaxed);
+            if (generation % 2 == 1)
+            {
+                release_slot(index);
+            }
+        }
+
+        for (std::uint32_t i = 0; i * chunk_size < slot_count; ++i)
+        {
+            delete chunks[i].load(std::memory_order_relaxed);
+        }
+
+        std::scoped_lock lock{registry_mutex};
+        pools[pool_id].store(nullptr, std::memory_order_release);
+    }
+
+    /// @brief Constructs a value in a free slot.
+    /// @tparam arg_types The types of the arguments passed to the constructor of the value.
+    /// @param args The arguments passed to the constructor of the value.
+    /// @return A handle to the slot, or an empty handle if the pool is full.
+    template <typename... arg_types> handle emplace(arg_types &&...args)
+    {
+        std::uint32_t index;
+
+        {
+            std::scoped_lock lock{mutex};
+
+            if (!free_slots.empty())
+            {
+                index = free_slots.back();
+                free_slots.pop_back();
+            }
+            else if (slot_count < max_slots)
+            {
+                index = slot_count++;
+                if (index % chunk_size == 0)
+                {
+                    chunks[index / chunk_size].store(new chunk, std::memory_order_release);
+                }
+            }
+            else
+            {
+                return {};
+            }
+        }
+
+        chunk &c = chunk_of(index);
+        const std::uint32_t slot = index % chunk_size;
+
+#if defined(na_ref_ptr_counted)
+        new (c.counters[slot]) counter_policy{0};
+#elif defined(na_ref_ptr_tracked)
+        new (c.counters[slot]) ref_counter<counter_policy>{0, location};
+#endif
+        new (c.values[slot]) type(std::forward<arg_types>(args)...);
+
+        // Odd generations are in use
+        const auto generation = c.generations[slot].load(std::memory_order_relaxed) + 1;
+        c.generations[slot].store(generation, std::memory_order_release);
+
+        return {pool_id << slot_bits | index, generation};
+    }
+
+    /// @brief Destroys the value of a slot and makes the slot free.
+    ///
+    /// The referable after free handler is called if there are pooled_refs to the slot. Releasing a handle that is
+    /// already released does nothing.
+    /// @param h The handle of the slot.
+    void release(handle h)
+    {
+        if (get(h) != nullptr)
+        {
+            release_slot(h.id & slot_mask);
+        }
+    }
+
+    /// @brief Gets the value of a slot.
+    /// @param h The handle of the slot.
+    /// @return A pointer to the value, or nullptr if the handle is empty or the slot is released.
+    type *get(handle h) const noexcept
+    {
+        if (!h || (h.id >> slot_bits) != pool_id || (h.id & slot_mask) >= max_slots)
+        {
+            return nullptr;
+        }
+
+        const std::uint32_t index = h.id & slot_mask;
+        const chunk *c = chunks[index / chunk_size].load(std::memory_order_acquire);
+
+        if (c == nullptr || c->generations[index % chunk_size].load(std::memory_order_acquire) != h.generation)
+        {
+            return nullptr;
+        }
+
+        return value_at(index);
+    }
+
+    /// @brief Creates a pooled_ref to the value of a slot.
+    /// @param h The handle of the slot.
+    /// @return A pooled_ref to the value, or an empty pooled_ref if the handle is empty or the slot is released.
+    pooled_ref<type, counter_policy> ref(handle h
+#if defined(na_ref_ptr_tracked)
+                                         ,
+                                         const std::source_location &loc = std::source_location::current()
+#endif
+    ) const noexcept
+    {
+        if (get(h) == nullptr)
+        {
+            return {
+#if defined(na_ref_ptr_tracked)
+                loc
+#endif
+            };
+        }
+
+        return {h.id, h.generation
+#if defined(na_ref_ptr_tracked)
+                ,
+                loc
+#endif
+        };
+    }
+
+    /// @brief Gets the number of slots in use.
+    /// @return The number of slots in use.
+    std::size_t size() const
+    {
+        std::scoped_lock lock{mutex};
+        return slot_count - free_slots.size();
+    }
+
+  private:
+    template <typename, typename> friend class pooled_ref;
+
+    static constexpr std::uint32_t invalid_id = 0xFFFFFFFF;
+    static constexpr std::uint32_t slot_bits = 24;
+    static constexpr std::uint32_t slot_mask = max_slots - 1;
+
+#if defined(na_ref_ptr_counted)
+    using counter_type = counter_policy;
+#elif defined(na_ref_ptr_tracked)
+    using counter_type = ref_counter<counter_policy>;
+#endif
+
+    struct chunk
+    {
+        alignas(type) unsigned char values[chunk_size][sizeof(type)];
+#if defined(na_ref_ptr_counted) || defined(na_ref_ptr_tracked)
+        alignas(counter_type) unsigned char counters[chunk_size][sizeof(counter_type)];
+#endif
+        std::atomic<std::uint32_t> generations[chunk_size] = {};
+    };
+
+    static referable_pool &pool_of(std::uint32_t id) noexcept
+    {
+        return *pools[id >> slot_bits].load(std::memory_order_acquire);
+    }
+
+    chunk &chunk_of(std::uint32_t index) const noexcept
+    {
+        return *chunks[index / chunk_size].load(std::memory_order_acquire);
+    }
+
+    type *value_at(std::uint32_t index) const noexcept
+    {
+        return std::launder(reinterpret_cast<type *>(chunk_of(index).values[index % chunk_size]));
+    }
+
+#if defined(na_ref_ptr_counted) || defined(na_ref_ptr_tracked)
+    counter_type *counter_at(std::uint32_t index) const noexcept
+    {
+        return std::launder(reinterpret_cast<counter_type *>(chunk_of(index).counters[index % chunk_size]));
+    }
+#endif
+
+    std::uint32_t generation_at(std::uint32_t index) const noexcept
+    {
+        return chunk_of(index).generations[index % chunk_size].load(std::memory_order_acquire);
+    }
+
+    void release_slot(std::uint32_t index)
+    {
+#if defined(na_ref_ptr_counted)
+        flush_deferred_releases_of(counter_at(index));
+        if (counter_at(index)->use_count() != 0)
+        {
+            detail::report_referable_after_free("Referable after free detected");
+        }
+#elif defined(na_ref_ptr_tracked)
+        if (counter_at(index)->use_count() != 0)
+        {
+            counter_at(index)->report_after_free();
+        }
+#endif
+
+        auto &generation = chunk_of(index).generations[index % chunk_size];
+        generation.store(generation.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+
+        value_at(index)->~type();
+#if defined(na_ref_ptr_counted) || defined(na_ref_ptr_tracked)
+        counter_at(index)->~counter_type();
+#endif
+
+        std::scoped_lock lock{mutex};
+        free_slots.push_back(index);
+    }
+
+    inline static std::mutex registry_mutex;
+    inline static std::atomic<referable_pool *> pools[max_pools] = {};
+
+    std::uint32_t pool_id = 0;
+#if defined(na_ref_ptr_tracked)
+    std::source_location location;
+#endif
+    mutable std::mutex mutex;
+    std::uint32_t slot_count = 0;
+    std::vector<std::uint32_t> free_slots;
+    std::atomic<chunk *> chunks[max_slots / chunk_size] = {};
+};
+
+/// @brief pooled_ref<type> is a counted reference to a value stored in a referable_pool<type>.
+///
+/// A pooled_ref holds the 32-bit id and generation of the slot instead of pointers and looks the value up through the
+/// pool when dereferenced. In the tracked implementation dereferencing a pooled_ref checks that the slot was not
+/// released, and calls the referable after free handler if it was.
+///
+/// @tparam type The type of the value pointed to by the pooled_ref.
+/// @tparam counter_policy The policy used to count the references.
+template <typename type, typename counter_policy> class pooled_ref
+{
+    using pool_type = referable_pool<type, counter_policy>;
+
+  public:
+    /// @brief Constructs an empty pooled_ref.
+    pooled_ref(
+#if defined(na_ref_ptr_tracked)
+        const std::source_location &loc = std::source_location::current()
+#endif
+            ) noexcept
+#if defined(na_ref_ptr_tracked)
+        : list_node{loc}
+#endif
+    {
+    }
+
+    /// @brief Copy constructor
+    /// @param other The other pooled_ref
+    pooled_ref(const pooled_ref &other
+#if defined(na_ref_ptr_tracked)
+               ,
+               const std::source_location &loc = std::source_location::current()
+#endif
+               ) noexcept
+        : id{other.id}, generation{other.generation}
+#if defined(na_ref_ptr_tracked)
+          ,
+          list_node{loc}
+#endif
+    {
+        if (*this)
+        {
+            add_ref();
+        }
+    }
+
+    /// @brief Move constructor
+    /// @param other The other pooled_ref
+    pooled_ref(pooled_ref &&other) noexcept : id{other.id}, generation{other.generation}
+    {
+        if (*this)
+        {
+#if defined(na_ref_ptr_tracked)
+            counter()->move_ref(&other.list_node, &list_node);
+#endif
+            other.id = pool_type::invalid_id;
+        }
+    }
+
+    /// @brief Copy assignment
+    /// @param other The other pooled_ref
+    /// @return This pooled_ref
+    pooled_ref &operator=(const pooled_ref &other) noexcept
+    {
+        if (this != &other)
+        {
+            pooled_ref copy{other};
+            *this = std::move(copy);
+        }
+
+        return *this;
+    }
+
+    /// @brief Move assignment
+    /// @param other The other pooled_ref
+    /// @return This pooled_ref
+    pooled_ref &operator=(pooled_ref &&other) noexcept
+    {
+        if (this != &other)
+        {
+            reset();
+
+            if (other)
+            {
+                id = other.id;
+                generation = other.generation;
+#if defined(na_ref_ptr_tracked)
+                    counter()->move_ref(&other.list_node, &list_node);
+#endif
+                other.id = pool_type::invalid_id;
+            }
+        }
+
+        return *this;
+    }
+
+    /// @brief Destroys the pooled_ref and removes the reference
+    ~pooled_ref()
+    {
+        reset();
+    }
+
+    /// @brief Makes the pooled_ref empty.
+    void reset() noexcept
+    {
+        if (*this)
+        {
+#if defined(na_ref_ptr_counted) && defined(na_ref_ptr_deferred_releases)
+            if (!release_buffer::defer(counter()))
+            {
+                counter()->remove_ref();
+            }
+#elif defined(na_ref_ptr_counted)
+            counter()->remove_ref();
+#elif defined(na_ref_ptr_tracked)
+            counter()->remove_ref(&list_node);
+#endif
+#if defined(na_ref_ptr_statistics) && (defined(na_ref_ptr_counted) || defined(na_ref_ptr_tracked))
+            count_statistics<type>(statistics_event::remove_ref);
+#endif
+            id = pool_type::invalid_id;
+        }
+    }
+
+    /// @brief Tests whether the pooled_ref points to a value.
+    /// @return true if the pooled_ref points to a value.
+    explicit operator bool() const noexcept
+    {
+        return id != pool_type::invalid_id;
+    }
+
+#if defined(na_ref_ptr_counted) || defined(na_ref_ptr_tracked)
+    /// @brief Gets the number of references to the slot.
+    /// @return The number of references, or 0 if the pooled_ref is empty.
+    std::size_t use_count() const
+    {
+        return *this ? counter()->use_count() : 0;
+    }
+#endif
+
+    /// @brief Gets the value pointed to by the pooled_ref.
+    /// @return A pointer to the value, or nullptr if the pooled_ref is empty.
+    type *get() const noexcept
+    {
+        if (!*this)
+        {
+            return nullptr;
+        }
+
+        const pool_type &pool = pool_type::pool_of(id);
+
+#if defined(na_ref_ptr_tracked)
+        if (pool.generation_at(id & pool_type::slot_mask) != generation)
+        {
+            report_referable_after_free("pooled_ref used after its slot was released");
+        }
+#endif
+
+        return pool.value_at(id & pool_type::slot_mask);
+    }
+
+    type *operator->() const noexcept
+    {
+        return get();
+    }
+
+    type &operator*() const noexcept
+    {
+        return *get();
+    }
+
+  private:
+    template <typename, typename> friend class referable_pool;
+
+    // Adds a reference to a slot that is known to be in use
+    pooled_ref(std::uint32_t id, std::uint32_t generation
+#if defined(na_ref_ptr_tracked)
+               ,
+               const std::source_location &loc
+#endif
+               ) noexcept
+        : id{id}, generation{generation}
+#if defined(na_ref_ptr_tracked)
+          ,
+          list_node{loc}
+#endif
+    {
+        add_ref();
+    }
+
+    void add_ref() noexcept
+    {
+#if defined(na_ref_ptr_counted)
+        counter()->add_ref();
+#elif defined(na_ref_ptr_tracked)
+        counter()->add_ref(&list_node);
+#endif
+#if defined(na_ref_ptr_statistics) && (defined(na_ref_ptr_counted) || defined(na_ref_ptr_tracked))
+        count_statistics<type>(statistics_event::add_ref);
+#endif
+    }
+
+#if defined(na_ref_ptr_counted) || defined(na_ref_ptr_tracked)
+    typename pool_type::counter_type *counter() const noexcept
+    {
+        return pool_type::pool_of(id).counter_at(id & pool_type::slot_mask);
+    }
+#endif
+
+    std::uint32_t id = pool_type::invalid_id;
+    std::uint32_t generation = 0;
+#if defined(na_ref_ptr_tracked)
+    ref_list_node list_node;
+#endif
+};
+
+/// @brief signal<arg_types...> calls the methods of the objects connected to it, holding a ref_ptr or a weak_ref to
+/// each of them.
+///
+/// A slot connected with a ref_ptr keeps a reference to its target, so the target must be disconnected before it is
+/// destroyed or the referable after free handler is called. A slot connected with a weak_ref is skipped once its
+/// target is destroyed.
+///
+/// The slots are kept in an immutable array that connect() and disconnect() replace with a modified copy under a mutex.
+/// emit() does not wait for a lock: like atomic_ref_ptr, the address of the current array shares one atomic word with
+/// the number of emits reading it, and a replaced array hands those emits over to a count of its own. The address must
+/// fit in 48 bits, as for atomic_ref_ptr. A replaced array is freed by the connect() or disconnect() that replaced it
+/// or by the last emit() still reading it, so the references of a disconnected slot are removed once the emits that
+/// started before the disconnect return, however many emits overlap, and slots can connect and disconnect from within
+/// emit(). At most 65535 emits, nested ones included, can read one array at a time.
+///
+/// @tparam arg_types The types of the arguments passed to the slots
+template <typename... arg_types> class signal
+{
+  public:
+    /// @brief Identifies a connected slot. 0 is never a valid connection.
+    using connection = std::uint64_t;
+
+    signal() = default;
+    signal(const signal &) = delete;
+    signal &operator=(const signal &) = delete;
+
+    ~signal()
+    {
+        const auto w = word.load(std::memory_order_acquire);
+        retire(list_of(w), readers_of(w));
+    }
+
+    /// @brief Connects a method of the object pointed by a ref_ptr. The slot keeps a reference to the object.
+    /// @param target The object the method is called on.
+    /// @param method The method, called with the arguments passed to emit().
+    /// @return The connection, to be passed to disconnect().
+    template <typename target_type, typename counter_policy, typename method_type>
+    connection connect(const ref_ptr<target_type, counter_policy> &target, method_type method
+#if defined(na_ref_ptr_tracked)
+                       ,
+                       const std::source_location &loc = std::source_location::current()
+#endif
+    )
+    {
+        return add([target = ref_ptr<target_type, counter_policy>{target
+#if defined(na_ref_ptr_tracked)
+                                                                  ,
+                                                                  loc
+#endif
+                    },
+                    method](arg_types... args) mutable { std::invoke(method, *target, args...); });
+    }
+
+    /// @brief Connects a method of the object pointed by a weak_ref. The slot is skipped once the object is destroyed.
+    /// @param target The object the method is called on.
+    /// @param method The method, called with the arguments passed to emit().
+    /// @return The connection, to be passed to disconnect().
+    template <typename target_type, typename counter_policy, typename method_type>
+    connection connect(const weak_ref<target_type, counter_policy> &target, method_type method)
+    {
+        return add([target, method](arg_types... args) {
+            if (auto locked = target.lock())
+            {
+                std::invoke(method, *locked, args...);
+            }
+        });
+    }
+
+    /// @brief Disconnects a slot.
+    /// @param c The connection returned by connect().
+    /// @return true if the slot was connected.
+    bool disconnect(connection c)
+    {
+        std::scoped_lock lock{mutex};
+
+        const slot_list *list = list_of(word.load(std::memory_order_relaxed));
+        if (list == nullptr)
+        {
+            return false;
+        }
+
+        auto *updated = new slot_list;
+        updated->slots.reserve(list->slots.size());
+
+        for (const auto &s : list->slots)
+        {
+            if (s->id != c)
+            {
+                updated->slots.push_back(s);
+            }
+        }
+
+        const bool found = updated->slots.size() != list->slots.size();
+        publish(updated);
+        return found;
+    }
+
+    /// @brief Disconnects all the slots.
+    void disconnect_all()
+    {
+        std::scoped_lock lock{mutex};
+        publish(nullptr);
+    }
+
+    /// @brief Calls all the connected slots with the arguments.
+    /// @param args The arguments passed to the slots.
+    void emit(arg_types... args) const
+    {
+        emit_scope scope{*this};
+
+        const slot_list *list = scope.list;
+        if (list == nullptr)
+        {
+            return;
+        }
+
+        for (const auto &s : list->slots)
+        {
+            s->call(args...);
+        }
+    }
+
+    /// @brief Calls all the connected slots with the arguments.
+    /// @param args The arguments passed to the slots.
+    void operator()(arg_types... args) const
+    {
+        emit(args...);
+    }
+
+    /// @brief Gets the number of connected slots.
+    /// @return The number of connected slots.
+    std::size_t size() const
+    {
+        std::scoped_lock lock{mutex};
+
+        const slot_list *list = list_of(word.load(std::memory_order_relaxed));
+        return list == nullptr ? 0 : list->slots.size();
+    }
+
+  private:
+    struct slot
+    {
+        connection id;
+        std::function<void(arg_types...)> call;
+    };
+
+    // Slots are shared between the arrays so that copying an array does not copy the references they hold
+    struct slot_list
+    {
+        std::vector<std::shared_ptr<const slot>> slots;
+
+        // Emits handed over when the array was replaced, minus the ones that returned since
+        std::atomic<std::int64_t> readers{0};
+    };
+
+    // Counts the emit as a reader of the current array, so that the array is not freed before the emit returns
+    struct emit_scope
+    {
+        explicit emit_scope(const signal &sig) noexcept
+            : sig{sig}, list{list_of(sig.word.fetch_add(one_reader, std::memory_order_acquire))}
+        {
+        }
+
+        ~emit_scope()
+        {
+            auto current = sig.word.load(std::memory_order_relaxed);
+            while (list_of(current) == list)
+            {
+                if (sig.word.compare_exchange_weak(current, current - one_reader, std::memory_order_release,
+                                                   std::memory_order_relaxed))
+                {
+                    return;
+                }
+            }
+
+            // The array was replaced and this emit was handed over to it
+            if (list != nullptr && list->readers.fetch_sub(1, std::memory_order_acq_rel) == 1)
+            {
+                delete list;
+            }
+        }
+
+        const signal &sig;
+        slot_list *const list;
+    };
+
+    static constexpr int readers_shift = 48;
+    static constexpr std::uint64_t one_reader = std::uint64_t{1} << readers_shift;
+    static constexpr std::uint64_t address_mask = one_reader - 1;
+
+    static std::uint64_t to_word(slot_list *list) noexcept
+    {
+        const std::uint64_t w = reinterpret_cast<std::uintptr_t>(list);
+        assert((w & ~address_mask) == 0 && "the address of the slot array must fit in 48 bits");
+        return w;
+    }
+
+    static slot_list *list_of(std::uint64_t w) noexcept
+    {
+        return reinterpret_cast<slot_list *>(static_cast<std::uintptr_t>(w & address_mask));
+    }
+
+    static std::int64_t readers_of(std::uint64_t w) noexcept
+    {
+        return static_cast<std::int64_t>(w >> readers_shift);
+    }
+
+    static void retire(slot_list *list, std::int64_t readers) noexcept
+    {
+        if (list != nullptr && list->readers.fetch_add(readers, std::memory_order_acq_rel) == -readers)
+        {
+            delete list;
+        }
+    }
+
+    connection add(std::function<void(arg_types...)> call)
+    {
+        std::scoped_lock lock{mutex};
+
+        const slot_list *list = list_of(word.load(std::memory_order_relaxed));
+        auto *updated = new slot_list;
+        if (list != nullptr)
+        {
+            updated->slots = list->slots;
+        }
+
+        const connection id = ++last_connection;
+        updated->slots.push_back(std::make_shared<const slot>(slot{id, std::move(call)}));
+
+        publish(updated);
+        return id;
+    }
+
+    // Must be called with the mutex held. The emits reading the replaced array are handed over to it, and the last of
+    // them frees it
+    void publish(slot_list *updated)
+    {
+        const auto previous = word.exchange(to_word(updated), std::memory_order_acq_rel);
+        retire(list_of(previous), readers_of(previous));
+    }
+
+    mutable std::mutex mutex;
+    mutable std::atomic<std::uint64_t> word{0};
+    connection last_connection = 0;
+};
+
+/// @brief atomic_ref_ptr<type> is a ref_ptr<type> that threads can load and store concurrently.
+///
+/// The ref_ptr is kept in a heap allocated box and the atomic holds a single 64-bit word, with the address of the box
+/// in the lower 48 bits and the number of threads reading the box in the upper 16 bits. Loading adds to the readers in
+/// the same atomic operation that reads the address, copies the ref_ptr out of the box and removes the reader again,
+/// so loading a counted ref_ptr never waits for a lock. A store that replaces the box hands the readers still copying
+/// from it over to the box, and the last of them frees it, which removes the reference the box holds.
+///
+/// This needs the addresses of the boxes to fit in 48 bits, which debug builds assert. They do with the 4-level page
+/// tables of x86-64 and arm64 user space, but not with 5-level paging (LA57) when a process maps memory above 128 TiB,
+/// or with pointers whose top byte is tagged, such as the TBI and MTE heap tags of Android on arm64.
+///
+/// @tparam type The type of the value pointed to by the ref_ptr.
+/// @tparam counter_policy The policy used to count the references.
+template <typename type, typename counter_policy> class atomic_ref_ptr
+{
+    static_assert(sizeof(void *) == sizeof(std::uint64_t), "atomic_ref_ptr needs 64-bit pointers");
+
+  public:
+    /// @brief Constructs an empty atomic_ref_ptr.
+    constexpr atomic_ref_ptr() noexcept = default;
+
+    /// @brief Constructs an atomic_ref_ptr holding a ref_ptr.
+    /// @param desired The ref_ptr to hold.
+    atomic_ref_ptr(ref_ptr<type, counter_policy> desired) : word{to_word(make_box(std::move(desired)))}
+    {
+    }
+
+    atomic_ref_ptr(const atomic_ref_ptr &) = delete;
+    atomic_ref_ptr &operator=(const atomic_ref_ptr &) = delete;
+
+    ~atomic_ref_ptr()
+    {
+        const auto current = word.load(std::memory_order_acquire);
+        retire(box_of(current), readers_of(current));
+    }
+
+    /// @brief Loads the ref_ptr.
+    /// @return A copy of the ref_ptr held.
+    ref_ptr<type, counter_policy> load(
+#if defined(na_ref_ptr_tracked)
+        const std::source_location &loc = std::source_location::current()
+#endif
+            ) const
+    {
+        box *b = acquire_box();
+
+        ref_ptr<type, counter_policy> ptr = b == nullptr ? ref_ptr<type, counter_policy>{
+#if defined(na_ref_ptr_tracked)
+                                                               loc
+#endif
+                                                           }
+                                                         : ref_ptr<type, counter_policy>{b->ptr
+#if defined(na_ref_ptr_tracked)
+                                                                                         ,
+                                                                                         loc
+#endif
+                                                           };
+
+        release_box(b);
+        return ptr;
+    }
+
+    /// @brief Loads the ref_ptr.
+    operator ref_ptr<type, counter_policy>() const
+    {
+        return load();
+    }
+
+    /// @brief Stores a ref_ptr, the ref_ptr held before is released once no thread is loading it.
+    /// @param desired The ref_ptr to hold.
+    void store(ref_ptr<type, counter_policy> desired)
+    {
+        const auto previous = word.exchange(to_word(make_box(std::move(desired))), std::memory_order_acq_rel);
+        retire(box_of(previous), readers_of(previous));
+    }
+
+    /// @brief Stores a ref_ptr and returns the ref_ptr held before.
+    /// @param desired The ref_ptr to hold.
+    /// @return The ref_ptr held before.
+    ref_ptr<type, counter_policy> exchange(ref_ptr<type, counter_policy> desired
+#if defined(na_ref_ptr_tracked)
+                                           ,
+                                           const std::source_location &loc = std::source_location::current()
+#endif
+    )
+    {
+        const auto previous = word.exchange(to_word(make_box(std::move(desired))), std::memory_order_acq_rel);
+        box *b = box_of(previous);
+
+        // The box is not freed before it is retired, so it can be copied without being acquired
+        ref_ptr<type, counter_policy> ptr = b == nullptr ? ref_ptr<type, counter_policy>{
+#if defined(na_ref_ptr_tracked)
+                                                               loc
+#endif
+                                                           }
+                                                         : ref_ptr<type, counter_policy>{b->ptr
+#if defined(na_ref_ptr_tracked)
+                                                                                         ,
+                                                                                         loc
+#endif
+                                                           };
+
+        retire(b, readers_of(previous));
+        return ptr;
+    }
+
+    /// @brief Stores desired if the ref_ptr held points to the same value of the same referable as expected, otherwise
+    /// loads the ref_ptr held into expected.
+    /// @param expected The ref_ptr expected to be held.
+    /// @param desired The ref_ptr to hold.
+    /// @return true if desired was stored.
+    bool compare_exchange_strong(ref_ptr<type, counter_policy> &expected, ref_ptr<type, counter_policy> desired)
+    {
+        box *updated = make_box(std::move(desired));
+
+        for (;;)
+        {
+            box *b = acquire_box();
+
+            if (!holds(b, expected))
+            {
+                expected = b == nullptr ? ref_ptr<type, counter_policy>{} : b->ptr;
+                release_box(b);
+                delete updated;
+                return false;
+            }
+
+            auto current = word.load(std::memory_order_relaxed);
+            while (box_of(current) == b)
+            {
+                if (word.compare_exchange_weak(current, to_word(updated), std::memory_order_acq_rel,
+                                               std::memory_order_relaxed))
+                {
+                    // This thread is one of the readers of the replaced box and is done with it
+                    retire(b, readers_of(current) - 1);
+                    return true;
+                }
+            }
+
+            // Another thread replaced the box in the meantime, compare with the new one
+            release_box(b);
+        }
+    }
+
+    /// @brief Same as compare_exchange_strong(), which does not fail spuriously.
+    bool compare_exchange_weak(ref_ptr<type, counter_policy> &expected, ref_ptr<type, counter_policy> desired)
+    {
+        return compare_exchange_strong(expected, std::move(desired));
+    }
+
+  private:
+    struct box
+    {
+        ref_ptr<type, counter_policy> ptr;
+
+        // Readers handed over when the box was replaced, minus the ones that finished since
+        std::atomic<std::int64_t> readers{0};
+    };
+
+    static constexpr int readers_shift = 48;
+    static constexpr std::uint64_t one_reader = std::uint64_t{1} << readers_shift;
+    static constexpr std::uint64_t address_mask = one_reader - 1;
+
+    static box *make_box(ref_ptr<type, counter_policy> &&ptr)
+    {
+        return ptr ? new box{std::move(ptr)} : nullptr;
+    }
+
+    static std::uint64_t to_word(box *b) noexcept
+    {
+        const auto w = reinterpret_cast<std::uint64_t>(b);
+        assert((w & ~address_mask) == 0 && "the address of the box must fit in 48 bits");
+        return w;
+    }
+
+    static box *box_of(std::uint64_t w) noexcept
+    {
+        return reinterpret_cast<box *>(w & address_mask);
+    }
+
+    static std::int64_t readers_of(std::uint64_t w) noexcept
+    {
+        return static_cast<std::int64_t>(w >> readers_shift);
+    }
+
+    static bool holds(const box *b, const ref_ptr<type, counter_policy> &expected) noexcept
+    {
+        if (b == nullptr)
+        {
+            return !expected;
+        }
+
+#if defined(na_ref_ptr_counted) || defined(na_ref_ptr_tracked)
+        return b->ptr.ref_count == expected.ref_count && b->ptr.value == expected.value;
+#else
+        return b->ptr.value == expected.value;
+#endif
+    }
+
+    // Counts the calling thread as a reader of the current box, so that it is not freed before release_box()
+    box *acquire_box() const noexcept
+    {
+        return box_of(word.fetch_add(one_reader, std::memory_order_acquire));
+    }
+
+    void release_box(box *b) const noexcept
+    {
+        auto current = word.load(std::memory_order_relaxed);
+        while (box_of(current) == b)
+        {
+            if (word.compare_exchange_weak(current, current - one_reader, std::memory_order_release,
+                                           std::memory_order_relaxed))
+            {
+                return;
+            }
+        }
+
+        // The box was replaced and this thread was handed over to it
+        if (b != nullptr && b->readers.fetch_sub(1, std::memory_order_acq_rel) == 1)
+        {
+            delete b;
+        }
+    }
+
+    static void retire(box *b, std::int64_t readers) noexcept
+    {
+        if (b != nullptr && b->readers.fetch_add(readers, std::memory_order_acq_rel) == -readers)
+        {
+            delete b;
+        }
+    }
+
+    mutable std::atomic<std::uint64_t> word{0};
+};
+
+/// @brief versioned_referable<type> holds the current version of a value that is replaced while readers hold
+/// ref_ptrs to the versions they read, such as a configuration or a routing table.
+///
+/// publish() installs a new version without waiting for the readers, and load() returns a ref_ptr to the version
+/// current at the time, which stays valid until that ref_ptr is gone. The replaced versions are kept until their
+/// references drain, and publish() and reclaim() destroy the ones that have. The versions left when the
+/// versioned_referable is destroyed are destroyed with it, and like any referable report the references still pointing
+/// at them.
+///
+/// The current version is held in a single 64-bit word, with the address of the version in the lower 48 bits and a
+/// count of references in the upper 16 bits, like atomic_ref_ptr and with the same limits on the addresses. In the
+/// counted implementation load() is a single acquire fetch_add on the word: the reference it returns is counted in the
+/// word and moved to the count of the version when the version is replaced, or when the word is about to overflow, so
+/// the use_count() of a loaded ref_ptr leaves those references out until then. The tracked implementation links the
+/// reference into the reference list of the version, so loading counts the reader in the word while it adds its
+/// reference. The uncounted implementation can not tell when a version is no longer referred to and keeps the replaced
+/// versions until the versioned_referable is destroyed.
+///
+/// @tparam type The value type
+/// @tparam counter_policy The policy used to count the references to each version
+template <typename type, typename counter_policy> class versioned_referable
+{
+    static_assert(sizeof(void *) == sizeof(std::uint64_t), "versioned_referable needs 64-bit pointers");
+
+  public:
+    /// @brief Constructs a versioned_referable with its first version.
+    /// @param initial The value of the first version.
+    /// @param loc The source location of the first version.
+    explicit versioned_referable(type initial
+#if defined(na_ref_ptr_tracked)
+                                 ,
+                                 const std::source_location &loc = std::source_location::current()
+#endif
+                                 )
+        : word{to_word(new version{std::move(initial)
+#if defined(na_ref_ptr_tracked)
+                                   ,
+                                   loc
+#endif
+          })}
+    {
+    }
+
+    versioned_referable(const versioned_referable &) = delete;
+    versioned_referable &operator=(const versioned_referable &) = delete;
+
+    /// @brief Destroys all the versions, the referable after free handler is called for the ones still referred to.
+    ~versioned_referable()
+    {
+        std::scoped_lock lock{mutex};
+        retire(word.exchange(0, std::memory_order_acq_rel));
+
+        while (retired != nullptr)
+        {
+            delete std::exchange(retired, retired->next);
+        }
+    }
+
+    /// @brief Gets a reference to the current version.
+    /// @param loc The source location of the ref_ptr.
+    /// @return A ref_ptr to the current version, which stays valid when a new version is published.
+    ref_ptr<const type, counter_policy> load(
+#if defined(na_ref_ptr_tracked)
+        const std::source_location &loc = std::source_location::current()
+#endif
+    ) const noexcept
+    {
+#if defined(na_ref_ptr_counted)
+        const std::uint64_t previous = word.fetch_add(one_ref, std::memory_order_acquire);
+        version *v = version_of(previous);
+
+        if (refs_of(previous) + 1 >= fold_threshold)
+        {
+            fold(previous + one_ref);
+        }
+
+        // The reference is already counted, in the word
+        ref_ptr<const type, counter_policy> ptr;
+        ptr.ref_count = &v->value.ref_count;
+        ptr.value = &v->value.value;
+#if defined(na_ref_ptr_statistics)
+        count_statistics<const type>(statistics_event::add_ref);
+#endif
+        return ptr;
+#elif defined(na_ref_ptr_tracked)
+        // The word counts this thread while it adds its reference, so that the version is not destroyed before
+        version *v = version_of(word.fetch_add(one_ref, std::memory_order_acquire));
+        ref_ptr<const type, counter_policy> ptr{std::as_const(v->value), loc};
+        unpin(v);
+        return ptr;
+#else
+        return {std::as_const(version_of(word.load(std::memory_order_acquire))->value)};
+#endif
+    }
+
+    /// @brief Installs a new version. The readers are not waited for, the versions replaced before whose references
+    /// have drained are destroyed.
+    /// @param value The value of the new version.
+    /// @param loc The source location of the new version.
+    void publish(type value
+#if defined(na_ref_ptr_tracked)
+                 ,
+                 const std::source_location &loc = std::source_location::current()
+#endif
+    )
+    {
+        version *v = new version{std::move(value)
+#if defined(na_ref_ptr_tracked)
+                                 ,
+                                 loc
+#endif
+        };
+
+        std::scoped_lock lock{mutex};
+        retire(word.exchange(to_word(v), std::memory_order_acq_rel));
+        reclaim_drained();
+    }
+
+    /// @brief Destroys the replaced versions whose references have drained.
+    void reclaim()
+    {
+        std::scoped_lock lock{mutex};
+        reclaim_drained();
+    }
+
+  private:
+    struct version
+    {
+        explicit version(type &&val
+#if defined(na_ref_ptr_tracked)
+                         ,
+                         const std::source_location &loc
+#endif
+                         )
+            : value{std::move(val)
+#if defined(na_ref_ptr_tracked)
+                    ,
+                    loc
+#endif
+              }
+        {
+        }
+
+        referable<type, counter_policy> value;
+        version *next = nullptr; // in the list of replaced versions
+#if defined(na_ref_ptr_tracked)
+        // Readers that were adding their reference when the version was replaced, minus the ones that finished since
+        std::atomic<std::int64_t> readers{0};
+#endif
+    };
+
+    static constexpr int refs_shift = 48;
+    static constexpr std::uint64_t one_ref = std::uint64_t{1} << refs_shift;
+    static constexpr std::uint64_t address_mask = one_ref - 1;
+    static constexpr std::int64_t fold_threshold = std::int64_t{1} << 15;
+
+    static std::uint64_t to_word(version *v) noexcept
+    {
+        const auto w = reinterpret_cast<std::uint64_t>(v);
+        assert((w & ~address_mask) == 0 && "the address of the version must fit in 48 bits");
+        return w;
+    }
+
+    static version *version_of(std::uint64_t w) noexcept
+    {
+        return reinterpret_cast<version *>(w & address_mask);
+    }
+
+    static std::int64_t refs_of(std::uint64_t w) noexcept
+    {
+        return static_cast<std::int64_t>(w >> refs_shift);
+    }
+
+#if defined(na_ref_ptr_counted)
+    // Moves the references counted in the word to the count of the version, before the word overflows
+    void fold(std::uint64_t current) const noexcept
+    {
+        version *v = version_of(current);
+
+        while (version_of(current) == v)
+        {
+            // The references are added before they are cleared from the word, so that a publish() in between does not
+            // retire the version without them
+            const auto refs = static_cast<std::size_t>(refs_of(current));
+            v->value.ref_count.add_refs(refs);
+
+            if (word.compare_exchange_weak(current, to_word(v), std::memory_order_release, std::memory_order_relaxed))
+            {
+                return;
+            }
+
+            v->value.ref_count.remove_refs(refs);
+        }
+
+        // The version was replaced in the meantime, and publish() moved the references
+    }
+#elif defined(na_ref_ptr_tracked)
+    void unpin(version *v) const noexcept
+    {
+        auto current = word.load(std::memory_order_relaxed);
+        while (version_of(current) == v)
+        {
+            if (word.compare_exchange_weak(current, current - one_ref, std::memory_order_release,
+                                           std::memory_order_relaxed))
+            {
+                return;
+            }
+        }
+
+        // The version was replaced and this thread was handed over to it
+        v->readers.fetch_sub(1, std::memory_order_acq_rel);
+    }
+#endif
+
+    // Hands the references counted in the word of a replaced version over to it, and keeps it until they drain
+    void retire(std::uint64_t w) noexcept
+    {
+        version *v = version_of(w);
+
+#if defined(na_ref_ptr_counted)
+        v->value.ref_count.add_refs(static_cast<std::size_t>(refs_of(w)));
+#elif defined(na_ref_ptr_tracked)
+        v->readers.fetch_add(refs_of(w), std::memory_order_acq_rel);
+#endif
+
+        v->next = retired;
+        retired = v;
+    }
+
+    void reclaim_drained() noexcept
+    {
+#if defined(na_ref_ptr_counted) || defined(na_ref_ptr_tracked)
+        for (version **link = &retired; *link != nullptr;)
+        {
+            version *v = *link;
+
+#if defined(na_ref_ptr_tracked)
+            const bool drained =
+                v->readers.load(std::memory_order_acquire) == 0 && v->value.ref_count.use_count() == 0;
+#else
+            flush_deferred_releases_of(&v->value.ref_count);
+            const bool drained = v->value.ref_count.use_count() == 0;
+#endif
+
+            if (drained)
+            {
+                *link = v->next;
+                delete v;
+            }
+            else
+            {
+                link = &v->next;
+            }
+        }
+#endif
+    }
+
+    mutable std::atomic<std::uint64_t> word;
+
+    // Serializes the writers, the readers never take it
+    std::mutex mutex;
+    version *retired = nullptr;
+};
+
+/// @brief Points ranges of ref_ptrs at a referable and releases them with a single count update for the whole range.
+class ref_batch
+{
+  public:
+    template <typename referable_type> static auto *count_of(referable_type &ref) noexcept
+    {
+#if defined(na_ref_ptr_counted) || defined(na_ref_ptr_tracked)
+        return &ref.ref_count;
+#else
+        static_cast<void>(ref);
+        return static_cast<void *>(nullptr);
+#endif
+    }
+
+    template <typename ref_type, typename counter_policy>
+    static auto *value_of(referable<ref_type, counter_policy> &ref) noexcept
+    {
+        return &ref.value;
+    }
+
+    template <typename ref_type, typename counter_policy>
+    static auto *value_of(const referable<ref_type, counter_policy> &ref) noexcept
+    {
+        return &ref.value;
+    }
+
+    template <typename ref_type, typename counter_policy>
+    static auto *value_of(enable_ref_from_this<ref_type, counter_policy> &ref) noexcept
+    {
+        return &static_cast<ref_type &>(ref);
+    }
+
+    template <typename iterator, typename counter_type, typename value_type>
+    static void add(counter_type *count, value_type *value, iterator first, iterator last
+#if defined(na_ref_ptr_tracked)
+                    ,
+                    const std::source_location &loc
+#endif
+                    ) noexcept
+    {
+        release(first, last);
+
+#if defined(na_ref_ptr_tracked)
+        const std::uint32_t location = source_location_table::intern(loc);
+#endif
+        std::size_t n = 0;
+
+        for (iterator it = first; it != last; ++it, ++n)
+        {
+#if defined(na_ref_ptr_counted) || defined(na_ref_ptr_tracked)
+            it->ref_count = count;
+#endif
+#if defined(na_ref_ptr_tracked)
+            it->list_node.set_location(location);
+#endif
+            it->value = value;
+        }
+
+#if defined(na_ref_ptr_counted)
+        count->add_refs(n);
+#elif defined(na_ref_ptr_tracked)
+        count->add_refs(first, last, [](auto &ptr) { return &ptr.list_node; });
+#else
+        static_cast<void>(count);
+#endif
+#if defined(na_ref_ptr_statistics) && (defined(na_ref_ptr_counted) || defined(na_ref_ptr_tracked))
+        count_statistics<value_type>(statistics_event::add_ref, n);
+#endif
+    }
+
+    template <typename iterator> static void release(iterator first, iterator last) noexcept
+    {
+        while (first != last)
+        {
+#if defined(na_ref_ptr_counted) || defined(na_ref_ptr_tracked)
+            auto *count = first->ref_count;
+            iterator run = first;
+            std::size_t n = 0;
+
+            // Consecutive ref_ptrs to the same referable are released together
+            for (; first != last && first->ref_count == count; ++first, ++n)
+            {
+            }
+
+            if (count != nullptr)
+            {
+#if defined(na_ref_ptr_counted)
+                count->remove_refs(n);
+#else
+                count->remove_refs(run, first, [](auto &ptr) { return &ptr.list_node; });
+#endif
+#if defined(na_ref_ptr_statistics) && (defined(na_ref_ptr_counted) || defined(na_ref_ptr_tracked))
+                count_statistics<std::remove_pointer_t<decltype(run->value)>>(statistics_event::remove_ref, n);
+#endif
+            }
+
+            for (; run != first; ++run)
+            {
+                run->ref_count = nullptr;
+                run->value = nullptr;
+            }
+#else
+            first->value = nullptr;
+            ++first;
+#endif
+        }
+    }
+};
+
+/// @brief Points every ref_ptr in a range at a referable<type> object, with a single count update for the range.
+///
+/// This is the bulk version of assigning each ref_ptr from the referable, for fanning a referable out to many
+/// subscribers. The tracked implementation links all the references into the reference list under a single lock. The
+/// ref_ptrs are released first if they are not empty.
+/// @param ref The referable object.
+/// @param first The first ref_ptr to point at the referable.
+/// @param last One past the last ref_ptr to point at the referable.
+template <typename ref_type, typename counter_policy, typename iterator>
+void make_refs(referable<ref_type, counter_policy> &ref, iterator first, iterator last
+#if defined(na_ref_ptr_tracked)
+               ,
+               const std::source_location &loc = std::source_location::current()
+#endif
+               ) noexcept
+{
+    ref_batch::add(ref_batch::count_of(ref), ref_batch::value_of(ref), first, last
+#if defined(na_ref_ptr_tracked)
+                   ,
+                   loc
+#endif
+    );
+}
+
+/// @brief Points every ref_ptr in a range at a const referable<type> object, with a single count update for the range.
+/// @param ref The referable object.
+/// @param first The first ref_ptr to point at the referable.
+/// @param last One past the last ref_ptr to point at the referable.
+template <typename ref_type, typename counter_policy, typename iterator>
+void make_refs(const referable<ref_type, counter_policy> &ref, iterator first, iterator last
+#if defined(na_ref_ptr_tracked)
+               ,
+               const std::source_location &loc = std::source_location::current()
+#endif
+               ) noexcept
+{
+    ref_batch::add(ref_batch::count_of(ref), ref_batch::value_of(ref), first, last
+#if defined(na_ref_ptr_tracked)
+                   ,
+                   loc
+#endif
+    );
+}
+
+/// @brief Points every ref_ptr in a range at an object derived from enable_ref_from_this, with a single count update
+/// for the range.
+/// @param ref The enable_ref_from_this object.
+/// @param first The first ref_ptr to point at the object.
+/// @param last One past the last ref_ptr to point at the object.
+template <typename ref_type, typename counter_policy, typename iterator>
+void make_refs(enable_ref_from_this<ref_type, counter_policy> &ref, iterator first, iterator last
+#if defined(na_ref_ptr_tracked)
+               ,
+               const std::source_location &loc = std::source_location::current()
+#endif
+               ) noexcept
+{
+    ref_batch::add(ref_batch::count_of(ref), ref_batch::value_of(ref), first, last
+#if defined(na_ref_ptr_tracked)
+                   ,
+                   loc
+#endif
+    );
+}
+
+/// @brief Makes every ref_ptr in a range empty. Consecutive ref_ptrs pointing at the same referable are released with
+/// a single count update, and in the tracked implementation under a single lock.
+/// @param first The first ref_ptr to release.
+/// @param last One past the last ref_ptr to release.
+template <typename iterator> void release_refs(iterator first, iterator last) noexcept
+{
+    ref_batch::release(first, last);
+}
+
+// pooled_refs replace the two pointers of a ref_ptr by a slot id and generation
+#if defined(na_ref_ptr_uncounted) || defined(na_ref_ptr_counted)
+static_assert(sizeof(pooled_ref<int, seq_cst_counter>) == 2 * sizeof(std::uint32_t), "pooled_ref must be 8 bytes");
+#endif
+
+} // namespace na_ref_ptr_implementation
+
+#if defined(na_ref_ptr_tracked)
+} // namespace na_ref_ptr_shards_namespace(na_ref_ptr_tracked_shards)
+#endif
+
+} // namespace na::detail
+
+#undef na_ref_ptr_implementation
@@ -0,0 +1,109 @@
+// Copyright (c) 2023 Namal Bambarasinghe
+//
+// This software is released under the MIT License.
+// https://opensource.org/licenses/MIT
+
+// The na.ref_ptr named module, exporting the names of na/ref_ptr.hpp. Macros do not cross a module boundary, so the
+// na_ref_ptr_ macros that select the implementation and configure it are the ones the module is compiled with, and
+// the importers use the basic_ aliases with the implementation tags to name the other implementations. With
+// na_ref_ptr_out_of_line_handler the referable after free handler is defined in this unit.
+
+module;
+
+#if defined(na_ref_ptr_out_of_line_handler)
+#define na_ref_ptr_define_handler
+#endif
+
+#include "ref_ptr.hpp"
+
+export module na.ref_ptr;
+
+export namespace na
+{
+
+// Implementations
+using na::counted;
+using na::default_implementation;
+using na::sampled;
+using na::tracked;
+using na::uncounted;
+
+// Counter policies
+using na::distributed_counter;
+using na::draining_counter;
+using na::isolated_counter;
+using na::profiled_counter;
+using na::relaxed_counter;
+using na::seq_cst_counter;
+using na::unsynchronized_counter;
+
+// Referables and references of the selected implementation
+using na::atomic_ref_ptr;
+using na::draining_referable;
+using na::enable_ref_from_this;
+using na::enable_weak_ref_from_this;
+using na::pooled_ref;
+using na::ref_ptr;
+using na::ref_view;
+using na::referable;
+using na::referable_array;
+using na::referable_pool;
+using na::signal;
+using na::versioned_referable;
+using na::weak_ref;
+using na::weakly_referable;
+
+// Referables and references of any implementation
+using na::basic_atomic_ref_ptr;
+using na::basic_draining_referable;
+using na::basic_enable_ref_from_this;
+using na::basic_enable_weak_ref_from_this;
+using na::basic_pooled_ref;
+using na::basic_ref_ptr;
+using na::basic_ref_view;
+using na::basic_referable;
+using na::basic_referable_array;
+using na::basic_referable_pool;
+using na::basic_signal;
+using na::basic_versioned_referable;
+using na::basic_weak_ref;
+using na::basic_weakly_referable;
+
+// Paths, casts, batches and relocation
+using na::const_ref_cast;
+using na::dynamic_ref_cast;
+using na::index;
+using na::is_trivially_relocatable;
+using na::is_trivially_relocatable_v;
+using na::make_refs;
+using na::path;
+using na::release_refs;
+using na::relocate_range;
+using na::static_path;
+using na::static_ref_cast;
+
+// Deferred releases
+using na::deferred_release_scope;
+using na::flush_deferred_releases;
+
+// Referable after free handler and reports
+using na::get_referable_after_free_handler;
+using na::referable_after_free_handler;
+using na::referable_after_free_handler_function;
+using na::report_live_referables_at_exit;
+using na::report_sink;
+using na::set_referable_after_free_handler;
+using na::write_live_referables;
+
+// Statistics and contention profile
+using na::contention_record;
+using na::export_statistics;
+using na::get_contention_profile;
+using na::get_statistics;
+using na::set_statistics_exporter;
+using na::statistics_exporter;
+using na::statistics_snapshot;
+using na::type_statistics;
+using na::write_contention_profile;
+
+} // namespace na
@@ -6,30 +6,35 @@
 #ifndef NA_REF_PTR_HPP
 #define NA_REF_PTR_HPP
 
-#if !defined(na_ref_ptr_uncounted) && !defined(na_ref_ptr_counted) && !defined(na_ref_ptr_tracked)
+#include "detail/ref_ptr_core_definitions.hpp"
 
-// ref_ptr implementation is not defined, define the default below
+#include <algorithm>
+#include <charconv>
+#include <chrono>
+#include <coroutine>
+#include <source_location>
 
-#ifdef NDEBUB
-#define na_ref_ptr_counted // defaults to counted in the release build
-#else
-#define na_ref_ptr_tracked // defaults to tracked in the debug build
-#endif
+#include <cassert>
+#include <cstdlib>
+#include <functional>
+#include <initializer_list>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
 
+#if defined(_MSC_VER)
+#include <intrin.h>
 #endif
 
-#if defined(na_ref_ptr_counted)
-#include <atomic>
+#if defined(na_ref_ptr_stack_traces)
+#if !__has_include(<execinfo.h>) || !__has_include(<dlfcn.h>)
+#error "na_ref_ptr_stack_traces needs backtrace() from <execinfo.h> and dladdr() from <dlfcn.h>"
 #endif
-
-#if defined(na_ref_ptr_tracked)
-#include <source_location>
+#include <dlfcn.h>
+#include <execinfo.h>
 #endif
 
-#include <functional>
-#include <mutex>
-#include <string>
-
 namespace na
 {
 
@@ -37,1055 +42,1679 @@ using referable_after_free_handler = std::function<void(const std::string &)>;
 
 namespace detail
 {
-inline std::mutex referable_after_free_handler_mutex;
 
-inline referable_after_free_handler referable_after_free_handler_instance = [](const std::string &msg) {
-    std::fputs(msg.c_str(), stderr);
-    __debugbreak();
-    std::terminate();
-};
+inline void invoke_referable_after_free_handler(void *context, std::string_view message)
+{
+    (*static_cast<const referable_after_free_handler *>(context))(std::string{message});
+}
 
 } // namespace detail
 
-// Customization point for the referable after free handler
-// By default a referable_after_free exception is thrown if exceptions are enabled or std::terminate() is called if
-// exceptions are disabled.
-
 /// @brief Set a custom referable after free handler
+///
+/// The handler is called with a std::string copy of the message, use the referable_after_free_handler_function
+/// overload to avoid the allocation. Like that overload, each call leaks its record and a copy of the handler, so that
+/// a thread still calling the replaced handler can finish.
 /// @param handler  New referable after free handler
 inline void set_referable_after_free_handler(const referable_after_free_handler &handler)
 {
-    const auto lock = std::scoped_lock{detail::referable_after_free_handler_mutex};
-    detail::referable_after_free_handler_instance = handler;
+    set_referable_after_free_handler(detail::invoke_referable_after_free_handler,
+                                     new referable_after_free_handler{handler});
 }
 
 /// @brief Get referable after free handler
 /// @return Current referable after free handler
 inline referable_after_free_handler get_referable_after_free_handler()
 {
-    const auto lock = std::scoped_lock{detail::referable_after_free_handler_mutex};
-    return detail::referable_after_free_handler_instance;
+    const auto *record = detail::referable_after_free_handler_instance.load(std::memory_order_acquire);
+    return [record](const std::string &msg) { record->function(record->context, msg); };
 }
 
-namespace detail
-{
-#if defined(na_ref_ptr_uncounted)
-namespace uncounted
-#elif defined(na_ref_ptr_counted)
-namespace counted
-#else
-namespace tracked
-#endif
-{
-
-#if defined(na_ref_ptr_tracked)
+/// @brief Receives a report in pieces.
+/// @param context The context pointer given with the sink
+/// @param text The next piece of the report, only valid during the call
+using report_sink = void (*)(void *context, std::string_view text);
 
-struct ref_list_node
+namespace detail
 {
-    ref_list_node(const std::source_location &loc)
-    {
-        location = loc;
-    }
 
-    ref_list_node *prev = nullptr;
-    ref_list_node *next = nullptr;
-    std::source_location location;
-};
-
-class ref_counter
+/// @brief Formats a report into a fixed buffer without allocating.
+///
+/// With a sink the buffer is passed to the sink whenever it fills up, so a report of any length can be written through
+/// a small buffer. Without a sink the text that does not fit is dropped and the report ends with "...". The buffer must
+/// hold at least one character with a sink, and the "...\n" marker without one.
+class report_writer
 {
   public:
-    explicit ref_counter(size_t count, const std::source_location loc) : ref_count{count}, head(loc)
+    report_writer(char *buffer, std::size_t capacity, report_sink sink = nullptr, void *context = nullptr) noexcept
+        : buffer{buffer}, capacity{capacity}, sink{sink}, context{context}
     {
+        assert(capacity >= (sink != nullptr ? 1 : truncation_marker.size()) && "the report buffer is too small");
     }
 
-    void add_ref(ref_list_node *node) noexcept
-    {
-        std::scoped_lock lock{mutex};
-
-        ++ref_count;
-        node->next = head.next;
-        node->prev = &head;
-        head.next = node;
-    }
+    report_writer(const report_writer &) = delete;
+    report_writer &operator=(const report_writer &) = delete;
 
-    void remove_ref(ref_list_node *node) noexcept
+    report_writer &operator<<(std::string_view text) noexcept
     {
-        std::scoped_lock lock{mutex};
-
-        --ref_count;
-
-        node->prev->next = node->next;
-
-        if (node->next != nullptr)
+        if (sink != nullptr)
         {
-            node->next->prev = node->prev;
+            while (size + text.size() > capacity)
+            {
+                const std::size_t part = capacity - size;
+                std::copy_n(text.data(), part, buffer + size);
+                size = capacity;
+                flush();
+                text.remove_prefix(part);
+            }
+        }
+        else if (truncated || size + text.size() > capacity - truncation_marker.size())
+        {
+            if (!truncated)
+            {
+                truncated = true;
+                *this << truncation_marker;
+            }
+
+            return *this;
         }
 
-        node->prev = nullptr;
-        node->next = nullptr;
+        std::copy_n(text.data(), text.size(), buffer + size);
+        size += text.size();
+        return *this;
     }
 
-    std::size_t use_count() const
+    template <std::integral number> report_writer &operator<<(number n) noexcept
     {
-        return ref_count;
+        char digits[24];
+        const auto result = std::to_chars(digits, digits + sizeof(digits), n);
+        return *this << std::string_view{digits, static_cast<std::size_t>(result.ptr - digits)};
     }
 
-    std::string get_referable_after_free_message() const
+    report_writer &write_hex(std::uintptr_t n) noexcept
     {
-        using namespace std::string_literals;
-
-        std::string ret = "Referable after free detected.\n"
-                          "The referable was destroyed while there were still references to it.\n"
-                          "The number of references is " +
-                          std::to_string(ref_count) +
-                          ".\n"
-                          "The referable destroyed:\n" +
-                          "  " + head.location.file_name() + ":" + std::to_string(head.location.line()) + "\n" +
-                          "Active references:" + "\n";
+        char digits[24];
+        const auto result = std::to_chars(digits, digits + sizeof(digits), n, 16);
+        return *this << std::string_view{digits, static_cast<std::size_t>(result.ptr - digits)};
+    }
 
-        ref_list_node *node = head.next;
-        while (node != nullptr)
+    /// @brief Passes the buffered text to the sink.
+    void flush() noexcept
+    {
+        if (sink != nullptr && size != 0)
         {
-            ret += "  "s + node->location.file_name() + ":" + std::to_string(node->location.line()) + "\n";
-            node = node->next;
+            sink(context, {buffer, size});
+            size = 0;
         }
+    }
 
-        return ret;
+    /// @brief The text written so far, or since the last flush when writing to a sink.
+    std::string_view text() const noexcept
+    {
+        return {buffer, size};
     }
 
   private:
-    std::mutex mutex;
-    std::size_t ref_count = 0;
-    ref_list_node head;
+    static constexpr std::string_view truncation_marker = "...\n";
+
+    char *buffer;
+    std::size_t capacity;
+    std::size_t size = 0;
+    report_sink sink;
+    void *context;
+    bool truncated = false;
 };
 
-#endif
+// The registry is sharded like the reference lists, see na_ref_ptr_shards_namespace
+inline namespace na_ref_ptr_shards_namespace(na_ref_ptr_tracked_shards)
+{
+
+/// @brief A referable in the live referable registry.
+struct live_referable_node
+{
+    live_referable_node *prev = nullptr;
+    live_referable_node *next = nullptr;
+    std::uint32_t shard = 0;
+    const void *owner = nullptr;
+    void (*write_report)(const void *owner, report_writer &writer) = nullptr;
+};
 
-template <typename type> class ref_ptr;
+struct alignas(na_ref_ptr_tracked_shards > 1 ? cache_line_size : alignof(std::mutex)) live_referable_shard
+{
+    std::mutex mutex;
+    live_referable_node head;
+};
 
-/// @brief referable<type> type boxes a value so that safe references can be made to the contained value using
-/// ref_ptr.
-///
-/// There are two advantages of using referable over raw references,
-/// 1. The intention is clear and visible that the contained value is going to be referred to by other parts of the
-/// program.
-/// 2. All references are runtime checked to ensure that the referred object is not destroyed before the references
-/// pointing at it.
+/// @brief Lists the referables of the tracked implementations that are alive, for write_live_referables(). The
+/// referables are only registered when na_ref_ptr_live_referables is defined.
 ///
-/// @tparam type The contained value type
-template <typename type> class referable
+/// The list is split into na_ref_ptr_tracked_shards shards like the reference lists, so that threads creating and
+/// destroying referables do not serialize on a single mutex.
+class live_referable_registry
 {
   public:
-    /// @brief Constructs a referable object by copying the value.
-    /// @param val The value to copy into the referable object
-    /// @param loc The source location of the referable object
-    referable(const type &val
-#if defined(na_ref_ptr_tracked)
-              ,
-              const std::source_location &loc = std::source_location::current()
-#endif
-                  )
-        :
-#if defined(na_ref_ptr_counted)
-          ref_count{0},
-#elif defined(na_ref_ptr_tracked)
-          ref_count(0, loc),
-#endif
-          value{val}
+    static void add(live_referable_node *node) noexcept
     {
-    }
-
-    /// @brief Constructs a referable object by moving the value.
-    /// @param val The value to move into the referable object.
-    /// @param loc The source location of the referable object.
-    referable(type &&val
-#if defined(na_ref_ptr_tracked)
-              ,
-              const std::source_location &loc = std::source_location::current()
-#endif
-                  )
-        :
-#if defined(na_ref_ptr_counted)
-          ref_count{0},
-#elif defined(na_ref_ptr_tracked)
-          ref_count(0, loc),
-#endif
-          value{std::move(val)}
-    {
-    }
-
-    /// @brief Destroys the referable object, raises an error if there are any ref_ptr objects still referring the
-    /// object.
-    ~referable()
-    {
-#if defined(na_ref_ptr_counted)
-        if (ref_count != 0)
-        {
-            get_referable_after_free_handler()("Referable after free detected");
-        }
-#elif defined(na_ref_ptr_tracked)
-        if (ref_count.use_count() != 0)
-        {
-            get_referable_after_free_handler()(ref_count.get_referable_after_free_message());
-        }
-#endif
-    }
+        node->shard = static_cast<std::uint32_t>(this_thread_index() % na_ref_ptr_tracked_shards);
+        live_referable_shard &shard = shards[node->shard];
 
-    /// @brief Constructs a referable object by copying the value from another referable object.
-    /// @tparam other_type The value type of the other referable object
-    /// @param other The other referable object
-    template <typename other_type>
-    referable(const referable<other_type> &other
-#if defined(na_ref_ptr_tracked)
-              ,
-              const std::source_location &loc = std::source_location::current()
-#endif
-                  )
-        :
-#if defined(na_ref_ptr_counted)
-          ref_count(0),
-#elif defined(na_ref_ptr_tracked)
-          ref_count(0, loc),
-#endif
-          value(other.value)
-    {
-    }
+        std::scoped_lock lock{shard.mutex};
 
-    /// @brief Constructs a referable object by moving the value from another referable object.
-    /// @tparam other_type The value type of the other referable object
-    /// @param other The other referable object
-    template <typename other_type>
-    referable(referable<other_type> &&other
-#if defined(na_ref_ptr_tracked)
-              ,
-              const std::source_location &loc = std::source_location::current()
-#endif
-                  )
-        :
-#if defined(na_ref_ptr_counted)
-          ref_count(0),
-#elif defined(na_ref_ptr_tracked)
-          ref_count(0, loc),
-#endif
-          value(std::move(other.value))
-    {
-    }
+        node->next = shard.head.next;
+        node->prev = &shard.head;
 
-    /// @brief Assigns the value from another referable object.
-    /// @param other The other referable object
-    /// @return A reference to this referable object
-    referable &operator=(const referable &other)
-    {
-        if(this == &other)
+        if (node->next != nullptr)
         {
-            return *this;
+            node->next->prev = node;
         }
 
-        value = other.value;
-        return *this;
-    }
-
-    /// @brief Assigns the value from another referable object.
-    /// @tparam other_type The value type of the other referable object
-    /// @param other The other referable object
-    /// @return A reference to this referable object
-    template <typename other_type> referable &operator=(const referable<other_type> &other)
-    {
-        value = other.value;
-        return *this;
+        shard.head.next = node;
     }
 
-    /// @brief Assigns the value from another referable object by moving the value.
-    /// @param other The other referable object
-    /// @return A reference to this referable object
-    referable &operator=(referable &&other)
+    static void remove(live_referable_node *node) noexcept
     {
-        value = std::move(other.value);
-        return *this;
-    }
+        std::scoped_lock lock{shards[node->shard].mutex};
 
-    /// @brief Assigns the value from another referable object by moving the value.
-    /// @tparam other_type The value type of the other referable object
-    /// @param other The other referable object
-    /// @return A reference to this referable object
-    template <typename other_type> referable &operator=(referable<other_type> &&other)
-    {
-        value = std::move(other.value);
-        return *this;
-    }
+        node->prev->next = node->next;
 
-    /// @brief Accesses the value.
-    /// @return A pointer to the value
-    constexpr const type *operator->() const noexcept
-    {
-        return &value;
+        if (node->next != nullptr)
+        {
+            node->next->prev = node->prev;
+        }
     }
 
-    /// @brief Accesses the value.
-    /// @return A pointer to the value
-    constexpr type *operator->() noexcept
+    // Lock order is registry shard, then the reference list shards of the referable
+    static void write_report(report_writer &writer) noexcept
     {
-        return &value;
-    }
+        for (live_referable_shard &shard : shards)
+        {
+            std::scoped_lock lock{shard.mutex};
 
-    /// @brief Accesses the value.
-    /// @return A reference to the value
-    constexpr const type &operator*() const & noexcept
-    {
-        return value;
+            for (const live_referable_node *node = shard.head.next; node != nullptr; node = node->next)
+            {
+                node->write_report(node->owner, writer);
+            }
+        }
     }
 
-    /// @brief Accesses the value.
-    /// @return A reference to the value
-    constexpr type &operator*() & noexcept
-    {
-        return value;
-    }
+  private:
+    static inline live_referable_shard shards[na_ref_ptr_tracked_shards];
+};
 
-    /// @brief Accesses the value.
-    /// @return A reference to the value
-    constexpr const type &&operator*() const && noexcept
-    {
-        return value;
-    }
+} // namespace na_ref_ptr_shards_namespace(na_ref_ptr_tracked_shards)
 
-    /// @brief Accesses the value.
-    /// @return A reference to the value
-    constexpr type &&operator*() && noexcept
-    {
-        return value;
-    }
+inline void write_report_to_stderr(void *, std::string_view text)
+{
+    std::fwrite(text.data(), 1, text.size(), stderr);
+}
 
-  private:
-    template <typename other_type> friend class referable;
-    template <typename ref_type> friend class ref_ptr;
+} // namespace detail
 
-#if defined(na_ref_ptr_counted)
-    mutable std::atomic_size_t ref_count;
-#elif defined(na_ref_ptr_tracked)
-    mutable ref_counter ref_count;
-#endif // na_ref_ptr_counted
+/// @brief Writes every live referable of the tracked and sampled implementations, each with its references grouped by
+/// the source location that created them.
+///
+/// The referables are only listed when na_ref_ptr_live_referables is defined in all translation units, otherwise the
+/// report has no entries. The report is formatted through a small stack buffer and passed to the sink in pieces,
+/// without allocating. The sink is called with the lock of a registry shard and of a reference list shard held, so it
+/// must not create or destroy tracked or sampled referables, or copy or destroy ref_ptrs to them.
+/// @param sink Receives the report
+/// @param context Pointer passed to every call of the sink
+inline void write_live_referables(report_sink sink, void *context = nullptr)
+{
+    char buffer[512];
+    detail::report_writer writer{buffer, sizeof(buffer), sink, context};
+    writer << "Live referables:\n";
+    detail::live_referable_registry::write_report(writer);
+    writer.flush();
+}
 
-    type value;
-};
+/// @brief Writes the live referables to stderr when the process exits. Calling this more than once has no effect.
+///
+/// Referables with static storage duration constructed after the first call are destroyed before the report is written.
+inline void report_live_referables_at_exit()
+{
+    static std::once_flag once;
+    std::call_once(once, [] { std::atexit([] { write_live_referables(detail::write_report_to_stderr); }); });
+}
 
-/// @brief enable_ref_from_this<type> allow creating ref_ptr aware value types.
+/// @brief Counter policy that lets the owner block or suspend a coroutine until all the references are removed.
 ///
-/// Publicly deriving from enable_ref_from_this<type> makes the value type a referable so that ref_ptr<type> can be
-/// constructed by passing a reference to the value.
-/// Moreover, from within the value type, ref_from_this() can be called to create a ref_ptr<type> to the value.
+/// Counts like relaxed_counter, and the decrement that brings the count to zero wakes the thread waiting in
+/// wait_for_zero() or resumes the coroutine suspended in resume_at_zero(). Removing any other reference costs the same as
+/// relaxed_counter. This is the counter policy of draining_referable.
 ///
-/// @tparam type The value type of the derived class
-template <class type> class enable_ref_from_this
+/// The waiter usually destroys the counter as soon as the count reaches zero, so the decrement never touches the
+/// counter after it: it wakes a waiting thread through a flag on the stack of that thread, which does not return before
+/// the flag is no longer used. Only one thread or coroutine can wait at a time.
+class draining_counter
 {
   public:
-    /// @brief Copy constructor.
-    /// @param other The other enable_ref_from_this object
-    enable_ref_from_this([[maybe_unused]] const enable_ref_from_this &other
-#if defined(na_ref_ptr_tracked)
-                         ,
-                         const std::source_location &loc = std::source_location::current()
-#endif
-                             )
-#if defined(na_ref_ptr_counted)
-        : ref_count{0}
-#elif defined(na_ref_ptr_tracked)
-        : ref_count(0, loc)
-#endif
+    constexpr explicit draining_counter(std::size_t count = 0) noexcept : count{count}
     {
     }
 
-    /// @brief Move constructor.
-    /// @param other The other enable_ref_from_this object
-    enable_ref_from_this([[maybe_unused]] enable_ref_from_this &&other
-#if defined(na_ref_ptr_tracked)
-                         ,
-                         const std::source_location &loc = std::source_location::current()
-#endif
-                             )
-#if defined(na_ref_ptr_counted)
-        : ref_count{0}
-#elif defined(na_ref_ptr_tracked)
-        : ref_count(0, loc)
-#endif
+    void add_ref() noexcept
     {
+        count.fetch_add(1, std::memory_order_relaxed);
     }
 
-    /// @brief Assignment operator.
-    /// @param other The other enable_ref_from_this object
-    enable_ref_from_this &operator=([[maybe_unused]] const enable_ref_from_this &)
+    void remove_ref() noexcept
     {
+        remove_refs(1);
     }
 
-    /// @brief Move assignment operator.
-    /// @param other The other enable_ref_from_this object
-    enable_ref_from_this &operator=([[maybe_unused]] enable_ref_from_this &&)
+    void add_refs(std::size_t n) noexcept
     {
+        count.fetch_add(n, std::memory_order_relaxed);
     }
 
-    /// @brief Destroys the enable_ref_from_this object, raises an error if there are any ref_ptr objects still
-    /// referring the object.
-    ~enable_ref_from_this()
+    void remove_refs(std::size_t n) noexcept
     {
-#if defined(na_ref_ptr_counted)
-        if (ref_count != 0)
+        const std::size_t previous = count.fetch_sub(n, std::memory_order_acq_rel);
+
+        // Without a waiter the owner may poll use_count() and destroy the counter as soon as it reads zero, so the last
+        // decrement must be the last access
+        if (previous != (n | waiter_bit))
         {
-            get_referable_after_free_handler()("Referable after free detected");
+            return;
         }
-#elif defined(na_ref_ptr_tracked)
-        if (ref_count.use_count() != 0)
+
+        // The waiter does not destroy the counter before it is woken up, and the woken thread does not return before
+        // the flag reads done, so nothing is accessed after waking it or resuming the coroutine
+        std::atomic_int *const flag = parked;
+        const std::coroutine_handle<> handle = waiter;
+        count.fetch_and(~waiter_bit, std::memory_order_relaxed);
+
+        if (flag != nullptr)
         {
-            get_referable_after_free_handler()(ref_count.get_referable_after_free_message());
+            flag->store(flag_woken, std::memory_order_release);
+            flag->notify_one();
+            flag->store(flag_done, std::memory_order_release);
+            return;
         }
-#endif
+
+        handle.resume();
     }
 
-    /// @brief Creates a ref_ptr<type> to the value.
-    /// @return A ref_ptr<type> pointing the value.
-    ref_ptr<type> ref_from_this()
+    std::size_t use_count() const noexcept
     {
-        return {*this};
+        return count.load(std::memory_order_acquire) & ~waiter_bit;
     }
 
-    /// @brief Creates a ref_ptr<type> to the value.
-    /// @return A ref_ptr<type> pointing the value.
-    ref_ptr<const type> ref_from_this() const
+    /// @brief Blocks until the count reaches zero or the timeout expires.
+    ///
+    /// std::atomic::wait has no timeout, so a finite timeout polls the count with an increasing sleep instead of
+    /// waiting for the notification.
+    /// @param timeout The longest time to wait, std::chrono::nanoseconds::max() waits without a timeout.
+    /// @return true if the count reached zero.
+    bool wait_for_zero(std::chrono::nanoseconds timeout = std::chrono::nanoseconds::max()) const noexcept
     {
-        return {*this};
-    }
+        if (timeout == std::chrono::nanoseconds::max())
+        {
+            std::atomic_int flag{flag_waiting};
+            parked = &flag;
+
+            if (!set_waiter_bit())
+            {
+                parked = nullptr;
+                return true;
+            }
+
+            // Spins through the short time between the wake up and the end of the notify
+            for (int state = flag.load(std::memory_order_acquire); state != flag_done;
+                 state = flag.load(std::memory_order_acquire))
+            {
+                if (state == flag_waiting)
+                {
+                    flag.wait(flag_waiting, std::memory_order_acquire);
+                }
+                else
+                {
+                    std::this_thread::yield();
+                }
+            }
+
+            parked = nullptr;
+            return true;
+        }
 
-  protected:
-    enable_ref_from_this()
-#if defined(na_ref_ptr_counted)
-        : ref_count{0}
-#elif defined(na_ref_ptr_tracked)
-        : ref_count(0, std::source_location::current())
-#endif
-          {};
+        const auto deadline = std::chrono::steady_clock::now() + timeout;
+        auto sleep = std::chrono::microseconds{1};
 
-  private:
-    template <typename ref_type> friend class ref_ptr;
+        while (use_count() != 0)
+        {
+            if (std::chrono::steady_clock::now() >= deadline)
+            {
+                return false;
+            }
 
-#if defined(na_ref_ptr_counted)
-    mutable std::atomic_size_t ref_count = 0;
-#elif defined(na_ref_ptr_tracked)
-    mutable ref_counter ref_count;
-#endif // na_ref_ptr_counted or na_ref_ptr_tracked
-};
+            std::this_thread::sleep_for(sleep);
+            sleep = std::min(sleep * 2, std::chrono::microseconds{1000});
+        }
 
-/// @brief ref_ptr<type> is a smart pointer that can be used to safely point to a value owned by another object.
-///
-/// A ref_ptr<type> can be constructed to point to an object boxed in a referable<type> object or an object of type that
-/// is derived from enable_ref_from_this<type>.
-///
-/// Moreover, a ref_ptr<type> can also point to a sub object of such an object.
-///
-/// ref_ptr<type> has three different implementations.
-/// 1. Counted implementation: ref_ptr<type> counts the number of references at runtime. This variation is the default
-/// in the release mode.
-/// 2. Tracked implementation: ref_ptr<type> keeps track of all the ref_ptrs alive so that referable after free does
-/// list all the references for easy debugging. This variation is the default in the debug mode.
-/// 3. Uncounted implementation: ref_ptr<type> does not count or keep track of references. This variation has zero
-/// overhead compared to a raw pointer or reference. If the program can be validated to have correct RAII in the debug
-/// mode then this implementation can be enabled in the release mode to achieve optimal performance. Recommended to be
-/// used only if last bit of performance is important or the performance gain achieved by disabling the reference
-/// counting can be justified.
-///
-/// Use following macros to select the implementation before including the header file:
-/// 1. na_ref_ptr_counted: Counted implementation
-/// 2. na_ref_ptr_tracked: Tracked implementation
-/// 3. na_ref_ptr_uncounted: Uncounted implementation
-///
-/// @tparam type The type of the value pointed to by the ref_ptr.
-template <typename type> class ref_ptr
-{
-  public:
-    /// @brief Constructs an empty ref_ptr.
-    ref_ptr(
-#if defined(na_ref_ptr_tracked)
-        const std::source_location &loc = std::source_location::current()
-#endif
-            )
-        :
-#if defined(na_ref_ptr_counted) || defined(na_ref_ptr_tracked)
-          ref_count{nullptr},
-#endif
-#if defined(na_ref_ptr_tracked)
-          list_node{loc},
-#endif
-          value{nullptr}
-    {
+        return true;
     }
 
-    /// @brief Constructs a ref_ptr pointing to a referable<type> object.
-    /// @tparam ref_type The value type of the referable object.
-    /// @param ref The referable object.
-    template <typename ref_type>
-    ref_ptr(referable<ref_type> &ref
-#if defined(na_ref_ptr_tracked)
-            ,
-            const std::source_location &loc = std::source_location::current()
-#endif
-                )
-        :
-#if defined(na_ref_ptr_counted) || defined(na_ref_ptr_tracked)
-          ref_count{&ref.ref_count},
-#endif
-#if defined(na_ref_ptr_tracked)
-          list_node{loc},
-#endif
-          value{&ref.value}
+    /// @brief Makes the decrement that brings the count to zero resume a coroutine, on the thread that removes the
+    /// last reference. Only one coroutine can wait at a time, and not while wait_for_zero() waits.
+    /// @param handle The coroutine to resume
+    /// @return false if the count is already zero, in which case the coroutine is not resumed and must not suspend.
+    bool resume_at_zero(std::coroutine_handle<> handle) const noexcept
     {
-        add_ref();
+        waiter = handle;
+        return set_waiter_bit();
     }
 
-    /// @brief Constructs a ref_ptr pointing to a referable<type> object.
-    /// @tparam ref_type The value type of the referable object.
-    /// @param ref The referable object.
-    template <typename ref_type>
-    ref_ptr(const referable<ref_type> &ref
-#if defined(na_ref_ptr_tracked)
-            ,
-            const std::source_location &loc = std::source_location::current()
-#endif
-                )
-        :
-#if defined(na_ref_ptr_counted) || defined(na_ref_ptr_tracked)
-          ref_count{&ref.ref_count},
-#endif
-#if defined(na_ref_ptr_tracked)
-          list_node{loc},
-#endif
-          value{&ref.value}
-    {
-        add_ref();
-    }
+  private:
+    static constexpr std::size_t waiter_bit = std::size_t{1} << (sizeof(std::size_t) * 8 - 1);
 
-    /// @brief Constructs a ref_ptr pointing to a sub object of a referable<type> object.
-    /// @tparam ref_type The value type of the referable object.
-    /// @param ref The referable object.
-    /// @param mem_var_ptr The member pointer to the sub object.
-    template <typename ref_type, typename value_type>
-    ref_ptr(referable<ref_type> &ref, value_type ref_type::*mem_var_ptr
-#if defined(na_ref_ptr_tracked)
-            ,
-            const std::source_location &loc = std::source_location::current()
-#endif
-                )
-        :
-#if defined(na_ref_ptr_counted) || defined(na_ref_ptr_tracked)
-          ref_count{&ref.ref_count},
-#endif
-#if defined(na_ref_ptr_tracked)
-          list_node{loc},
-#endif
-          value{&(ref.value.*mem_var_ptr)}
-    {
-        add_ref();
-    }
+    static constexpr int flag_waiting = 0;
+    static constexpr int flag_woken = 1;
+    static constexpr int flag_done = 2;
 
-    /// @brief Constructs a ref_ptr pointing to a sub object of a referable<type> object.
-    /// @tparam ref_type The value type of the referable object.
-    /// @param ref The referable object.
-    /// @param mem_var_ptr The member pointer to the sub object.
-    template <typename ref_type, typename value_type>
-    ref_ptr(const referable<ref_type> &ref, value_type ref_type::*mem_var_ptr
-#if defined(na_ref_ptr_tracked)
-            ,
-            const std::source_location &loc = std::source_location::current()
-#endif
-                )
-        :
-#if defined(na_ref_ptr_counted) || defined(na_ref_ptr_tracked)
-          ref_count{&ref.ref_count},
-#endif
-#if defined(na_ref_ptr_tracked)
-          list_node{loc},
-#endif
-          value{&(ref.value.*mem_var_ptr)}
+    // The waiter bit is only set while there are references, so the decrement that removes the last of them sees it.
+    // The counter must not be read after setting it, since the waiter may destroy it once it is woken up.
+    bool set_waiter_bit() const noexcept
     {
-        add_ref();
+        std::size_t current = count.load(std::memory_order_acquire);
+        do
+        {
+            if (current == 0)
+            {
+                return false;
+            }
+        } while (!count.compare_exchange_weak(current, current | waiter_bit, std::memory_order_acq_rel,
+                                              std::memory_order_acquire));
+
+        return true;
     }
 
-    /// @brief Deleted constructor from a temporary referable object.
-    /// @tparam ref_type The value type of the referable object.
-    /// @param ref The temporary referable object.
-    template <typename ref_type> ref_ptr(referable<ref_type> &&ref) = delete;
+    mutable std::atomic_size_t count;
+    mutable std::coroutine_handle<> waiter;
+    mutable std::atomic_int *parked = nullptr;
+};
 
-    /// @brief Constructs a ref_ptr pointing to an object of type that is derived from enable_ref_from_this.
-    /// @tparam ref_type The value type of enable_ref_from_this.
-    /// @param ref The enable_ref_from_this object.
-    template <typename ref_type>
-    ref_ptr(enable_ref_from_this<ref_type> &ref
-#if defined(na_ref_ptr_tracked)
-            ,
-            const std::source_location &loc = std::source_location::current()
-#endif
-                )
-        :
-#if defined(na_ref_ptr_counted) || defined(na_ref_ptr_tracked)
-          ref_count{&ref.ref_count},
-#endif
-#if defined(na_ref_ptr_tracked)
-          list_node{loc},
-#endif
-          value{&static_cast<ref_type &>(ref)}
+/// @brief Reference counting statistics of one value type, see get_statistics().
+struct type_statistics
+{
+    std::string_view type_name;
+    std::uint64_t add_refs = 0;
+    std::uint64_t remove_refs = 0;
+    std::uint64_t referables_created = 0;
+    std::uint64_t referables_destroyed = 0;
+    std::uint64_t max_snapshot_live_refs = 0;       // Largest live_refs() seen by a snapshot
+    std::uint64_t max_snapshot_live_referables = 0; // Largest live_referables() seen by a snapshot
+
+    std::uint64_t live_refs() const noexcept
     {
-        static_assert(std::is_base_of_v<enable_ref_from_this<ref_type>, ref_type>);
-        add_ref();
+        return add_refs > remove_refs ? add_refs - remove_refs : 0;
     }
 
-    /// @brief Constructs a ref_ptr pointing to an object of type that is derived from enable_ref_from_this.
-    /// @tparam ref_type The value type of enable_ref_from_this.
-    /// @param ref The enable_ref_from_this object.
-    template <typename ref_type>
-    ref_ptr(const enable_ref_from_this<ref_type> &ref
-#if defined(na_ref_ptr_tracked)
-            ,
-            const std::source_location &loc = std::source_location::current()
-#endif
-                )
-        :
-#if defined(na_ref_ptr_counted) || defined(na_ref_ptr_tracked)
-          ref_count{&ref.ref_count},
-#endif
-#if defined(na_ref_ptr_tracked)
-          list_node{loc},
-#endif
-          value{&static_cast<const ref_type &>(ref)}
-    {
-        static_assert(std::is_base_of_v<enable_ref_from_this<ref_type>, ref_type>);
-        add_ref();
-    }
-
-    /// @brief Constructs a ref_ptr pointing to a sub object of type that is derived from enable_ref_from_this.
-    /// @tparam ref_type The value type of enable_ref_from_this.
-    /// @tparam value_type The value type of the sub object.
-    /// @param ref The enable_ref_from_this object.
-    /// @param mem_var_ptr The member pointer to the sub object.
-    template <typename ref_type, typename value_type>
-    ref_ptr(enable_ref_from_this<ref_type> &ref, value_type ref_type::*mem_var_ptr
-#if defined(na_ref_ptr_tracked)
-            ,
-            const std::source_location &loc = std::source_location::current()
-#endif
-                )
-        :
-#if defined(na_ref_ptr_counted) || defined(na_ref_ptr_tracked)
-          ref_count{&ref.ref_count},
-#endif
-#if defined(na_ref_ptr_tracked)
-          list_node{loc},
-#endif
-          value{&(ref.value->*mem_var_ptr)}
+    std::uint64_t live_referables() const noexcept
     {
-        add_ref();
+        return referables_created > referables_destroyed ? referables_created - referables_destroyed : 0;
     }
+};
 
-    /// @brief Constructs a ref_ptr pointing to a sub object of type that is derived from enable_ref_from_this.
-    /// @tparam ref_type The value type of enable_ref_from_this.
-    /// @tparam value_type The value type of the sub object.
-    /// @param ref The enable_ref_from_this object.
-    /// @param mem_var_ptr The member pointer to the sub object.
-    template <typename ref_type, typename value_type>
-    ref_ptr(const enable_ref_from_this<ref_type> &ref, value_type ref_type::*mem_var_ptr
-#if defined(na_ref_ptr_tracked)
-            ,
-            const std::source_location &loc = std::source_location::current()
-#endif
-                )
-        :
-#if defined(na_ref_ptr_counted) || defined(na_ref_ptr_tracked)
-          ref_count{&ref.ref_count},
-#endif
-#if defined(na_ref_ptr_tracked)
-          list_node{loc},
-#endif
-          value{&(ref.value->*mem_var_ptr)}
-    {
-        add_ref();
-    }
+/// @brief Reference counting statistics of the process, see get_statistics().
+struct statistics_snapshot
+{
+    type_statistics total;
+    std::vector<type_statistics> types; // Sorted by add_refs, the types that churn references the most first
+};
 
-    /// @brief Deleted constructor from a temporary enable_ref_from_this object.
-    /// @tparam ref_type The value type of enable_ref_from_this.
-    /// @param ref the temporary enable_ref_from_this object.
-    template <typename ref_type> ref_ptr(enable_ref_from_this<ref_type> &&ref) = delete;
+using statistics_exporter = std::function<void(const statistics_snapshot &)>;
 
-    /// @brief Constructs a ref_ptr from another ref_ptr.
-    /// @tparam other_type The value type of the tother ref_ptr.
-    /// @param other The other ref_ptr object.
-    template <typename other_type>
-    ref_ptr(const ref_ptr<other_type> &other
-#if defined(na_ref_ptr_tracked)
-            ,
-            const std::source_location &loc = std::source_location::current()
-#endif
-                )
-        :
-#if defined(na_ref_ptr_counted) || defined(na_ref_ptr_tracked)
-          ref_count{other.ref_count},
-#endif
-#if defined(na_ref_ptr_tracked)
-          list_node{loc},
-#endif
-          value{other.value}
+namespace detail
+{
+
+enum class statistics_event : std::size_t
+{
+    add_ref,
+    remove_ref,
+    create_referable,
+    destroy_referable,
+    count
+};
+
+constexpr std::uint32_t statistics_max_types = 256;
+constexpr std::size_t statistics_event_count = static_cast<std::size_t>(statistics_event::count);
+
+struct statistics_counts
+{
+    std::atomic<std::uint64_t> values[statistics_max_types][statistics_event_count] = {};
+};
+
+struct statistics_peak
+{
+    std::uint64_t refs = 0;
+    std::uint64_t referables = 0;
+};
+
+/// @brief Collects the reference counting events counted when na_ref_ptr_statistics is defined.
+///
+/// Every thread counts the events of each value type in its own block, so counting an event is a single thread local
+/// increment. A snapshot sums the blocks of the running threads and the counts merged from the threads that exited.
+/// Value types are registered on first use, types beyond max_types are counted together as "other". The live counts
+/// only exist as sums over the blocks, so the peaks are the largest sums seen by the snapshots, following every event
+/// would need a count shared by the threads.
+class statistics_registry
+{
+  public:
+    static constexpr std::uint32_t max_types = statistics_max_types;
+
+    static void count(std::uint32_t type_id, statistics_event event, std::uint64_t n = 1) noexcept
     {
-#if defined(na_ref_ptr_counted) || defined(na_ref_ptr_tracked)
-        if (ref_count != nullptr)
+        // The ref_ptrs destroyed with the thread locals after the block count into the retired counts
+        if (block_destroyed)
         {
-            add_ref();
+            retired.values[type_id][static_cast<std::size_t>(event)].fetch_add(n, std::memory_order_relaxed);
+            return;
         }
-#endif
+
+        thread_local thread_block block;
+
+        auto &value = block.values[type_id][static_cast<std::size_t>(event)];
+        value.store(value.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
     }
 
-    /// @brief Constructs a ref_ptr to a sub object of another ref_ptr.
-    /// @tparam other_type The value type of the tother ref_ptr.
-    /// @tparam value_type The value type of the sub object.
-    /// @param other The other ref_ptr object.
-    /// @param mem_var_ptr The member pointer to the sub object.
-    template <typename other_type, typename value_type>
-    ref_ptr(const ref_ptr<other_type> &other, value_type other_type::*mem_var_ptr
-#if defined(na_ref_ptr_tracked)
-            ,
-            const std::source_location &loc = std::source_location::current()
-#endif
-                )
-        :
-#if defined(na_ref_ptr_counted) || defined(na_ref_ptr_tracked)
-          ref_count{other.ref_count},
-#endif
-#if defined(na_ref_ptr_tracked)
-          list_node{loc},
-#endif
-          value{&(other.value->*mem_var_ptr)}
+    static std::uint32_t register_type(std::string_view name)
     {
-#if defined(na_ref_ptr_counted) || defined(na_ref_ptr_tracked)
-        if (ref_count != nullptr)
+        std::scoped_lock lock{mutex};
+
+        if (type_count == max_types)
         {
-            add_ref();
+            return 0;
         }
-#endif
-    }
 
-    /// @brief Constructs a ref_ptr from another ref_ptr.
-    /// @tparam other_type The value type of the tother ref_ptr.
-    /// @param other The other ref_ptr object.
-    template <typename other_type>
-    ref_ptr(ref_ptr<other_type> &&other
-#if defined(na_ref_ptr_tracked)
-            ,
-            const std::source_location &loc = std::source_location::current()
-#endif
-                )
-        :
-#if defined(na_ref_ptr_counted) || defined(na_ref_ptr_tracked)
-          ref_count{other.ref_count},
-#endif
-#if defined(na_ref_ptr_tracked)
-          list_node{loc},
-#endif
-          value{other.value}
-    {
-#if defined(na_ref_ptr_counted) || defined(na_ref_ptr_tracked)
-        other.ref_count = nullptr;
-#endif
-        other.value = nullptr;
-    }
-
-    /// @brief Constructs a ref_ptr to a sub object of another ref_ptr.
-    /// @tparam other_type The value type of the tother ref_ptr.
-    /// @tparam value_type The value type of the sub object.
-    /// @param other The other ref_ptr object.
-    /// @param mem_var_ptr The member pointer to the sub object.
-    template <typename other_type, typename value_type>
-    ref_ptr(ref_ptr<other_type> &&other, value_type other_type::*mem_var_ptr
-#if defined(na_ref_ptr_tracked)
-            ,
-            const std::source_location &loc = std::source_location::current()
-#endif
-                )
-        :
-#if defined(na_ref_ptr_counted) || defined(na_ref_ptr_tracked)
-          ref_count{other.ref_count},
-#endif
-#if defined(na_ref_ptr_tracked)
-          list_node{loc},
-#endif
-          value{&(other.value->*mem_var_ptr)}
-    {
-#if defined(na_ref_ptr_counted) || defined(na_ref_ptr_tracked)
-        other.ref_count = nullptr;
-#endif
-        other.value = nullptr;
+        type_names[type_count] = name;
+        return type_count++;
     }
 
-    /// @brief Assigns the value from another ref_ptr.
-    /// @param other The other ref_ptr object.
-    /// @return A reference to this ref_ptr.
-    ref_ptr &operator=(const ref_ptr &other)
+    static statistics_snapshot snapshot()
     {
-        if (this == &other)
-        {
-            return *this;
-        }
+        std::scoped_lock lock{mutex};
 
-#if defined(na_ref_ptr_counted) || defined(na_ref_ptr_tracked)
-        if (this->ref_count != nullptr)
-        {
-            remove_ref();
-        }
+        statistics_snapshot snapshot;
+        snapshot.total.type_name = "total";
 
-        this->ref_count = other.ref_count;
-        if (ref_count != nullptr)
+        for (std::uint32_t id = 0; id < type_count; ++id)
         {
-            add_ref();
+            std::uint64_t sums[event_count] = {};
+
+            for (std::size_t event = 0; event < event_count; ++event)
+            {
+                sums[event] = retired.values[id][event].load(std::memory_order_relaxed);
+                for (const counts *thread : threads)
+                {
+                    sums[event] += thread->values[id][event].load(std::memory_order_relaxed);
+                }
+            }
+
+            type_statistics stats{type_names[id],
+                                  sums[static_cast<std::size_t>(statistics_event::add_ref)],
+                                  sums[static_cast<std::size_t>(statistics_event::remove_ref)],
+                                  sums[static_cast<std::size_t>(statistics_event::create_referable)],
+                                  sums[static_cast<std::size_t>(statistics_event::destroy_referable)]};
+
+            peaks[id].refs = std::max(peaks[id].refs, stats.live_refs());
+            peaks[id].referables = std::max(peaks[id].referables, stats.live_referables());
+            stats.max_snapshot_live_refs = peaks[id].refs;
+            stats.max_snapshot_live_referables = peaks[id].referables;
+
+            if (stats.add_refs == 0 && stats.referables_created == 0)
+            {
+                continue;
+            }
+
+            snapshot.total.add_refs += stats.add_refs;
+            snapshot.total.remove_refs += stats.remove_refs;
+            snapshot.total.referables_created += stats.referables_created;
+            snapshot.total.referables_destroyed += stats.referables_destroyed;
+            snapshot.types.push_back(stats);
         }
-#endif
 
-        this->value = other.value;
+        total_peak.refs = std::max(total_peak.refs, snapshot.total.live_refs());
+        total_peak.referables = std::max(total_peak.referables, snapshot.total.live_referables());
+        snapshot.total.max_snapshot_live_refs = total_peak.refs;
+        snapshot.total.max_snapshot_live_referables = total_peak.referables;
 
-        return *this;
+        std::sort(snapshot.types.begin(), snapshot.types.end(),
+                  [](const type_statistics &a, const type_statistics &b) { return a.add_refs > b.add_refs; });
+
+        return snapshot;
     }
 
-    /// @brief Assigns the value from another ref_ptr.
-    /// @tparam other_type The value type of the other ref_ptr
-    /// @param other The other ref_ptr object.
-    /// @return A reference to this ref_ptr.
-    template <typename other_type> ref_ptr &operator=(const ref_ptr<other_type> &other)
+    static void set_exporter(statistics_exporter exporter)
     {
-#if defined(na_ref_ptr_counted) || defined(na_ref_ptr_tracked)
-        if (this->ref_count != nullptr)
-        {
-            remove_ref();
-        }
-
-        this->ref_count = other.ref_count;
-        if (ref_count != nullptr)
-        {
-            add_ref();
-        }
-#endif
-
-        this->value = other.value;
-
-        return *this;
+        std::scoped_lock lock{exporter_mutex};
+        statistics_registry::exporter = std::move(exporter);
     }
 
-    /// @brief Assigns the value from another ref_ptr.
-    /// @param other The other ref_ptr object.
-    /// @return A reference to this ref_ptr.
-    ref_ptr &operator=(ref_ptr &&other)
+    static void export_snapshot()
     {
-#if defined(na_ref_ptr_counted) || defined(na_ref_ptr_tracked)
-        if (this->ref_count != nullptr)
+        const statistics_snapshot s = snapshot();
+
+        std::scoped_lock lock{exporter_mutex};
+        if (exporter)
         {
-            this->remove_ref();
+            exporter(s);
         }
+    }
 
-        this->ref_count = other.ref_count;
+  private:
+    static constexpr std::size_t event_count = statistics_event_count;
+    using counts = statistics_counts;
+    using peak = statistics_peak;
 
-#if defined(na_ref_ptr_tracked)
-        if (other.ref_count != nullptr)
+    // Registers the counts of a thread and merges them into the retired counts when the thread exits
+    struct thread_block : counts
+    {
+        thread_block()
         {
-            other.remove_ref();
+            std::scoped_lock lock{mutex};
+            threads.push_back(this);
         }
 
-        if (this->ref_count != nullptr)
+        ~thread_block()
         {
-            this->add_ref();
+            std::scoped_lock lock{mutex};
+
+            for (std::uint32_t id = 0; id < max_types; ++id)
+            {
+                for (std::size_t event = 0; event < event_count; ++event)
+                {
+                    retired.values[id][event].fetch_add(values[id][event].load(std::memory_order_relaxed),
+                                                        std::memory_order_relaxed);
+                }
+            }
+
+            threads.erase(std::find(threads.begin(), threads.end(), this));
+            block_destroyed = true;
         }
-#endif
+    };
 
-        other.ref_count = nullptr;
-#endif
+    // Trivially destructible, so it can still be read while the other thread locals are destroyed
+    inline static thread_local bool block_destroyed = false;
+
+    inline static std::mutex mutex;
+    inline static std::vector<const counts *> threads;
+    inline static counts retired;
+    inline static std::string_view type_names[max_types] = {"other"};
+    inline static std::uint32_t type_count = 1;
+    inline static peak peaks[max_types];
+    inline static peak total_peak;
+
+    inline static std::mutex exporter_mutex;
+    inline static statistics_exporter exporter;
+};
+
+/// @brief Returns the name of a type as the compiler spells it in the name of a function template.
+template <typename type> std::string_view statistics_type_name() noexcept
+{
+    std::string_view name = std::source_location::current().function_name();
+
+    // GCC and Clang spell the template argument as "[with type = ...; ...]" and "[type = ...]"
+    const auto begin = name.find("type = ");
+    if (begin == std::string_view::npos)
+    {
+        return name;
+    }
+
+    name.remove_prefix(begin + 7);
+    return name.substr(0, name.find_first_of(";]"));
+}
+
+template <typename type>
+inline const std::uint32_t statistics_type_id = statistics_registry::register_type(statistics_type_name<type>());
+
+template <typename type> void count_statistics(statistics_event event, std::uint64_t n = 1) noexcept
+{
+    statistics_registry::count(statistics_type_id<std::remove_cv_t<type>>, event, n);
+}
 
-        this->value = other.value;
-        other.value = nullptr;
+/// @brief Counts the construction and destruction of the referable it is a member of. It takes no space.
+template <typename type> struct statistics_probe
+{
+    statistics_probe() noexcept
+    {
+        count_statistics<type>(statistics_event::create_referable);
+    }
 
+    statistics_probe(const statistics_probe &) noexcept : statistics_probe{}
+    {
+    }
+
+    statistics_probe &operator=(const statistics_probe &) noexcept
+    {
         return *this;
     }
 
-    /// @brief Assigns the value from another ref_ptr.
-    /// @tparam other_type The value type of the other ref_ptr
-    /// @param other The other ref_ptr object.
-    /// @return A reference to this ref_ptr.
-    template <typename other_type> ref_ptr &operator=(ref_ptr<other_type> &&other)
+    ~statistics_probe()
     {
-#if defined(na_ref_ptr_counted) || defined(na_ref_ptr_tracked)
-        if (this->ref_count != nullptr)
+        count_statistics<type>(statistics_event::destroy_referable);
+    }
+};
+
+} // namespace detail
+
+/// @brief Takes a snapshot of the reference counting statistics.
+///
+/// The counted, sampled and tracked implementations count the statistics only when na_ref_ptr_statistics is defined,
+/// in all the translation units. Counting costs one thread local increment for each reference added or removed and
+/// each referable created or destroyed. The peak values are the largest values seen by the snapshots taken so far.
+/// @return The statistics of each value type and their total.
+inline statistics_snapshot get_statistics()
+{
+    return detail::statistics_registry::snapshot();
+}
+
+/// @brief Sets the function export_statistics() passes the snapshots to.
+/// @param exporter The statistics exporter.
+inline void set_statistics_exporter(statistics_exporter exporter)
+{
+    detail::statistics_registry::set_exporter(std::move(exporter));
+}
+
+/// @brief Takes a snapshot of the reference counting statistics and passes it to the statistics exporter.
+inline void export_statistics()
+{
+    detail::statistics_registry::export_snapshot();
+}
+
+/// @brief Contention measured on one referable whose references are counted with profiled_counter, see
+/// get_contention_profile().
+///
+/// Only the sampled operations are measured, one in na_ref_ptr_contention_sample_rate count updates and lock
+/// acquisitions of each thread. The times are in cycles of the cycle counter of the processor.
+struct contention_record
+{
+    std::source_location location; // Where the referable was constructed, only known in the tracked implementations
+    const void *counter = nullptr;  // Identifies the counter of the referable while it is alive
+    bool alive = false;
+    std::uint64_t sampled_updates = 0;       // Count updates timed
+    std::uint64_t update_cycles = 0;         // Cycles spent in the timed count updates
+    std::uint64_t cross_thread_updates = 0;  // Timed count updates made by another thread than the previous one
+    std::uint64_t sampled_locks = 0;         // Reference list locks timed, tracked implementations only
+    std::uint64_t lock_wait_cycles = 0;      // Cycles spent waiting for the timed locks
+    std::uint64_t lock_hold_cycles = 0;      // Cycles the timed locks were held
+
+    /// @brief The cycles the sampled operations spent on the count and waiting for the locks, by which the most
+    /// contended referables are ranked.
+    std::uint64_t contended_cycles() const noexcept
+    {
+        return update_cycles + lock_wait_cycles;
+    }
+};
+
+namespace detail
+{
+
+/// @brief Reads the cycle counter of the processor, or the steady clock in nanoseconds where there is none.
+inline std::uint64_t read_cycle_counter() noexcept
+{
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+    return __rdtsc();
+#elif defined(__x86_64__) || defined(__i386__)
+    return __builtin_ia32_rdtsc();
+#elif defined(__aarch64__)
+    std::uint64_t ticks;
+    asm volatile("mrs %0, cntvct_el0" : "=r"(ticks));
+    return ticks;
+#else
+    return static_cast<std::uint64_t>(std::chrono::steady_clock::now().time_since_epoch().count());
+#endif
+}
+
+enum class contention_operation
+{
+    count_update,
+    lock
+};
+
+/// @brief Decides whether the next operation of the calling thread on a profiled counter is timed. Every
+/// na_ref_ptr_contention_sample_rate th operation of each kind and thread is timed. The kinds are sampled separately
+/// because a reference change makes a fixed number of each, which would otherwise always sample the same one.
+template <contention_operation operation> bool sample_contention() noexcept
+{
+    thread_local std::size_t operation_index = 0;
+    return ++operation_index % na_ref_ptr_contention_sample_rate == 0;
+}
+
+/// @brief The contention measured on one profiled counter.
+///
+/// Only the sampled operations write to it, so the relaxed increments do not add contention of their own to the
+/// operations that are not timed. It takes its own cache line so that it does not false share with the count.
+struct alignas(cache_line_size) contention_state
+{
+    void add_update(std::uint64_t cycles) noexcept
+    {
+        const auto thread = static_cast<std::uint32_t>(this_thread_index());
+
+        // A count update by another thread than the previous one moves the cache line of the count between cores
+        if (last_thread.load(std::memory_order_relaxed) != thread)
         {
-            this->remove_ref();
+            last_thread.store(thread, std::memory_order_relaxed);
+            cross_thread_updates.fetch_add(1, std::memory_order_relaxed);
         }
 
-        this->ref_count = other.ref_count;
+        sampled_updates.fetch_add(1, std::memory_order_relaxed);
+        update_cycles.fetch_add(cycles, std::memory_order_relaxed);
+    }
+
+    void add_lock(std::uint64_t wait_cycles, std::uint64_t hold_cycles) noexcept
+    {
+        sampled_locks.fetch_add(1, std::memory_order_relaxed);
+        lock_wait_cycles.fetch_add(wait_cycles, std::memory_order_relaxed);
+        lock_hold_cycles.fetch_add(hold_cycles, std::memory_order_relaxed);
+    }
+
+    contention_record record(bool alive) const noexcept
+    {
+        return {location,
+                this,
+                alive,
+                sampled_updates.load(std::memory_order_relaxed),
+                update_cycles.load(std::memory_order_relaxed),
+                cross_thread_updates.load(std::memory_order_relaxed),
+                sampled_locks.load(std::memory_order_relaxed),
+                lock_wait_cycles.load(std::memory_order_relaxed),
+                lock_hold_cycles.load(std::memory_order_relaxed)};
+    }
+
+    // Linked into the contention_registry, guarded by its mutex like the location
+    contention_state *prev = nullptr;
+    contention_state *next = nullptr;
+    std::source_location location{};
+
+    std::atomic<std::uint32_t> last_thread{static_cast<std::uint32_t>(this_thread_index())};
+    std::atomic<std::uint64_t> sampled_updates{0};
+    std::atomic<std::uint64_t> update_cycles{0};
+    std::atomic<std::uint64_t> cross_thread_updates{0};
+    std::atomic<std::uint64_t> sampled_locks{0};
+    std::atomic<std::uint64_t> lock_wait_cycles{0};
+    std::atomic<std::uint64_t> lock_hold_cycles{0};
+};
+
+/// @brief Lists the contention states of the live profiled counters, and keeps the records of the most contended ones
+/// that were destroyed so that short lived hot spots show up in the profile too.
+class contention_registry
+{
+  public:
+    static constexpr std::size_t max_retired = 64;
+
+    static void add(contention_state *state) noexcept
+    {
+        std::scoped_lock lock{mutex};
+
+        state->next = head.next;
+        state->prev = &head;
 
-#if defined(na_ref_ptr_tracked)
-        if (other.ref_count != nullptr)
+        if (state->next != nullptr)
         {
-            other.remove_ref();
+            state->next->prev = state;
         }
 
-        if (this->ref_count != nullptr)
+        head.next = state;
+    }
+
+    static void set_location(contention_state *state, const std::source_location &loc) noexcept
+    {
+        std::scoped_lock lock{mutex};
+        state->location = loc;
+    }
+
+    static void retire(contention_state *state) noexcept
+    {
+        std::scoped_lock lock{mutex};
+
+        state->prev->next = state->next;
+
+        if (state->next != nullptr)
         {
-            this->add_ref();
+            state->next->prev = state->prev;
         }
-#endif
 
-        other.ref_count = nullptr;
-#endif
+        contention_record record = state->record(false);
+        record.counter = nullptr; // The address is reused once the counter is gone
 
-        this->value = other.value;
-        other.value = nullptr;
+        if (record.sampled_updates + record.sampled_locks == 0)
+        {
+            return;
+        }
 
-        return *this;
+        if (retired_count < max_retired)
+        {
+            retired[retired_count++] = record;
+            return;
+        }
+
+        // When full, the least contended record is replaced
+        contention_record *least = std::min_element(std::begin(retired), std::end(retired), more_contended_last);
+        if (more_contended_last(*least, record))
+        {
+            *least = record;
+        }
     }
 
-    /// @brief Remove this reference to the object and destroys the ref_ptr.
-    ~ref_ptr()
+    static std::vector<contention_record> snapshot(std::size_t top_n)
     {
-#if defined(na_ref_ptr_counted) || defined(na_ref_ptr_tracked)
-        if (ref_count != nullptr)
+        std::vector<contention_record> records;
+
         {
-            remove_ref();
+            std::scoped_lock lock{mutex};
+
+            records.assign(retired, retired + retired_count);
+            for (const contention_state *state = head.next; state != nullptr; state = state->next)
+            {
+                records.push_back(state->record(true));
+            }
         }
-#endif
+
+        std::sort(records.begin(), records.end(),
+                  [](const contention_record &a, const contention_record &b) { return more_contended_last(b, a); });
+        records.resize(std::min(records.size(), top_n));
+        return records;
     }
 
-    /// @brief Remove this reference to the pointed object.
-    void reset() noexcept
+  private:
+    static bool more_contended_last(const contention_record &a, const contention_record &b) noexcept
+    {
+        return a.contended_cycles() < b.contended_cycles();
+    }
+
+    inline static std::mutex mutex;
+    inline static contention_state head;
+    inline static contention_record retired[max_retired];
+    inline static std::size_t retired_count = 0;
+};
+
+} // namespace detail
+
+/// @brief Counter policy that measures the contention on the count of another counter policy, for finding the
+/// referables to move to distributed_counter or isolated_counter.
+///
+/// Times one in na_ref_ptr_contention_sample_rate count updates of each thread with the cycle counter and counts the
+/// timed updates made by another thread than the previous one, each of which moves the cache line of the count between
+/// cores. In the tracked implementations the time spent waiting for and holding the reference list locks is measured
+/// too, and the referables are reported with the source location they were constructed at. The operations that are
+/// not timed cost one thread local increment more than the counter policy. See get_contention_profile().
+///
+/// The owner of a counter that can wait for zero, like draining_counter, may destroy the referable as soon as the last
+/// reference is removed, or be resumed by that removal and destroy it, so the removals from those counters are not
+/// timed and touch nothing after the count update.
+///
+/// @tparam counter_policy The counter policy used to count the references
+template <typename counter_policy = seq_cst_counter> class profiled_counter
+{
+  public:
+    explicit profiled_counter(std::size_t count = 0) noexcept : counter{count}
+    {
+        detail::contention_registry::add(&state);
+    }
+
+    profiled_counter(const profiled_counter &) = delete;
+    profiled_counter &operator=(const profiled_counter &) = delete;
+
+    ~profiled_counter()
+    {
+        detail::contention_registry::retire(&state);
+    }
+
+    void add_ref() noexcept
+    {
+        update([this] { counter.add_ref(); });
+    }
+
+    void remove_ref() noexcept
+    {
+        remove([this] { counter.remove_ref(); });
+    }
+
+    void add_refs(std::size_t n) noexcept
     {
-#if defined(na_ref_ptr_counted) || defined(na_ref_ptr_tracked)
-        if (ref_count != nullptr)
+        update([this, n] { counter.add_refs(n); });
+    }
+
+    void remove_refs(std::size_t n) noexcept
+    {
+        remove([this, n] { counter.remove_refs(n); });
+    }
+
+    std::size_t use_count() const noexcept
+    {
+        return counter.use_count();
+    }
+
+    /// @brief Waits for the count to reach zero, for a counter policy that can, like draining_counter.
+    bool wait_for_zero(std::chrono::nanoseconds timeout = std::chrono::nanoseconds::max()) const noexcept
+        requires requires(const counter_policy &c, std::chrono::nanoseconds t) { c.wait_for_zero(t); }
+    {
+        return counter.wait_for_zero(timeout);
+    }
+
+    /// @brief Resumes a coroutine when the count reaches zero, for a counter policy that can, like draining_counter.
+    bool resume_at_zero(std::coroutine_handle<> handle) const noexcept
+        requires requires(const counter_policy &c, std::coroutine_handle<> h) { c.resume_at_zero(h); }
+    {
+        return counter.resume_at_zero(handle);
+    }
+
+    /// @brief The contention measured so far, the tracked implementations add the lock times to it.
+    detail::contention_state &contention() const noexcept
+    {
+        return state;
+    }
+
+  private:
+    static constexpr bool waits_for_zero =
+        requires(const counter_policy &c, std::chrono::nanoseconds t) { c.wait_for_zero(t); } ||
+        requires(const counter_policy &c, std::coroutine_handle<> h) { c.resume_at_zero(h); };
+
+    template <typename operation> void remove(operation op) noexcept
+    {
+        if constexpr (waits_for_zero)
         {
-            remove_ref();
-            ref_count = nullptr;
+            op();
+        }
+        else
+        {
+            update(op);
         }
-#endif
-        value = nullptr;
     }
 
-    /// @brief Tests whether the ref_ptr is pointing to a valid object.
-    operator bool() const noexcept
+    template <typename operation> void update(operation op) noexcept
     {
-        return value != nullptr;
+        if (!detail::sample_contention<detail::contention_operation::count_update>())
+        {
+            op();
+            return;
+        }
+
+        const std::uint64_t start = detail::read_cycle_counter();
+        op();
+        state.add_update(detail::read_cycle_counter() - start);
     }
 
-    /// @brief Returns the use count of the referable. 0 is returned if ref_ptr is not pointing to a valid object.
-    /// @return The use count of the referable.
-    std::size_t use_count() const
+    counter_policy counter;
+    mutable detail::contention_state state;
+};
+
+namespace detail
+{
+
+template <typename counter_policy> inline constexpr bool is_profiled_counter = false;
+
+template <typename counter_policy>
+inline constexpr bool is_profiled_counter<profiled_counter<counter_policy>> = true;
+
+} // namespace detail
+
+/// @brief Collects the contention measured on the referables counted with profiled_counter.
+/// @param top_n The number of referables to return
+/// @return The live and destroyed referables with the most contended cycles, the most contended first. Only the
+/// max_retired most contended destroyed referables are kept.
+inline std::vector<contention_record> get_contention_profile(std::size_t top_n = 10)
+{
+    return detail::contention_registry::snapshot(top_n);
+}
+
+/// @brief Writes the referables counted with profiled_counter that have the most contended cycles to a sink, the
+/// most contended first.
+/// @param sink Receives the report
+/// @param context Pointer passed to every call of the sink
+/// @param top_n The number of referables to write
+inline void write_contention_profile(report_sink sink, void *context = nullptr, std::size_t top_n = 10)
+{
+    char buffer[512];
+    detail::report_writer writer{buffer, sizeof(buffer), sink, context};
+    writer << "Contention profile (1 in " << na_ref_ptr_contention_sample_rate << " operations timed):\n";
+
+    for (const contention_record &r : get_contention_profile(top_n))
     {
-#ifdef na_ref_ptr_counted
-        if (ref_count != nullptr)
+        writer << "  ";
+        if (r.location.line() != 0)
+        {
+            writer << r.location.file_name() << ":" << r.location.line();
+        }
+        else if (r.alive)
+        {
+            writer << "referable 0x";
+            writer.write_hex(reinterpret_cast<std::uintptr_t>(r.counter));
+        }
+        else
+        {
+            writer << "referable";
+        }
+        writer << (r.alive ? "\n" : " (destroyed)\n");
+
+        if (r.sampled_updates != 0)
+        {
+            writer << "    count updates: " << r.sampled_updates << " timed, " << r.update_cycles / r.sampled_updates
+                   << " cycles each, " << r.cross_thread_updates * 100 / r.sampled_updates
+                   << "% from another thread\n";
+        }
+
+        if (r.sampled_locks != 0)
         {
-            return *ref_count;
+            writer << "    locks: " << r.sampled_locks << " timed, " << r.lock_wait_cycles / r.sampled_locks
+                   << " cycles waiting and " << r.lock_hold_cycles / r.sampled_locks << " cycles held each\n";
         }
-#elif defined(na_ref_ptr_tracked)
-        if (ref_count != nullptr)
+    }
+
+    writer.flush();
+}
+
+namespace detail
+{
+
+/// @brief Coalesces the count decrements of the counted ref_ptrs destroyed on a thread inside a
+/// deferred_release_scope, and applies them in batches.
+///
+/// The buffer is a small direct mapped table keyed by the address of the counter, so the decrements of the ref_ptrs
+/// to the same referable add up in one slot and are applied with a single remove_refs(). A slot taken by another
+/// counter is applied first, and all the slots are applied when flush_threshold decrements are pending, when the
+/// outermost scope ends and when the thread exits. Each thread has one buffer, created on first use. The buffer is
+/// guarded by a spin lock that only the owner takes, except while a referable is destroyed and the destroying thread
+/// applies the decrements of that referable pending in every buffer.
+class release_buffer
+{
+  public:
+    static constexpr std::size_t slot_count = 64;
+    static constexpr std::size_t flush_threshold = 1024;
+
+    release_buffer() noexcept
+    {
+        std::scoped_lock lock{mutex};
+
+        next = first;
+
+        if (next != nullptr)
         {
-            return ref_count->use_count();
+            next->prev = this;
         }
+
+        first = this;
+        buffer_count.fetch_add(1, std::memory_order_release);
+    }
+
+    release_buffer(const release_buffer &) = delete;
+    release_buffer &operator=(const release_buffer &) = delete;
+
+    // The thread exits, which is the last point its decrements can be applied at
+    ~release_buffer()
+    {
+        flush();
+
+        std::scoped_lock lock{mutex};
+
+        (prev != nullptr ? prev->next : first) = next;
+
+        if (next != nullptr)
+        {
+            next->prev = prev;
+        }
+
+        buffer_count.fetch_sub(1, std::memory_order_relaxed);
+    }
+
+    /// @brief Defers a decrement of a counter if the calling thread is in a deferred_release_scope.
+    /// @return false if the decrement must be applied now.
+    template <typename counter_type> static bool defer(counter_type *counter) noexcept
+    {
+        // Applying the decrements of a counter that resumes a coroutine at zero would run it inside the buffer lock
+        if constexpr (requires(const counter_type &c, std::coroutine_handle<> h) { c.resume_at_zero(h); })
+        {
+            return false;
+        }
+
+        release_buffer *buffer = current;
+        if (buffer == nullptr)
+        {
+            return false;
+        }
+
+        buffer->add(counter, [](void *c, std::size_t n) noexcept { static_cast<counter_type *>(c)->remove_refs(n); });
+        return true;
+    }
+
+    /// @brief Applies the decrements of a counter pending in the buffers of all the threads, before the counter is
+    /// checked for zero.
+    static void flush_counter(const void *counter) noexcept
+    {
+        if (buffer_count.load(std::memory_order_acquire) == 0)
+        {
+            return;
+        }
+
+        std::scoped_lock lock{mutex};
+
+        for (release_buffer *buffer = first; buffer != nullptr; buffer = buffer->next)
+        {
+            buffer->flush_slot(counter);
+        }
+    }
+
+    static void enter() noexcept
+    {
+        thread_local release_buffer buffer;
+
+        if (depth++ == 0)
+        {
+            current = &buffer;
+        }
+    }
+
+    static void leave() noexcept
+    {
+        if (--depth == 0)
+        {
+            current->flush();
+            current = nullptr;
+        }
+    }
+
+    static void flush_current() noexcept
+    {
+        if (current != nullptr)
+        {
+            current->flush();
+        }
+    }
+
+  private:
+    struct slot
+    {
+        void *counter = nullptr;
+        void (*remove_refs)(void *counter, std::size_t n) = nullptr;
+        std::size_t count = 0;
+    };
+
+    static std::size_t index_of(const void *counter) noexcept
+    {
+        const auto address = reinterpret_cast<std::uintptr_t>(counter);
+        return ((address >> 4) ^ (address >> 12)) % slot_count;
+    }
+
+    static void apply(slot &s) noexcept
+    {
+        s.remove_refs(s.counter, s.count);
+        s = slot{};
+    }
+
+    void add(void *counter, void (*remove_refs)(void *, std::size_t)) noexcept
+    {
+        lock();
+
+        slot &s = slots[index_of(counter)];
+        if (s.counter != counter)
+        {
+            if (s.counter != nullptr)
+            {
+                apply(s);
+            }
+
+            s.counter = counter;
+            s.remove_refs = remove_refs;
+        }
+
+        ++s.count;
+
+        if (++pending == flush_threshold)
+        {
+            apply_all();
+        }
+
+        unlock();
+    }
+
+    void flush() noexcept
+    {
+        lock();
+        apply_all();
+        unlock();
+    }
+
+    void flush_slot(const void *counter) noexcept
+    {
+        lock();
+
+        slot &s = slots[index_of(counter)];
+        if (s.counter == counter)
+        {
+            pending -= s.count;
+            apply(s);
+        }
+
+        unlock();
+    }
+
+    void apply_all() noexcept
+    {
+        for (slot &s : slots)
+        {
+            if (s.counter != nullptr)
+            {
+                apply(s);
+            }
+        }
+
+        pending = 0;
+    }
+
+    void lock() noexcept
+    {
+        while (locked.test_and_set(std::memory_order_acquire))
+        {
+            std::this_thread::yield();
+        }
+    }
+
+    void unlock() noexcept
+    {
+        locked.clear(std::memory_order_release);
+    }
+
+    // Linked into the list of buffers, guarded by the mutex
+    release_buffer *prev = nullptr;
+    release_buffer *next = nullptr;
+
+    std::atomic_flag locked;
+    std::size_t pending = 0;
+    slot slots[slot_count];
+
+    inline static std::mutex mutex;
+    inline static release_buffer *first = nullptr;
+    inline static std::atomic_size_t buffer_count{0};
+    inline static thread_local release_buffer *current = nullptr;
+    inline static thread_local std::size_t depth = 0;
+};
+
+#if defined(na_ref_ptr_deferred_releases)
+inline void flush_deferred_releases_of(const void *counter) noexcept
+{
+    release_buffer::flush_counter(counter);
+}
 #endif
-        return 0;
+
+} // namespace detail
+
+/// @brief Makes the counted ref_ptrs destroyed on the calling thread defer their count decrements while the scope is
+/// alive, when na_ref_ptr_deferred_releases is defined in all translation units.
+///
+/// The decrements are coalesced per referable in a buffer of the thread and applied in batches, so a consumer thread
+/// that destroys many ref_ptrs to referables owned by other threads updates each of their counts once per batch instead
+/// of once per ref_ptr. The pending decrements are applied when the outermost scope ends, when the thread exits,
+/// by flush_deferred_releases(), and for one referable before its destructor checks that it is no longer referred to.
+/// use_count() does not see the decrements before they are applied. Scopes can be nested. The counters that resume a
+/// coroutine at zero, such as draining_counter, and the tracked implementations, which unlink each reference from its
+/// list when it is destroyed, do not defer.
+class deferred_release_scope
+{
+  public:
+    deferred_release_scope() noexcept
+    {
+        detail::release_buffer::enter();
     }
 
-    /// @brief Accesses the value pointed by the ref_ptr.
-    /// @return A pointer to the value pointed by the ref_ptr.
-    constexpr const type *operator->() const noexcept
+    deferred_release_scope(const deferred_release_scope &) = delete;
+    deferred_release_scope &operator=(const deferred_release_scope &) = delete;
+
+    ~deferred_release_scope()
     {
-        return value;
+        detail::release_buffer::leave();
     }
+};
 
-    /// @brief Accesses the value pointed by the ref_ptr.
-    /// @return A pointer to the value pointed by the ref_ptr.
-    constexpr type *operator->() noexcept
+/// @brief Applies the count decrements deferred by the calling thread, see deferred_release_scope.
+inline void flush_deferred_releases() noexcept
+{
+    detail::release_buffer::flush_current();
+}
+
+namespace detail
+{
+
+/// @brief Process wide table of generation counted slots that weak_refs use to find out whether the referable they
+/// refer to is still alive.
+///
+/// Every weakly referable object owns a slot while it is alive. Destroying the object bumps the generation of its
+/// slot, after which the weak_refs holding the old generation see that it is gone, and puts the slot back to be
+/// reused. Slots are allocated in chunks that are never freed, so a weak_ref can always read its slot. At most
+/// max_chunks chunks of chunk_size slots are live at the same time, one more terminates the process.
+///
+/// The slot word holds the generation in the upper 32 bits and the number of threads pinning the slot in the lower 32
+/// bits. weak_ref::lock() pins the slot while it adds a reference, and retiring the slot waits for the pins to go.
+class weak_slot_table
+{
+  public:
+    static std::uint32_t acquire()
     {
-        return value;
+        std::scoped_lock lock{mutex};
+
+        if (!free_slots.empty())
+        {
+            const auto index = free_slots.back();
+            free_slots.pop_back();
+            return index;
+        }
+
+        // More than max_chunks * chunk_size weakly referable objects alive at the same time
+        if (slot_count == max_chunks * chunk_size)
+        {
+            std::terminate();
+        }
+
+        const auto index = slot_count++;
+        if (index % chunk_size == 0)
+        {
+            chunks[index / chunk_size].store(new std::atomic<std::uint64_t>[chunk_size] {}, std::memory_order_release);
+        }
+
+        return index;
     }
 
-    /// @brief Accesses the value pointed by the ref_ptr.
-    /// @return A reference to the value pointed by the ref_ptr.
-    constexpr const type &operator*() const & noexcept
+    static void release(std::uint32_t index)
     {
-        return *value;
+        auto &slot = word(index);
+        auto current = slot.load(std::memory_order_relaxed);
+
+        while ((current & pin_mask) != 0 ||
+               !slot.compare_exchange_weak(current, (current & ~pin_mask) + generation_one, std::memory_order_acq_rel))
+        {
+            current = slot.load(std::memory_order_relaxed);
+        }
+
+        std::scoped_lock lock{mutex};
+        free_slots.push_back(index);
     }
 
-    /// @brief Accesses the value pointed by the ref_ptr.
-    /// @return A reference to the value pointed by the ref_ptr.
-    constexpr type &operator*() & noexcept
+    static std::uint32_t generation(std::uint32_t index) noexcept
     {
-        return *value;
+        return static_cast<std::uint32_t>(word(index).load(std::memory_order_acquire) >> 32);
     }
 
-    /// @brief Accesses the value pointed by the ref_ptr.
-    /// @return A reference to the value pointed by the ref_ptr.
-    constexpr const type &&operator*() const && noexcept
+    static bool pin(std::uint32_t index, std::uint32_t generation) noexcept
     {
-        return *value;
+        auto &slot = word(index);
+
+        if ((slot.load(std::memory_order_acquire) >> 32) != generation)
+        {
+            return false;
+        }
+
+        if ((slot.fetch_add(1, std::memory_order_acquire) >> 32) != generation)
+        {
+            slot.fetch_sub(1, std::memory_order_relaxed);
+            return false;
+        }
+
+        return true;
     }
 
-    /// @brief Accesses the value pointed by the ref_ptr.
-    /// @return A reference to the value pointed by the ref_ptr.
-    constexpr type &&operator*() && noexcept
+    static void unpin(std::uint32_t index) noexcept
     {
-        return *value;
+        word(index).fetch_sub(1, std::memory_order_release);
     }
 
   private:
-    void add_ref()
+    static constexpr std::uint32_t chunk_size = 4096;
+    static constexpr std::uint32_t max_chunks = 4096;
+    static constexpr std::uint64_t pin_mask = 0xFFFFFFFF;
+    static constexpr std::uint64_t generation_one = std::uint64_t{1} << 32;
+
+    static std::atomic<std::uint64_t> &word(std::uint32_t index) noexcept
+    {
+        return chunks[index / chunk_size].load(std::memory_order_acquire)[index % chunk_size];
+    }
+
+    inline static std::mutex mutex;
+    inline static std::uint32_t slot_count = 0;
+    inline static std::vector<std::uint32_t> free_slots;
+    inline static std::atomic<std::atomic<std::uint64_t> *> chunks[max_chunks] = {};
+};
+
+#if defined(na_ref_ptr_stack_traces)
+
+/// @brief Interns the stack traces captured when tracked references are added, so that references only store a 32-bit
+/// id.
+///
+/// Like the source location table, this is a fixed size open addressing hash table that is never cleared, and interning
+/// a trace that is already in the table is lock free. Id 0 is reserved for the unknown trace, which is also used once
+/// the table is full. The frames are only symbolized when a report is written.
+class stack_trace_table
+{
+  public:
+    /// @brief Captures the stack of the calling thread and interns it.
+    static std::uint32_t capture() noexcept
+    {
+        void *frames[max_frames];
+        const int size = ::backtrace(frames, static_cast<int>(max_frames));
+        return size > 0 ? intern(frames, static_cast<std::size_t>(size)) : 0;
+    }
+
+    static std::uint32_t intern(void *const *frames, std::size_t size) noexcept
+    {
+        std::size_t hash = size;
+        for (std::size_t i = 0; i < size; ++i)
+        {
+            hash = (hash ^ reinterpret_cast<std::uintptr_t>(frames[i])) * 0x100000001B3u;
+        }
+
+        for (std::size_t probe = 0; probe < max_probes; ++probe)
+        {
+            const auto id = static_cast<std::uint32_t>((hash + probe) % (capacity - 1) + 1);
+            entry &e = entries[id];
+
+            auto state = e.state.load(std::memory_order_acquire);
+            if (state == empty && e.state.compare_exchange_strong(state, writing, std::memory_order_acquire))
+            {
+                std::copy_n(frames, size, e.frames);
+                e.size = size;
+                e.state.store(ready, std::memory_order_release);
+                return id;
+            }
+
+            // Another thread is writing this entry, the frames are only valid once it is ready
+            while (state == writing)
+            {
+                state = e.state.load(std::memory_order_acquire);
+            }
+
+            if (e.size == size && std::equal(frames, frames + size, e.frames))
+            {
+                return id;
+            }
+        }
+
+        return 0;
+    }
+
+    /// @brief Writes the symbolized frames of a trace, one per line, starting from the first frame outside this library.
+    static void write(std::uint32_t id, report_writer &writer, std::string_view indent) noexcept
     {
-#if defined(na_ref_ptr_counted)
-        ++(*ref_count);
-#elif defined(na_ref_ptr_tracked)
-        ref_count->add_ref(&list_node);
-#endif // na_ref_ptr_counted or na_ref_ptr_tracked
+        if (id == 0)
+        {
+            return;
+        }
+
+        const entry &e = entries[id];
+        bool in_library = true;
+
+        for (std::size_t i = 0, listed = 0; i < e.size && listed < na_ref_ptr_stack_trace_depth; ++i)
+        {
+            Dl_info info{};
+            const bool found = ::dladdr(e.frames[i], &info) != 0;
+            const bool named = found && info.dli_sname != nullptr;
+
+            // The frames of the library come first
+            if (in_library && named && is_library_function(info.dli_sname))
+            {
+                continue;
+            }
+
+            in_library = false;
+            writer << indent << "  #" << listed++ << " ";
+
+            if (named)
+            {
+                writer << info.dli_sname << "+0x";
+                writer.write_hex(reinterpret_cast<std::uintptr_t>(e.frames[i]) -
+                                 reinterpret_cast<std::uintptr_t>(info.dli_saddr));
+            }
+            else
+            {
+                writer << "0x";
+                writer.write_hex(reinterpret_cast<std::uintptr_t>(e.frames[i]));
+            }
+
+            if (found && info.dli_fname != nullptr)
+            {
+                writer << " (" << info.dli_fname << ")";
+            }
+
+            writer << "\n";
+        }
     }
 
-    void remove_ref()
+  private:
+    // Whether a mangled name is of a function in na::detail
+    static bool is_library_function(std::string_view name) noexcept
     {
-#if defined(na_ref_ptr_counted)
-        --(*ref_count);
-#elif defined(na_ref_ptr_tracked)
-        ref_count->remove_ref(&list_node);
-#endif // na_ref_ptr_counted or na_ref_ptr_tracked
+        for (std::string_view prefix : {"_ZN", "_ZNK"})
+        {
+            if (name.starts_with(prefix) && name.substr(prefix.size()).starts_with("2na6detail"))
+            {
+                return true;
+            }
+        }
+
+        return false;
     }
 
-    template <typename other_type> friend class ref_ptr;
+    static constexpr std::size_t capacity = 1 << 13;
+    static constexpr std::size_t max_probes = 64;
+
+    // Room for the frames of the library, which are skipped when the trace is written
+    static constexpr std::size_t max_frames = na_ref_ptr_stack_trace_depth + 8;
 
-#if defined(na_ref_ptr_counted)
-    std::atomic_size_t *ref_count;
-#elif defined(na_ref_ptr_tracked)
-    ref_counter *ref_count;
-    ref_list_node list_node;
-#endif // na_ref_ptr_counted or na_ref_ptr_tracked
+    enum entry_state : std::uint32_t
+    {
+        empty,
+        writing,
+        ready
+    };
+
+    struct entry
+    {
+        std::atomic<std::uint32_t> state{empty};
+        std::size_t size;
+        void *frames[max_frames];
+    };
 
-    type *value;
+    static entry entries[capacity];
 };
 
-} // namespace uncounted or counted or tracked
+inline stack_trace_table::entry stack_trace_table::entries[stack_trace_table::capacity];
+
+#endif
 
 } // namespace detail
 
-#if defined(na_ref_ptr_uncounted)
+} // namespace na
+
+// The core types of the uncounted and counted implementations, unless na/ref_ptr_core.hpp compiled them already
+#include "ref_ptr_core.hpp"
 
-template <typename type> using referable = detail::uncounted::referable<type>;
-template <typename type> using enable_ref_from_this = detail::uncounted::enable_ref_from_this<type>;
-template <typename type> using ref_ptr = detail::uncounted::ref_ptr<type>;
+// Compile the core types of the sampled and tracked implementations, and then the other types of each implementation
+// in turn, restoring the macros that select na::ref_ptr afterwards
 
+#if defined(na_ref_ptr_uncounted)
+#define na_ref_ptr_selected_uncounted
 #elif defined(na_ref_ptr_counted)
+#define na_ref_ptr_selected_counted
+#elif defined(na_ref_ptr_sampled)
+#define na_ref_ptr_selected_sampled
+#else
+#define na_ref_ptr_selected_tracked
+#endif
+
+#undef na_ref_ptr_uncounted
+#undef na_ref_ptr_counted
+#undef na_ref_ptr_sampled
+#undef na_ref_ptr_tracked
+
+#define na_ref_ptr_sampled
+#define na_ref_ptr_tracked
+#include "detail/ref_ptr_core_implementation.hpp"
+#undef na_ref_ptr_sampled
 
-template <typename type> using referable = detail::counted::referable<type>;
-template <typename type> using enable_ref_from_this = detail::counted::enable_ref_from_this<type>;
-template <typename type> using ref_ptr = detail::counted::ref_ptr<type>;
+#include "detail/ref_ptr_core_implementation.hpp"
+#undef na_ref_ptr_tracked
 
-#elif defined(na_ref_ptr_tracked)
+#define na_ref_ptr_uncounted
+#include "detail/ref_ptr_implementation.hpp"
+#undef na_ref_ptr_uncounted
 
-template <typename type> using referable = detail::tracked::referable<type>;
-template <typename type> using enable_ref_from_this = detail::tracked::enable_ref_from_this<type>;
-template <typename type> using ref_ptr = detail::tracked::ref_ptr<type>;
+#define na_ref_ptr_counted
+#include "detail/ref_ptr_implementation.hpp"
+#undef na_ref_ptr_counted
 
+#define na_ref_ptr_sampled
+#define na_ref_ptr_tracked
+#include "detail/ref_ptr_implementation.hpp"
+#undef na_ref_ptr_sampled
+
+#include "detail/ref_ptr_implementation.hpp"
+#undef na_ref_ptr_tracked
+
+#if defined(na_ref_ptr_selected_uncounted)
+#define na_ref_ptr_uncounted
+#elif defined(na_ref_ptr_selected_counted)
+#define na_ref_ptr_counted
+#elif defined(na_ref_ptr_selected_sampled)
+#define na_ref_ptr_sampled
+#define na_ref_ptr_tracked
+#else
+#define na_ref_ptr_tracked
 #endif
 
+#undef na_ref_ptr_selected_uncounted
+#undef na_ref_ptr_selected_counted
+#undef na_ref_ptr_selected_sampled
+#undef na_ref_ptr_selected_tracked
+
+namespace na
+{
+
+namespace detail
+{
+
+template <typename type, typename counter_policy>
+inline constexpr bool is_checked_ref_source<sampled::ref_ptr<type, counter_policy>> = true;
+template <typename type, typename counter_policy>
+inline constexpr bool is_checked_ref_source<sampled::referable<type, counter_policy>> = true;
+template <typename type, typename counter_policy>
+inline constexpr bool is_checked_ref_source<tracked::ref_ptr<type, counter_policy>> = true;
+template <typename type, typename counter_policy>
+inline constexpr bool is_checked_ref_source<tracked::referable<type, counter_policy>> = true;
+
+} // namespace detail
+
+/// @brief Implementation tags of the sampled and tracked implementations for the basic_ aliases.
+using sampled = detail::sampled::implementation;
+using tracked = detail::tracked::implementation;
+
+} // namespace na
+
+#include "detail/ref_ptr_aliases.hpp"
+
+namespace na
+{
+
+using detail::selected::make_refs;
+using detail::selected::release_refs;
+
 } // namespace na
 
 #endif // NA_REF_PTR_HPP
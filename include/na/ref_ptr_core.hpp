@@ -0,0 +1,78 @@
+// Copyright (c) 2023 Namal Bambarasinghe
+//
+// This software is released under the MIT License.
+// https://opensource.org/licenses/MIT
+
+// The referables, ref_ptrs, ref_views and casts of the uncounted and counted implementations, without the standard
+// headers and the code the other implementations and types need. Including this instead of na/ref_ptr.hpp in the
+// translation units that only use these types compiles them faster. na/ref_ptr.hpp can be included after this header,
+// and this header includes na/ref_ptr.hpp when the selected implementation, na_ref_ptr_statistics or
+// na_ref_ptr_deferred_releases needs it.
+
+#include "detail/ref_ptr_core_definitions.hpp"
+
+#if (defined(na_ref_ptr_tracked) || defined(na_ref_ptr_statistics) || defined(na_ref_ptr_deferred_releases)) &&       \
+    !defined(NA_REF_PTR_HPP)
+
+#include "ref_ptr.hpp"
+
+#elif !defined(NA_REF_PTR_CORE_HPP)
+#define NA_REF_PTR_CORE_HPP
+
+// Compile the core types of each implementation in turn, restoring the macros that select na::ref_ptr afterwards
+
+#if defined(na_ref_ptr_uncounted)
+#define na_ref_ptr_selected_uncounted
+#elif defined(na_ref_ptr_counted)
+#define na_ref_ptr_selected_counted
+#elif defined(na_ref_ptr_sampled)
+#define na_ref_ptr_selected_sampled
+#else
+#define na_ref_ptr_selected_tracked
+#endif
+
+#undef na_ref_ptr_uncounted
+#undef na_ref_ptr_counted
+#undef na_ref_ptr_sampled
+#undef na_ref_ptr_tracked
+
+#define na_ref_ptr_uncounted
+#include "detail/ref_ptr_core_implementation.hpp"
+#undef na_ref_ptr_uncounted
+
+#define na_ref_ptr_counted
+#include "detail/ref_ptr_core_implementation.hpp"
+#undef na_ref_ptr_counted
+
+#if defined(na_ref_ptr_selected_uncounted)
+#define na_ref_ptr_uncounted
+#elif defined(na_ref_ptr_selected_counted)
+#define na_ref_ptr_counted
+#elif defined(na_ref_ptr_selected_sampled)
+#define na_ref_ptr_sampled
+#define na_ref_ptr_tracked
+#else
+#define na_ref_ptr_tracked
+#endif
+
+#undef na_ref_ptr_selected_uncounted
+#undef na_ref_ptr_selected_counted
+#undef na_ref_ptr_selected_sampled
+#undef na_ref_ptr_selected_tracked
+
+namespace na::detail
+{
+
+template <typename type, typename counter_policy>
+inline constexpr bool is_checked_ref_source<counted::ref_ptr<type, counter_policy>> = true;
+template <typename type, typename counter_policy>
+inline constexpr bool is_checked_ref_source<counted::referable<type, counter_policy>> = true;
+
+} // namespace na::detail
+
+// na/ref_ptr.hpp includes the aliases after its own implementations
+#if !defined(NA_REF_PTR_HPP)
+#include "detail/ref_ptr_aliases.hpp"
+#endif
+
+#endif
@@ -0,0 +1,239 @@
+// Copyright (c) 2023 Namal Bambarasinghe
+//
+// This software is released under the MIT License.
+// https://opensource.org/licenses/MIT
+
+#include <na/ref_ptr.hpp>
+
+#include "stress.hpp"
+
+#include <atomic>
+#include <memory>
+#include <new>
+#include <thread>
+#include <utility>
+
+#define na_ref_ptr_stress_stringify_impl(x) #x
+#define na_ref_ptr_stress_stringify(x) na_ref_ptr_stress_stringify_impl(x)
+#define na_ref_ptr_stress_concat_impl(a, b) a##b
+#define na_ref_ptr_stress_concat(a, b) na_ref_ptr_stress_concat_impl(a, b)
+
+// Registers pattern<na::counter_policy> as "<suit>/pattern<counter_policy>"
+#define na_ref_ptr_stress(pattern, counter_policy)                                                                   \
+    static const na_ref_ptr_stress::registration na_ref_ptr_stress_concat(registration_, __LINE__)                    \
+    {                                                                                                                  \
+        {                                                                                                              \
+            na_ref_ptr_stress_stringify(na_ref_ptr_stress_suit), #pattern, #counter_policy,                            \
+                pattern<na::counter_policy>                                                                            \
+        }                                                                                                              \
+    }
+
+namespace na_ref_ptr_stress_suit
+{
+
+using na_ref_ptr_stress::result;
+using na_ref_ptr_stress::run_threads;
+using na_ref_ptr_stress::sampler;
+
+struct payload
+{
+    int a;
+    double b;
+};
+
+#if defined(na_ref_ptr_uncounted)
+constexpr bool counts_references = false;
+#else
+constexpr bool counts_references = true;
+#endif
+
+// Keeps the compiler from dropping the operations on a ref_ptr whose value is never used
+inline void consume(const void *p) noexcept
+{
+#if defined(__GNUC__)
+    asm volatile("" : : "r"(p) : "memory");
+#else
+    static thread_local const void *volatile sink;
+    sink = p;
+    static_cast<void>(sink);
+#endif
+}
+
+// Runs a pattern against one referable that all the threads refer to, and checks its count once they are done
+template <typename counter_policy, typename pattern_type>
+result run_pattern(std::size_t threads, std::uint64_t iterations, pattern_type pattern)
+{
+    using na_ref_ptr_stress::after_free_reported;
+    after_free_reported.store(false, std::memory_order_relaxed);
+
+    result r;
+    r.counted = counts_references;
+    r.expected_use_count = counts_references ? 1 : 0;
+
+    {
+        na::referable<payload, counter_policy> shared{{1, 2.0}};
+        na::ref_ptr<payload, counter_policy> held = shared;
+
+        pattern(threads, iterations, held, r);
+        r.final_use_count = held.use_count();
+    }
+
+    r.after_free_reported = after_free_reported.load(std::memory_order_relaxed);
+    return r;
+}
+
+// Every thread copies its own ref_ptr to the shared referable and destroys the copy
+template <typename counter_policy> result copy(std::size_t threads, std::uint64_t iterations)
+{
+    using ptr_type = na::ref_ptr<payload, counter_policy>;
+
+    return run_pattern<counter_policy>(threads, iterations, [](std::size_t threads, std::uint64_t iterations,
+                                                               const ptr_type &held, result &r) {
+        run_threads(threads, iterations, r, [&](std::size_t, sampler &s) {
+            const ptr_type local = held;
+            s.run(iterations, [&](std::uint64_t) {
+                const ptr_type copy = local;
+                consume(copy.operator->());
+            });
+        });
+
+        r.operations = threads * iterations;
+    });
+}
+
+// Every thread moves a ref_ptr to the shared referable back and forth between two ref_ptrs
+template <typename counter_policy> result move(std::size_t threads, std::uint64_t iterations)
+{
+    using ptr_type = na::ref_ptr<payload, counter_policy>;
+
+    return run_pattern<counter_policy>(threads, iterations, [](std::size_t threads, std::uint64_t iterations,
+                                                               const ptr_type &held, result &r) {
+        run_threads(threads, iterations, r, [&](std::size_t, sampler &s) {
+            ptr_type slots[2] = {held, ptr_type{}};
+            s.run(iterations, [&](std::uint64_t i) {
+                slots[(i + 1) % 2] = std::move(slots[i % 2]);
+                consume(slots[(i + 1) % 2].operator->());
+            });
+        });
+
+        r.operations = threads * iterations;
+    });
+}
+
+// Every thread copies batches of ref_ptrs into the mailbox of the next thread, which destroys them, so the references
+// are added and removed on different threads
+template <typename counter_policy> result destroy(std::size_t threads, std::uint64_t iterations)
+{
+    using ptr_type = na::ref_ptr<payload, counter_policy>;
+    constexpr std::size_t batch_size = 32;
+
+    struct alignas(64) mailbox
+    {
+        std::atomic_bool full{false};
+        alignas(ptr_type) unsigned char storage[batch_size][sizeof(ptr_type)];
+
+        ptr_type *slot(std::size_t i) noexcept
+        {
+            return std::launder(reinterpret_cast<ptr_type *>(storage[i]));
+        }
+    };
+
+    return run_pattern<counter_policy>(threads, iterations, [](std::size_t threads, std::uint64_t iterations,
+                                                               const ptr_type &held, result &r) {
+        const std::uint64_t rounds = iterations / batch_size + 1;
+        const auto mailboxes = std::make_unique<mailbox[]>(threads);
+
+        run_threads(threads, rounds, r, [&](std::size_t t, sampler &s) {
+            mailbox &own = mailboxes[t];
+            mailbox &next = mailboxes[(t + 1) % threads];
+            const ptr_type local = held;
+            std::uint64_t received = 0;
+
+            const auto receive = [&]() noexcept {
+                if (!own.full.load(std::memory_order_acquire))
+                {
+                    return false;
+                }
+
+                for (std::size_t i = 0; i < batch_size; ++i)
+                {
+                    std::destroy_at(own.slot(i));
+                }
+
+                own.full.store(false, std::memory_order_release);
+                ++received;
+                return true;
+            };
+
+            s.run(rounds, [&](std::uint64_t) {
+                // Waiting threads keep emptying their own mailbox so that the ring always makes progress
+                while (next.full.load(std::memory_order_acquire))
+                {
+                    if (!receive())
+                    {
+                        std::this_thread::yield();
+                    }
+                }
+
+                for (std::size_t i = 0; i < batch_size; ++i)
+                {
+                    ::new (static_cast<void *>(next.storage[i])) ptr_type{local};
+                }
+
+                next.full.store(true, std::memory_order_release);
+                receive();
+            });
+
+            // The previous thread sends as many batches as this one
+            while (received != rounds)
+            {
+                if (!receive())
+                {
+                    std::this_thread::yield();
+                }
+            }
+        });
+
+        // Each round copies and destroys a batch of ref_ptrs
+        for (double &latency : r.latencies)
+        {
+            latency /= batch_size;
+        }
+
+        r.operations = threads * rounds * batch_size;
+    });
+}
+
+// The uncounted implementation ignores the counter policy. unsynchronized_counter is for a single thread only.
+#if defined(na_ref_ptr_uncounted)
+
+na_ref_ptr_stress(copy, seq_cst_counter);
+na_ref_ptr_stress(move, seq_cst_counter);
+na_ref_ptr_stress(destroy, seq_cst_counter);
+
+#else
+
+na_ref_ptr_stress(copy, seq_cst_counter);
+na_ref_ptr_stress(copy, relaxed_counter);
+na_ref_ptr_stress(copy, distributed_counter<>);
+na_ref_ptr_stress(copy, isolated_counter<>);
+na_ref_ptr_stress(copy, draining_counter);
+na_ref_ptr_stress(copy, profiled_counter<>);
+
+na_ref_ptr_stress(move, seq_cst_counter);
+na_ref_ptr_stress(move, relaxed_counter);
+na_ref_ptr_stress(move, distributed_counter<>);
+na_ref_ptr_stress(move, isolated_counter<>);
+na_ref_ptr_stress(move, draining_counter);
+na_ref_ptr_stress(move, profiled_counter<>);
+
+na_ref_ptr_stress(destroy, seq_cst_counter);
+na_ref_ptr_stress(destroy, relaxed_counter);
+na_ref_ptr_stress(destroy, distributed_counter<>);
+na_ref_ptr_stress(destroy, isolated_counter<>);
+na_ref_ptr_stress(destroy, draining_counter);
+na_ref_ptr_stress(destroy, profiled_counter<>);
+
+#endif
+
+} // namespace na_ref_ptr_stress_suit
@@ -0,0 +1,198 @@
+// Copyright (c) 2023 Namal Bambarasinghe
+//
+// This software is released under the MIT License.
+// https://opensource.org/licenses/MIT
+
+// Runs the stress scenarios of every implementation and counter policy on increasing numbers of threads, checks the
+// count of the shared referable after each run and writes the throughput and the latency percentiles as JSON.
+//
+// Usage: stress [--threads=1,2,4,...] [--iterations=N] [--filter=text] [--output=file]
+//   --threads     Thread counts to run each scenario with, 1 to 128. Defaults to 1,2,4,8,16,32,64,128.
+//   --iterations  Operations of each thread in each run. Defaults to 100000.
+//   --filter      Only runs the scenarios whose name, like counted/copy<seq_cst_counter>, contains the text.
+//   --output      Writes the JSON to the file instead of stdout.
+//
+// Exits with 1 if a count is wrong or a referable after free is reported, and with 2 on a bad argument.
+
+#include "stress.hpp"
+
+#include <na/ref_ptr_core.hpp>
+
+#include <charconv>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <string_view>
+#include <vector>
+
+namespace
+{
+
+constexpr std::size_t max_threads = 128;
+
+struct options
+{
+    std::vector<std::size_t> threads = {1, 2, 4, 8, 16, 32, 64, 128};
+    std::uint64_t iterations = 100000;
+    std::string filter;
+    std::string output;
+};
+
+template <typename number> bool parse_number(std::string_view text, number &value)
+{
+    const auto [end, error] = std::from_chars(text.data(), text.data() + text.size(), value);
+    return error == std::errc{} && end == text.data() + text.size();
+}
+
+bool parse_threads(std::string_view text, std::vector<std::size_t> &threads)
+{
+    threads.clear();
+
+    while (!text.empty())
+    {
+        const std::size_t comma = std::min(text.find(','), text.size());
+        std::size_t count = 0;
+
+        if (!parse_number(text.substr(0, comma), count) || count == 0 || count > max_threads)
+        {
+            return false;
+        }
+
+        threads.push_back(count);
+        text.remove_prefix(std::min(comma + 1, text.size()));
+    }
+
+    return !threads.empty();
+}
+
+bool parse_options(int argc, char **argv, options &o)
+{
+    for (int i = 1; i < argc; ++i)
+    {
+        const std::string_view arg = argv[i];
+        const std::size_t equals = arg.find('=');
+        const std::string_view name = arg.substr(0, equals);
+        const std::string_view value = equals == std::string_view::npos ? std::string_view{} : arg.substr(equals + 1);
+
+        if (name == "--threads" && parse_threads(value, o.threads))
+        {
+            continue;
+        }
+
+        if (name == "--iterations" && parse_number(value, o.iterations) && o.iterations != 0)
+        {
+            continue;
+        }
+
+        if (name == "--filter")
+        {
+            o.filter = value;
+            continue;
+        }
+
+        if (name == "--output" && !value.empty())
+        {
+            o.output = value;
+            continue;
+        }
+
+        std::cerr << "stress: bad argument " << arg << "\n";
+        return false;
+    }
+
+    return true;
+}
+
+// Nearest rank percentile of sorted samples
+double percentile(const std::vector<double> &sorted, double p)
+{
+    if (sorted.empty())
+    {
+        return 0;
+    }
+
+    const auto rank = static_cast<std::size_t>(std::ceil(p / 100 * static_cast<double>(sorted.size())));
+    return sorted[std::clamp<std::size_t>(rank, 1, sorted.size()) - 1];
+}
+
+void write_result(std::ostream &out, const na_ref_ptr_stress::scenario &s, std::size_t threads,
+                  na_ref_ptr_stress::result &r, bool correct)
+{
+    std::sort(r.latencies.begin(), r.latencies.end());
+
+    out << "    {\"name\": \"" << s.implementation << "/" << s.pattern << "<" << s.counter_policy << ">\", "
+        << "\"implementation\": \"" << s.implementation << "\", \"pattern\": \"" << s.pattern
+        << "\", \"counter_policy\": \"" << s.counter_policy << "\", \"threads\": " << threads
+        << ", \"operations\": " << r.operations << ", \"seconds\": " << r.seconds
+        << ", \"operations_per_second\": " << (r.seconds > 0 ? static_cast<double>(r.operations) / r.seconds : 0)
+        << ", \"latency_ns\": {\"samples\": " << r.latencies.size() << ", \"p50\": " << percentile(r.latencies, 50)
+        << ", \"p90\": " << percentile(r.latencies, 90) << ", \"p99\": " << percentile(r.latencies, 99)
+        << ", \"p999\": " << percentile(r.latencies, 99.9)
+        << ", \"max\": " << (r.latencies.empty() ? 0 : r.latencies.back()) << "}, \"checked\": "
+        << (r.counted ? "true" : "false") << ", \"final_use_count\": " << r.final_use_count
+        << ", \"expected_use_count\": " << r.expected_use_count
+        << ", \"after_free_reported\": " << (r.after_free_reported ? "true" : "false")
+        << ", \"correct\": " << (correct ? "true" : "false") << "}";
+}
+
+} // namespace
+
+int main(int argc, char **argv)
+{
+    options o;
+    if (!parse_options(argc, argv, o))
+    {
+        return 2;
+    }
+
+    std::ofstream file;
+    if (!o.output.empty())
+    {
+        file.open(o.output);
+        if (!file)
+        {
+            std::cerr << "stress: can not write " << o.output << "\n";
+            return 2;
+        }
+    }
+
+    // Once for the whole program, since every handler that is set is kept for the threads that may still call it
+    na::set_referable_after_free_handler(na_ref_ptr_stress::report_after_free);
+
+    std::ostream &out = o.output.empty() ? std::cout : file;
+    bool all_correct = true;
+    bool first = true;
+
+    out << "{\n  \"iterations\": " << o.iterations << ",\n  \"hardware_concurrency\": "
+        << std::thread::hardware_concurrency() << ",\n  \"results\": [\n";
+
+    for (const auto &s : na_ref_ptr_stress::scenarios())
+    {
+        const std::string name = s.implementation + "/" + s.pattern + "<" + s.counter_policy + ">";
+        if (name.find(o.filter) == std::string::npos)
+        {
+            continue;
+        }
+
+        for (const std::size_t threads : o.threads)
+        {
+            auto r = s.run(threads, o.iterations);
+            const bool correct = r.final_use_count == r.expected_use_count && !r.after_free_reported;
+
+            if (!correct)
+            {
+                all_correct = false;
+                std::cerr << "stress: " << name << " on " << threads << " threads ended with use_count() "
+                          << r.final_use_count << " instead of " << r.expected_use_count << "\n";
+            }
+
+            out << (first ? "" : ",\n");
+            write_result(out, s, threads, r, correct);
+            first = false;
+        }
+    }
+
+    out << "\n  ],\n  \"correct\": " << (all_correct ? "true" : "false") << "\n}\n";
+    return all_correct ? 0 : 1;
+}
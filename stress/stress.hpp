@@ -0,0 +1,165 @@
+// Copyright (c) 2023 Namal Bambarasinghe
+//
+// This software is released under the MIT License.
+// https://opensource.org/licenses/MIT
+
+#ifndef NA_REF_PTR_STRESS_HPP
+#define NA_REF_PTR_STRESS_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <latch>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+namespace na_ref_ptr_stress
+{
+
+/// @brief What a run of a scenario measured.
+struct result
+{
+    std::uint64_t operations = 0;
+    double seconds = 0;
+
+    /// @brief Nanoseconds per operation of each timed sample, see sampler.
+    std::vector<double> latencies;
+
+    /// @brief Whether the implementation counts references, so that the final count is checked.
+    bool counted = true;
+    std::size_t final_use_count = 0;
+    std::size_t expected_use_count = 0;
+    bool after_free_reported = false;
+};
+
+/// @brief A churn pattern of one implementation and counter policy.
+struct scenario
+{
+    std::string implementation;
+    std::string pattern;
+    std::string counter_policy;
+    std::function<result(std::size_t threads, std::uint64_t iterations)> run;
+};
+
+inline std::vector<scenario> &scenarios()
+{
+    static std::vector<scenario> all;
+    return all;
+}
+
+/// @brief Adds a scenario when the translation unit defining it is initialized.
+struct registration
+{
+    explicit registration(scenario s)
+    {
+        scenarios().push_back(std::move(s));
+    }
+};
+
+/// @brief Set by report_after_free(), cleared by each run before it starts.
+inline std::atomic_bool after_free_reported;
+
+/// @brief The referable after free handler of the stress program, installed once by main().
+inline void report_after_free(void *, std::string_view) noexcept
+{
+    after_free_reported.store(true, std::memory_order_relaxed);
+}
+
+/// @brief Times one in sample_every operations of a thread together with the sample_length operations that follow.
+///
+/// Reading the clock around every operation would cost more than most of the operations, so each sample is the time
+/// of sample_length operations divided by their number.
+class sampler
+{
+  public:
+    static constexpr std::uint64_t sample_every = 64;
+    static constexpr std::uint64_t sample_length = 16;
+
+    explicit sampler(std::uint64_t iterations)
+    {
+        latencies.reserve(iterations / sample_every + 1);
+    }
+
+    /// @brief Runs operation(i) for every i below iterations, timing the samples.
+    template <typename operation_type> void run(std::uint64_t iterations, operation_type &&operation)
+    {
+        for (std::uint64_t i = 0; i < iterations;)
+        {
+            if (i % sample_every == 0)
+            {
+                const std::uint64_t end = std::min(iterations, i + sample_length);
+                const auto start = std::chrono::steady_clock::now();
+
+                for (std::uint64_t j = i; j < end; ++j)
+                {
+                    operation(j);
+                }
+
+                const std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+                latencies.push_back(elapsed.count() / static_cast<double>(end - i));
+                i = end;
+            }
+            else
+            {
+                operation(i++);
+            }
+        }
+    }
+
+    std::vector<double> latencies;
+};
+
+/// @brief Runs body(thread_index, sampler) on threads started together, and collects the samples and the wall time
+/// from the start of the first thread to the end of the last thread.
+template <typename body_type> void run_threads(std::size_t threads, std::uint64_t iterations, result &r, body_type body)
+{
+    using clock = std::chrono::steady_clock;
+
+    std::vector<sampler> samplers;
+    samplers.reserve(threads);
+
+    for (std::size_t t = 0; t < threads; ++t)
+    {
+        samplers.emplace_back(iterations);
+    }
+
+    // Each thread reads the clock itself, since a short run may be over before the spawning thread wakes up
+    std::vector<clock::time_point> begins(threads);
+    std::vector<clock::time_point> ends(threads);
+    std::latch start{static_cast<std::ptrdiff_t>(threads)};
+
+    std::vector<std::thread> workers;
+    workers.reserve(threads);
+
+    for (std::size_t t = 0; t < threads; ++t)
+    {
+        workers.emplace_back([&, t] {
+            start.arrive_and_wait();
+            begins[t] = clock::now();
+            body(t, samplers[t]);
+            ends[t] = clock::now();
+        });
+    }
+
+    for (auto &worker : workers)
+    {
+        worker.join();
+    }
+
+    const auto begin = *std::min_element(begins.begin(), begins.end());
+    const auto end = *std::max_element(ends.begin(), ends.end());
+    r.seconds = std::chrono::duration<double>(end - begin).count();
+
+    for (auto &s : samplers)
+    {
+        r.latencies.insert(r.latencies.end(), s.latencies.begin(), s.latencies.end());
+    }
+}
+
+} // namespace na_ref_ptr_stress
+
+#endif // NA_REF_PTR_STRESS_HPP
@@ -7,6 +7,15 @@
 
 #include <gtest/gtest.h>
 
+#include <array>
+#include <atomic>
+#include <coroutine>
+#include <cstdint>
+#include <latch>
+#include <memory>
+#include <thread>
+#include <vector>
+
 TEST(na_ref_ptr_test_suit, documentation_tests)
 {
     // primitive type boxed in a referable
@@ -198,3 +207,1483 @@ TEST(na_ref_ptr_test_suit, ref_ptr_construction)
     na::ref_ptr<const double> p3{r1, &a::d};
     EXPECT_EQ(*p3, 5.0);
 }
+
+TEST(na_ref_ptr_test_suit, ref_ptr_copy_and_move_construction)
+{
+    na::referable<int> r{4};
+    na::ref_ptr<int> p1 = r;
+    na::ref_ptr<int> p2 = p1;
+    EXPECT_EQ(*p2, 4);
+
+#if defined(na_ref_ptr_counted) || defined(na_ref_ptr_tracked)
+    EXPECT_EQ(p1.use_count(), 2);
+#endif
+
+    na::ref_ptr<int> p3 = std::move(p2);
+    EXPECT_FALSE(p2);
+    EXPECT_EQ(*p3, 4);
+
+#if defined(na_ref_ptr_counted) || defined(na_ref_ptr_tracked)
+    EXPECT_EQ(p1.use_count(), 2);
+#endif
+
+    {
+        std::vector<na::ref_ptr<int>> refs;
+        for (int i = 0; i < 16; ++i)
+        {
+            refs.push_back(p1);
+        }
+
+#if defined(na_ref_ptr_counted) || defined(na_ref_ptr_tracked)
+        EXPECT_EQ(p1.use_count(), 18);
+#endif
+    }
+
+#if defined(na_ref_ptr_counted) || defined(na_ref_ptr_tracked)
+    EXPECT_EQ(p1.use_count(), 2);
+#endif
+}
+
+namespace
+{
+int sum_borrowed(na::ref_view<const int> view, int depth)
+{
+    return depth == 0 ? *view : *view + sum_borrowed(view, depth - 1);
+}
+} // namespace
+
+TEST(na_ref_ptr_test_suit, ref_view_borrow)
+{
+    struct a
+    {
+        int i;
+    };
+
+    na::referable<a> r{{3}};
+    na::ref_ptr<a> p = r;
+    na::ref_view<a> v = p.borrow();
+    EXPECT_TRUE(v);
+    EXPECT_EQ(v->i, 3);
+
+    v->i = 4;
+    EXPECT_EQ(p->i, 4);
+
+    na::ref_ptr<int> pi{p, &a::i};
+    const na::ref_ptr<int> &cpi = pi;
+    EXPECT_EQ(sum_borrowed(cpi.borrow(), 9), 40);
+
+#if defined(na_ref_ptr_counted) || defined(na_ref_ptr_tracked)
+    EXPECT_EQ(p.use_count(), 2);
+#endif
+
+    na::ref_view<const int> empty = na::ref_ptr<int>{}.borrow();
+    EXPECT_FALSE(empty);
+}
+
+TEST(na_ref_ptr_test_suit, ref_ptr_move_assignment)
+{
+    na::referable<int> r1{1};
+    na::referable<int> r2{2};
+    na::ref_ptr<int> p1 = r1;
+    na::ref_ptr<int> p2 = r1;
+    na::ref_ptr<int> p3 = r2;
+
+    // Same referable
+    p1 = std::move(p2);
+    EXPECT_EQ(*p1, 1);
+    EXPECT_FALSE(p2);
+
+#if defined(na_ref_ptr_counted) || defined(na_ref_ptr_tracked)
+    EXPECT_EQ(p1.use_count(), 1);
+#endif
+
+    // Different referable
+    p1 = std::move(p3);
+    EXPECT_EQ(*p1, 2);
+    EXPECT_FALSE(p3);
+
+#if defined(na_ref_ptr_counted) || defined(na_ref_ptr_tracked)
+    EXPECT_EQ(p1.use_count(), 1);
+#endif
+
+    // Self move
+    auto &self = p1;
+    p1 = std::move(self);
+    EXPECT_EQ(*p1, 2);
+
+#if defined(na_ref_ptr_counted) || defined(na_ref_ptr_tracked)
+    EXPECT_EQ(p1.use_count(), 1);
+#endif
+
+    // Into an empty ref_ptr
+    p2 = std::move(p1);
+    EXPECT_EQ(*p2, 2);
+
+#if defined(na_ref_ptr_counted) || defined(na_ref_ptr_tracked)
+    EXPECT_EQ(p2.use_count(), 1);
+#endif
+}
+
+template <typename counter_policy> void test_counter_policy()
+{
+    struct a : na::enable_ref_from_this<a, counter_policy>
+    {
+        a(int i) : i{i}
+        {
+        }
+
+        int i;
+    };
+
+    struct b
+    {
+        int x;
+        float y;
+    };
+
+    na::referable<b, counter_policy> r1{{7, 2.0f}};
+    na::ref_ptr<b, counter_policy> p1 = r1;
+    na::ref_ptr<float, counter_policy> p2{p1, &b::y};
+    na::ref_ptr<int, counter_policy> p3{r1, &b::x};
+    EXPECT_EQ(p1->x, 7);
+    EXPECT_EQ(*p2, 2.0f);
+    EXPECT_EQ(*p3, 7);
+
+    a a1{5};
+    na::ref_ptr<a, counter_policy> p4 = a1.ref_from_this();
+    na::ref_ptr<a, counter_policy> p5;
+    p5 = p4;
+    EXPECT_EQ(p5->i, 5);
+
+#if defined(na_ref_ptr_counted) || defined(na_ref_ptr_tracked)
+    EXPECT_EQ(p1.use_count(), 3);
+    EXPECT_EQ(p5.use_count(), 2);
+#endif
+
+    p2.reset();
+    p5 = std::move(p4);
+
+#if defined(na_ref_ptr_counted) || defined(na_ref_ptr_tracked)
+    EXPECT_EQ(p1.use_count(), 2);
+    EXPECT_EQ(p5.use_count(), 1);
+#endif
+}
+
+TEST(na_ref_ptr_test_suit, counter_policies)
+{
+    test_counter_policy<na::seq_cst_counter>();
+    test_counter_policy<na::relaxed_counter>();
+    test_counter_policy<na::unsynchronized_counter>();
+    test_counter_policy<na::distributed_counter<>>();
+    test_counter_policy<na::isolated_counter<>>();
+    test_counter_policy<na::isolated_counter<na::relaxed_counter>>();
+    test_counter_policy<na::profiled_counter<>>();
+}
+
+TEST(na_ref_ptr_test_suit, isolated_counter_layout)
+{
+    na::referable<char, na::isolated_counter<>> r{'a'};
+    na::ref_ptr<char, na::isolated_counter<>> p = r;
+    EXPECT_EQ(*p, 'a');
+
+#if defined(na_ref_ptr_counted) || defined(na_ref_ptr_tracked)
+    // The value starts on the cache line after the count
+    EXPECT_EQ(reinterpret_cast<std::uintptr_t>(&*r) % 64, 0u);
+    EXPECT_GE(reinterpret_cast<std::uintptr_t>(&*r) - reinterpret_cast<std::uintptr_t>(&r), 64u);
+    EXPECT_EQ(p.use_count(), 1);
+#endif
+}
+
+template <typename counter_policy> void test_counter_policy_threads()
+{
+    constexpr std::size_t thread_count = 8;
+    constexpr std::size_t iterations = 1000;
+
+    na::referable<int, counter_policy> r{1};
+    na::ref_ptr<int, counter_policy> p = r;
+    std::vector<na::ref_ptr<int, counter_policy>> kept(thread_count);
+
+    std::vector<std::thread> threads;
+    for (std::size_t t = 0; t < thread_count; ++t)
+    {
+        threads.emplace_back([&p, &kept, t] {
+            for (std::size_t i = 0; i < iterations; ++i)
+            {
+                na::ref_ptr<int, counter_policy> copy = p;
+                na::ref_ptr<int, counter_policy> moved = std::move(copy);
+                kept[t] = moved;
+            }
+        });
+    }
+
+    for (auto &thread : threads)
+    {
+        thread.join();
+    }
+
+#if defined(na_ref_ptr_counted) || defined(na_ref_ptr_tracked)
+    EXPECT_EQ(p.use_count(), thread_count + 1);
+#endif
+
+    // References removed on another thread than the one that added them
+    std::thread{[&kept] { kept.clear(); }}.join();
+
+#if defined(na_ref_ptr_counted) || defined(na_ref_ptr_tracked)
+    EXPECT_EQ(p.use_count(), 1);
+#endif
+}
+
+TEST(na_ref_ptr_test_suit, counter_policies_threads)
+{
+    test_counter_policy_threads<na::seq_cst_counter>();
+    test_counter_policy_threads<na::relaxed_counter>();
+    test_counter_policy_threads<na::distributed_counter<>>();
+    test_counter_policy_threads<na::isolated_counter<>>();
+    test_counter_policy_threads<na::profiled_counter<>>();
+}
+
+namespace
+{
+struct weak_service : na::enable_weak_ref_from_this<weak_service>
+{
+    int i = 5;
+};
+} // namespace
+
+TEST(na_ref_ptr_test_suit, weak_ref_lock_and_expire)
+{
+    na::weak_ref<int> empty;
+    EXPECT_TRUE(empty.expired());
+    EXPECT_FALSE(empty.lock());
+
+    na::weak_ref<const int> w;
+    {
+        na::weakly_referable<int> r{7};
+        w = r.weak_ref_to();
+        EXPECT_FALSE(w.expired());
+
+        {
+            na::ref_ptr<const int> p = w.lock();
+            ASSERT_TRUE(p);
+            EXPECT_EQ(*p, 7);
+
+#if defined(na_ref_ptr_counted) || defined(na_ref_ptr_tracked)
+            EXPECT_EQ(p.use_count(), 1);
+#endif
+        }
+
+        na::weakly_referable<int> reused{8};
+        na::weak_ref<int> w2{reused};
+        auto p2 = w2.lock();
+        EXPECT_EQ(*p2, 8);
+    }
+
+    // The referable is gone, the weak_ref expires instead of keeping it
+    EXPECT_TRUE(w.expired());
+    EXPECT_FALSE(w.lock());
+
+    // A new referable that reuses the slot does not revive the old weak_ref
+    na::weakly_referable<int> r{9};
+    EXPECT_TRUE(w.expired());
+    EXPECT_FALSE(w.lock());
+
+    w = r.weak_ref_to();
+    auto p = w.lock();
+    EXPECT_EQ(*p, 9);
+    w.reset();
+    EXPECT_TRUE(w.expired());
+}
+
+TEST(na_ref_ptr_test_suit, weak_from_this)
+{
+    na::weak_ref<weak_service> w;
+    {
+        weak_service s;
+        w = s.weak_from_this();
+
+        weak_service copy = s;
+        na::weak_ref<weak_service> wc = copy.weak_from_this();
+        EXPECT_EQ(w.lock().operator->(), &s);
+        EXPECT_EQ(wc.lock().operator->(), &copy);
+
+        auto p = w.lock();
+        ASSERT_TRUE(p);
+        EXPECT_EQ(p->i, 5);
+
+#if defined(na_ref_ptr_counted) || defined(na_ref_ptr_tracked)
+        EXPECT_EQ(p.use_count(), 1);
+#endif
+    }
+
+    EXPECT_TRUE(w.expired());
+    EXPECT_FALSE(w.lock());
+}
+
+TEST(na_ref_ptr_test_suit, weak_ref_across_assignment)
+{
+    na::weak_ref<int> wa;
+    na::weak_ref<int> wb;
+    {
+        na::weakly_referable<int> a{1};
+        wa = a.weak_ref_to();
+        {
+            na::weakly_referable<int> b{2};
+            wb = b.weak_ref_to();
+
+            // Only the values are assigned, each weak_ref keeps referring to its own object
+            a = b;
+            EXPECT_EQ(wa.lock().operator->(), &*a);
+            EXPECT_EQ(wb.lock().operator->(), &*b);
+
+            b = std::move(a);
+            EXPECT_EQ(wa.lock().operator->(), &*a);
+            EXPECT_EQ(wb.lock().operator->(), &*b);
+
+            na::weakly_referable<int> copy = b;
+            na::weak_ref<int> wc = copy.weak_ref_to();
+            auto pc = wc.lock();
+            EXPECT_EQ(*pc, 2);
+            EXPECT_EQ(wb.lock().operator->(), &*b);
+
+            pc.reset();
+            na::weakly_referable<int> moved = std::move(copy);
+            EXPECT_EQ(wc.lock().operator->(), &*copy);
+            auto pm = moved.weak_ref_to().lock();
+            EXPECT_EQ(*pm, 2);
+        }
+
+        EXPECT_TRUE(wb.expired());
+        EXPECT_FALSE(wa.expired());
+
+        weak_service s;
+        weak_service other;
+        na::weak_ref<weak_service> ws = s.weak_from_this();
+        s = other;
+        EXPECT_EQ(ws.lock().operator->(), &s);
+    }
+
+    EXPECT_TRUE(wa.expired());
+    EXPECT_FALSE(wa.lock());
+}
+
+TEST(na_ref_ptr_test_suit, make_refs_and_release_refs)
+{
+    na::referable<int> r1{1};
+    na::referable<int> r2{2};
+    const na::referable<int> cr{3};
+    std::vector<na::ref_ptr<int>> refs(8);
+    std::vector<na::ref_ptr<const int>> const_refs(2);
+
+    na::make_refs(r1, refs.begin(), refs.begin() + 5);
+    na::make_refs(r2, refs.begin() + 5, refs.end());
+    na::make_refs(cr, const_refs.begin(), const_refs.end());
+
+    for (std::size_t i = 0; i < refs.size(); ++i)
+    {
+        ASSERT_TRUE(refs[i]);
+        EXPECT_EQ(*refs[i], i < 5 ? 1 : 2);
+    }
+
+#if defined(na_ref_ptr_counted) || defined(na_ref_ptr_tracked)
+    EXPECT_EQ(refs.front().use_count(), 5);
+    EXPECT_EQ(refs.back().use_count(), 3);
+    EXPECT_EQ(const_refs.front().use_count(), 2);
+#endif
+
+    // Pointing ref_ptrs at another referable releases them first
+    na::make_refs(r2, refs.begin() + 3, refs.begin() + 5);
+
+#if defined(na_ref_ptr_counted) || defined(na_ref_ptr_tracked)
+    EXPECT_EQ(refs.front().use_count(), 3);
+    EXPECT_EQ(refs.back().use_count(), 5);
+#endif
+
+    // ref_ptrs made in bulk can be copied, moved and destroyed one by one
+    na::ref_ptr<int> copy = refs[1];
+    refs.erase(refs.begin());
+    refs.emplace_back();
+
+#if defined(na_ref_ptr_counted) || defined(na_ref_ptr_tracked)
+    EXPECT_EQ(copy.use_count(), 3);
+#endif
+
+    na::release_refs(refs.begin(), refs.end());
+
+    for (const auto &p : refs)
+    {
+        EXPECT_FALSE(p);
+    }
+
+#if defined(na_ref_ptr_counted) || defined(na_ref_ptr_tracked)
+    EXPECT_EQ(copy.use_count(), 1);
+#endif
+
+    na::release_refs(const_refs.begin(), const_refs.end());
+}
+
+TEST(na_ref_ptr_test_suit, make_refs_from_this)
+{
+    struct subscriber : na::enable_ref_from_this<subscriber>
+    {
+        int i = 4;
+    };
+
+    subscriber s;
+    na::ref_ptr<subscriber> refs[3];
+    na::make_refs(s, std::begin(refs), std::end(refs));
+
+    EXPECT_EQ(refs[2]->i, 4);
+
+#if defined(na_ref_ptr_counted) || defined(na_ref_ptr_tracked)
+    EXPECT_EQ(refs[0].use_count(), 3);
+#endif
+
+    na::release_refs(std::begin(refs), std::end(refs));
+}
+
+TEST(na_ref_ptr_test_suit, referable_pool)
+{
+    struct item
+    {
+        int i;
+        double d;
+    };
+
+    na::referable_pool<item> pool;
+    auto h1 = pool.emplace(1, 1.5);
+    auto h2 = pool.emplace(2, 2.5);
+    EXPECT_TRUE(h1);
+    EXPECT_EQ(pool.size(), 2);
+    EXPECT_EQ(pool.get(h1)->i, 1);
+
+    {
+        na::pooled_ref<item> p1 = pool.ref(h1);
+        na::pooled_ref<item> p2 = pool.ref(h2);
+        ASSERT_TRUE(p1);
+        EXPECT_EQ(p1->d, 1.5);
+        EXPECT_EQ((*p2).i, 2);
+
+        na::pooled_ref<item> copy = p1;
+        na::pooled_ref<item> moved = std::move(p2);
+        EXPECT_FALSE(p2);
+        EXPECT_EQ(moved->i, 2);
+
+        copy = moved;
+        EXPECT_EQ(copy->i, 2);
+        p1 = std::move(copy);
+        EXPECT_EQ(p1->i, 2);
+
+#if defined(na_ref_ptr_counted) || defined(na_ref_ptr_tracked)
+        EXPECT_EQ(moved.use_count(), 2);
+#endif
+    }
+
+    // Released slots are reused and stale handles do not refer to the new value
+    pool.release(h1);
+    EXPECT_EQ(pool.get(h1), nullptr);
+    EXPECT_FALSE(pool.ref(h1));
+    pool.release(h1);
+
+    auto h3 = pool.emplace(3, 3.5);
+    EXPECT_EQ(h3.id, h1.id);
+    EXPECT_NE(h3.generation, h1.generation);
+    EXPECT_EQ(pool.get(h1), nullptr);
+    EXPECT_EQ(pool.get(h3)->i, 3);
+
+    EXPECT_FALSE(pool.get(na::referable_pool<item>::handle{}));
+    EXPECT_FALSE(na::pooled_ref<item>{});
+}
+
+TEST(na_ref_ptr_test_suit, referable_pool_grows_in_chunks)
+{
+    na::referable_pool<int> pool;
+    std::vector<na::referable_pool<int>::handle> handles;
+    std::vector<na::pooled_ref<int>> refs;
+
+    for (int i = 0; i < 3000; ++i)
+    {
+        handles.push_back(pool.emplace(i));
+        refs.push_back(pool.ref(handles.back()));
+    }
+
+    // The values do not move when the pool grows
+    for (int i = 0; i < 3000; ++i)
+    {
+        EXPECT_EQ(*refs[i], i);
+    }
+
+    refs.clear();
+
+    for (std::size_t i = 0; i < handles.size(); i += 2)
+    {
+        pool.release(handles[i]);
+    }
+
+    EXPECT_EQ(pool.size(), 1500);
+}
+
+namespace
+{
+struct listener
+{
+    int sum = 0;
+
+    void on_value(int v)
+    {
+        sum += v;
+    }
+
+    void on_value_const(int v) const
+    {
+        last = v;
+    }
+
+    mutable int last = 0;
+};
+} // namespace
+
+TEST(na_ref_ptr_test_suit, signal_connect_emit_disconnect)
+{
+    na::referable<listener> l1{listener{}};
+    na::referable<listener> l2{listener{}};
+    na::signal<int> sig;
+
+    auto c1 = sig.connect(na::ref_ptr<listener>{l1}, &listener::on_value);
+    auto c2 = sig.connect(na::ref_ptr<listener>{l2}, &listener::on_value_const);
+    EXPECT_NE(c1, c2);
+    EXPECT_EQ(sig.size(), 2);
+
+#if defined(na_ref_ptr_counted) || defined(na_ref_ptr_tracked)
+    EXPECT_EQ(na::ref_ptr<listener>{l1}.use_count(), 2);
+#endif
+
+    sig.emit(3);
+    sig(4);
+    EXPECT_EQ(l1->sum, 7);
+    EXPECT_EQ(l2->last, 4);
+
+    EXPECT_TRUE(sig.disconnect(c1));
+    EXPECT_FALSE(sig.disconnect(c1));
+    sig.emit(5);
+    EXPECT_EQ(l1->sum, 7);
+    EXPECT_EQ(l2->last, 5);
+
+#if defined(na_ref_ptr_counted) || defined(na_ref_ptr_tracked)
+    EXPECT_EQ(na::ref_ptr<listener>{l1}.use_count(), 1);
+#endif
+
+    sig.disconnect_all();
+    EXPECT_EQ(sig.size(), 0);
+    sig.emit(6);
+    EXPECT_EQ(l2->last, 5);
+}
+
+TEST(na_ref_ptr_test_suit, signal_weak_slots)
+{
+    na::signal<int> sig;
+    na::weakly_referable<listener> kept{listener{}};
+    sig.connect(kept.weak_ref_to(), &listener::on_value);
+
+    {
+        na::weakly_referable<listener> gone{listener{}};
+        sig.connect(gone.weak_ref_to(), &listener::on_value);
+        sig.emit(1);
+        EXPECT_EQ(gone->sum, 1);
+    }
+
+    // The slot of the destroyed listener is skipped
+    sig.emit(2);
+    EXPECT_EQ(kept->sum, 3);
+}
+
+TEST(na_ref_ptr_test_suit, signal_connect_and_disconnect_from_slot)
+{
+    struct self_disconnecting
+    {
+        na::signal<> *sig = nullptr;
+        na::signal<>::connection c = 0;
+        int calls = 0;
+
+        void on_signal()
+        {
+            ++calls;
+            sig->disconnect(c);
+        }
+    };
+
+    na::signal<> sig;
+    na::referable<self_disconnecting> s{self_disconnecting{}};
+    s->sig = &sig;
+    s->c = sig.connect(na::ref_ptr<self_disconnecting>{s}, &self_disconnecting::on_signal);
+
+    sig.emit();
+    sig.emit();
+    EXPECT_EQ(s->calls, 1);
+    EXPECT_EQ(sig.size(), 0);
+}
+
+TEST(na_ref_ptr_test_suit, signal_emit_while_connecting)
+{
+    constexpr int thread_count = 4;
+    constexpr int emits_per_thread = 1000;
+
+    struct tally : na::enable_ref_from_this<tally>
+    {
+        std::atomic<int> count{0};
+    };
+
+    tally counter;
+    na::signal<int> sig;
+    sig.connect(counter.ref_from_this(), [](tally &t, int v) { t.count += v; });
+
+    std::vector<std::thread> threads;
+    for (int t = 0; t < thread_count; ++t)
+    {
+        threads.emplace_back([&sig] {
+            for (int i = 0; i < emits_per_thread; ++i)
+            {
+                sig.emit(1);
+            }
+        });
+    }
+
+    // Connecting and disconnecting replaces the slot array while the other threads emit
+    na::referable<listener> l{listener{}};
+    for (int i = 0; i < 100; ++i)
+    {
+        sig.disconnect(sig.connect(na::ref_ptr<listener>{l}, &listener::on_value));
+    }
+
+    for (auto &thread : threads)
+    {
+        thread.join();
+    }
+
+    EXPECT_EQ(counter.count.load(), thread_count * emits_per_thread);
+}
+
+TEST(na_ref_ptr_test_suit, signal_disconnect_while_emits_overlap)
+{
+    // An emit blocks in the slot until its gate opens, so that the emits overlap at every point of the test
+    struct blocker : na::enable_ref_from_this<blocker>
+    {
+        std::atomic<int> entered{0};
+        std::atomic<bool> gates[2] = {false, false};
+
+        void wait(int i)
+        {
+            entered.fetch_add(1);
+            while (!gates[i].load())
+            {
+                std::this_thread::yield();
+            }
+        }
+    };
+
+    blocker b;
+    na::referable<listener> target{listener{}};
+    na::signal<int> sig;
+
+    sig.connect(b.ref_from_this(), &blocker::wait);
+    const auto c = sig.connect(na::ref_ptr<listener>{target}, &listener::on_value);
+
+    std::thread first{[&sig] { sig.emit(0); }};
+    while (b.entered.load() != 1)
+    {
+        std::this_thread::yield();
+    }
+
+    EXPECT_TRUE(sig.disconnect(c));
+
+    std::thread second{[&sig] { sig.emit(1); }};
+    while (b.entered.load() != 2)
+    {
+        std::this_thread::yield();
+    }
+
+#if defined(na_ref_ptr_counted) || defined(na_ref_ptr_tracked)
+    // The first emit still reads the array holding the disconnected slot
+    EXPECT_EQ(na::ref_ptr<listener>{target}.use_count(), 2);
+#endif
+
+    b.gates[0] = true;
+    first.join();
+
+#if defined(na_ref_ptr_counted) || defined(na_ref_ptr_tracked)
+    // The second emit is still running, the reference of the slot is removed anyway
+    EXPECT_EQ(na::ref_ptr<listener>{target}.use_count(), 1);
+#endif
+
+    b.gates[1] = true;
+    second.join();
+    EXPECT_EQ(target->sum, 0);
+}
+
+TEST(na_ref_ptr_test_suit, draining_referable_waits_for_refs)
+{
+    std::atomic<bool> released{false};
+    std::thread holder;
+
+    {
+        na::draining_referable<int> r{1};
+        na::ref_ptr<int, na::draining_counter> p = r;
+
+        holder = std::thread{[p = std::move(p), &released]() mutable {
+            std::this_thread::sleep_for(std::chrono::milliseconds{20});
+            released = true;
+            p.reset();
+        }};
+    }
+
+#if defined(na_ref_ptr_counted) || defined(na_ref_ptr_tracked)
+    // The destructor returned only after the other thread removed its reference
+    EXPECT_TRUE(released.load());
+#endif
+
+    holder.join();
+}
+
+namespace
+{
+// Coroutine that starts eagerly and destroys its frame when it finishes
+struct detached_task
+{
+    struct promise_type
+    {
+        detached_task get_return_object() noexcept
+        {
+            return {};
+        }
+
+        std::suspend_never initial_suspend() noexcept
+        {
+            return {};
+        }
+
+        std::suspend_never final_suspend() noexcept
+        {
+            return {};
+        }
+
+        void return_void() noexcept
+        {
+        }
+
+        void unhandled_exception() noexcept
+        {
+            std::terminate();
+        }
+    };
+};
+
+detached_task shut_down(std::unique_ptr<na::draining_referable<int>> r, std::atomic<bool> &done)
+{
+    co_await r->unreferenced();
+    r.reset();
+    done = true;
+}
+} // namespace
+
+TEST(na_ref_ptr_test_suit, draining_referable_unreferenced)
+{
+    std::atomic<bool> done{false};
+    auto owned = std::make_unique<na::draining_referable<int>>(1);
+    na::ref_ptr<int, na::draining_counter> p = *owned;
+    na::ref_ptr<int, na::draining_counter> q = p;
+
+    shut_down(std::move(owned), done);
+
+#if defined(na_ref_ptr_counted) || defined(na_ref_ptr_tracked)
+    // The coroutine is suspended until the last reference is removed, and is resumed by the thread that removes it
+    EXPECT_FALSE(done.load());
+    p.reset();
+    EXPECT_FALSE(done.load());
+    std::thread{[&q] { q.reset(); }}.join();
+#else
+    q.reset();
+    p.reset();
+#endif
+
+    EXPECT_TRUE(done.load());
+
+    // Not suspended when there are no references
+    done = false;
+    shut_down(std::make_unique<na::draining_referable<int>>(2), done);
+    EXPECT_TRUE(done.load());
+}
+
+namespace
+{
+using profiled_draining = na::profiled_counter<na::draining_counter>;
+
+detached_task delete_when_unreferenced(na::draining_referable<int, profiled_draining> *r)
+{
+    co_await r->unreferenced();
+    delete r;
+}
+} // namespace
+
+TEST(na_ref_ptr_test_suit, profiled_draining_referable_deleted_when_unreferenced)
+{
+    // The resumed coroutine deletes the referable inside the removal of the last reference, which must not touch the
+    // counter afterwards. Enough referables are deleted that some of the last removals are sampled.
+    for (std::size_t i = 0; i < 4 * na_ref_ptr_contention_sample_rate; ++i)
+    {
+        auto *r = new na::draining_referable<int, profiled_draining>{1};
+        na::ref_ptr<int, profiled_draining> p = *r;
+        delete_when_unreferenced(r);
+        p.reset();
+    }
+}
+
+TEST(na_ref_ptr_test_suit, mixed_implementations)
+{
+    static_assert(std::is_same_v<na::basic_ref_ptr<int>, na::ref_ptr<int>>);
+    static_assert(!std::is_same_v<na::basic_ref_ptr<int, na::tracked>, na::basic_ref_ptr<int, na::counted>>);
+    static_assert(sizeof(na::basic_ref_ptr<int, na::uncounted>) == sizeof(int *));
+
+    // A tracked subsystem and a counted subsystem in the same translation unit
+    na::basic_referable<int, na::tracked> tracked_value{1};
+    na::basic_referable<int, na::counted> counted_value{2};
+    na::basic_ref_ptr<int, na::tracked> tp = tracked_value;
+    na::basic_ref_ptr<int, na::counted> cp = counted_value;
+    EXPECT_EQ(tp.use_count(), 1);
+    EXPECT_EQ(cp.use_count(), 1);
+
+    // Hot paths explicitly drop to uncounted references
+    na::basic_ref_ptr<int, na::uncounted> from_ptr{tp};
+    na::basic_ref_ptr<int, na::uncounted> from_referable{counted_value};
+    const na::basic_ref_ptr<int, na::sampled> sp;
+    na::basic_ref_ptr<const int, na::uncounted> from_empty{sp};
+    EXPECT_EQ(*from_ptr, 1);
+    EXPECT_EQ(*from_referable, 2);
+    EXPECT_FALSE(from_empty);
+    EXPECT_EQ(tp.use_count(), 1);
+
+    static_assert(!std::is_convertible_v<na::basic_ref_ptr<int, na::tracked> &, na::basic_ref_ptr<int, na::uncounted>>);
+    static_assert(!std::is_constructible_v<na::basic_ref_ptr<int, na::counted>, na::basic_ref_ptr<int, na::tracked> &>);
+}
+
+TEST(na_ref_ptr_test_suit, contention_profile)
+{
+    using profiled = na::profiled_counter<>;
+    constexpr std::size_t thread_count = 2;
+    constexpr std::size_t copies = 16 * na_ref_ptr_contention_sample_rate;
+
+    const auto find_alive = [] {
+        for (const auto &record : na::get_contention_profile(1000))
+        {
+            if (record.alive)
+            {
+                return record;
+            }
+        }
+        return na::contention_record{};
+    };
+
+    na::contention_record live;
+    {
+        na::referable<int, profiled> r{1};
+        na::ref_ptr<int, profiled> p = r;
+
+        std::vector<std::thread> threads;
+        for (std::size_t t = 0; t < thread_count; ++t)
+        {
+            threads.emplace_back([&p] {
+                for (std::size_t i = 0; i < copies; ++i)
+                {
+                    na::ref_ptr<int, profiled> copy = p;
+                }
+            });
+        }
+
+        for (auto &thread : threads)
+        {
+            thread.join();
+        }
+
+        live = find_alive();
+    }
+
+#if defined(na_ref_ptr_counted) || defined(na_ref_ptr_tracked)
+    // Each copy adds and removes a reference, and the first timed update of each thread comes from another thread
+    const std::size_t timed = thread_count * 2 * copies / na_ref_ptr_contention_sample_rate;
+    EXPECT_GE(live.sampled_updates, timed);
+    EXPECT_LE(live.sampled_updates, timed + 1);
+    EXPECT_GE(live.cross_thread_updates, thread_count);
+    EXPECT_LE(live.cross_thread_updates, live.sampled_updates);
+    EXPECT_GE(live.update_cycles, live.sampled_updates);
+
+    // The destroyed referable stays in the profile
+    const auto profile = na::get_contention_profile(1000);
+    EXPECT_TRUE(std::any_of(profile.begin(), profile.end(), [&live](const na::contention_record &r) {
+        return !r.alive && r.sampled_updates == live.sampled_updates && r.update_cycles == live.update_cycles;
+    }));
+#else
+    EXPECT_EQ(live.sampled_updates, 0);
+#endif
+
+    std::string report;
+    na::write_contention_profile(
+        [](void *context, std::string_view text) { static_cast<std::string *>(context)->append(text); }, &report);
+    EXPECT_TRUE(report.starts_with("Contention profile (1 in "));
+}
+
+TEST(na_ref_ptr_test_suit, atomic_ref_ptr)
+{
+    na::referable<int> r1{1};
+    na::referable<int> r2{2};
+    na::atomic_ref_ptr<int> a;
+    EXPECT_FALSE(a.load());
+
+    a.store(na::ref_ptr<int>{r1});
+    na::ref_ptr<int> loaded = a.load();
+    EXPECT_EQ(*loaded, 1);
+
+    na::ref_ptr<int> previous = a.exchange(na::ref_ptr<int>{r2});
+    EXPECT_EQ(*previous, 1);
+    loaded = a;
+    EXPECT_EQ(*loaded, 2);
+
+    // Fails and loads the ref_ptr held when expected points elsewhere
+    na::ref_ptr<int> expected = previous;
+    EXPECT_FALSE(a.compare_exchange_strong(expected, na::ref_ptr<int>{r1}));
+    EXPECT_EQ(*expected, 2);
+    EXPECT_TRUE(a.compare_exchange_strong(expected, na::ref_ptr<int>{r1}));
+    loaded = a.load();
+    EXPECT_EQ(*loaded, 1);
+    loaded.reset();
+
+#if defined(na_ref_ptr_counted) || defined(na_ref_ptr_tracked)
+    // The atomic holds a reference to r1, previous the other one
+    EXPECT_EQ(previous.use_count(), 2);
+    EXPECT_EQ(expected.use_count(), 1);
+#endif
+
+    a.store({});
+    EXPECT_FALSE(a.load());
+
+#if defined(na_ref_ptr_counted) || defined(na_ref_ptr_tracked)
+    EXPECT_EQ(previous.use_count(), 1);
+#endif
+}
+
+TEST(na_ref_ptr_test_suit, atomic_ref_ptr_threads)
+{
+    constexpr int reader_count = 4;
+    constexpr int stores = 2000;
+
+    na::referable<int> values[3] = {{0}, {1}, {2}};
+    na::atomic_ref_ptr<int> current{na::ref_ptr<int>{values[0]}};
+    std::atomic<bool> done{false};
+
+    std::vector<std::thread> readers;
+    for (int t = 0; t < reader_count; ++t)
+    {
+        readers.emplace_back([&] {
+            while (!done)
+            {
+                na::ref_ptr<int> p = current.load();
+                ASSERT_TRUE(p);
+                EXPECT_GE(*p, 0);
+                EXPECT_LE(*p, 2);
+            }
+        });
+    }
+
+    for (int i = 1; i <= stores; ++i)
+    {
+        if (i % 2 == 0)
+        {
+            current.store(na::ref_ptr<int>{values[i % 3]});
+        }
+        else
+        {
+            na::ref_ptr<int> expected = current.load();
+            current.compare_exchange_strong(expected, na::ref_ptr<int>{values[i % 3]});
+        }
+    }
+
+    done = true;
+    for (auto &reader : readers)
+    {
+        reader.join();
+    }
+
+    current.store({});
+
+#if defined(na_ref_ptr_counted) || defined(na_ref_ptr_tracked)
+    // Every box replaced while it was being read was freed by its last reader
+    for (auto &value : values)
+    {
+        EXPECT_EQ(na::ref_ptr<int>{value}.use_count(), 1);
+    }
+#endif
+}
+
+namespace
+{
+struct config
+{
+    int generation;
+    std::atomic<int> *destroyed;
+
+    config(int generation, std::atomic<int> *destroyed) : generation{generation}, destroyed{destroyed}
+    {
+    }
+
+    config(config &&other) noexcept : generation{other.generation}, destroyed{std::exchange(other.destroyed, nullptr)}
+    {
+    }
+
+    ~config()
+    {
+        if (destroyed != nullptr)
+        {
+            ++*destroyed;
+        }
+    }
+};
+} // namespace
+
+TEST(na_ref_ptr_test_suit, versioned_referable)
+{
+    std::atomic<int> destroyed{0};
+    {
+        na::versioned_referable<config> current{config{1, &destroyed}};
+
+        na::ref_ptr<const config> first = current.load();
+        EXPECT_EQ(first->generation, 1);
+
+        current.publish(config{2, &destroyed});
+        na::ref_ptr<const config> second = current.load();
+        EXPECT_EQ(first->generation, 1);
+        EXPECT_EQ(second->generation, 2);
+
+        // The first version is kept while it is referred to
+        current.reclaim();
+        EXPECT_EQ(destroyed.load(), 0);
+
+        first.reset();
+        current.reclaim();
+#if defined(na_ref_ptr_counted) || defined(na_ref_ptr_tracked)
+        EXPECT_EQ(destroyed.load(), 1);
+#else
+        EXPECT_EQ(destroyed.load(), 0);
+#endif
+
+        second.reset();
+    }
+
+    EXPECT_EQ(destroyed.load(), 2);
+}
+
+TEST(na_ref_ptr_test_suit, versioned_referable_many_refs)
+{
+    bool referable_after_free_detected = false;
+    na::set_referable_after_free_handler(
+        [&referable_after_free_detected](const std::string &) { referable_after_free_detected = true; });
+
+    // More references to one version than the word can count
+    std::atomic<int> destroyed{0};
+    {
+        na::versioned_referable<config> current{config{1, &destroyed}};
+        std::vector<na::ref_ptr<const config>> refs;
+        for (int i = 0; i < 100000; ++i)
+        {
+            refs.push_back(current.load());
+        }
+
+        current.publish(config{2, &destroyed});
+        refs.clear();
+        current.reclaim();
+#if defined(na_ref_ptr_counted) || defined(na_ref_ptr_tracked)
+        EXPECT_EQ(destroyed.load(), 1);
+#endif
+    }
+
+    EXPECT_EQ(destroyed.load(), 2);
+    EXPECT_FALSE(referable_after_free_detected);
+}
+
+TEST(na_ref_ptr_test_suit, versioned_referable_threads)
+{
+    constexpr int reader_count = 4;
+    constexpr int version_count = 200;
+
+    std::atomic<int> destroyed{0};
+    {
+        na::versioned_referable<config> current{config{0, &destroyed}};
+        std::atomic<bool> stop{false};
+
+        std::vector<std::thread> readers;
+        for (int t = 0; t < reader_count; ++t)
+        {
+            readers.emplace_back([&current, &stop] {
+                int last = 0;
+                while (!stop.load(std::memory_order_relaxed))
+                {
+                    na::ref_ptr<const config> p = current.load();
+                    na::ref_ptr<const config> copy = p;
+
+                    // Versions are published in order, a reader never sees an older version after a newer one
+                    EXPECT_GE(copy->generation, last);
+                    last = copy->generation;
+                }
+            });
+        }
+
+        for (int generation = 1; generation <= version_count; ++generation)
+        {
+            current.publish(config{generation, &destroyed});
+        }
+
+        stop = true;
+        for (auto &reader : readers)
+        {
+            reader.join();
+        }
+
+        current.reclaim();
+#if defined(na_ref_ptr_counted) || defined(na_ref_ptr_tracked)
+        EXPECT_EQ(destroyed.load(), version_count);
+#endif
+    }
+
+    EXPECT_EQ(destroyed.load(), version_count + 1);
+}
+
+TEST(na_ref_ptr_test_suit, versioned_referable_fold_while_publishing)
+{
+    bool referable_after_free_detected = false;
+    na::set_referable_after_free_handler(
+        [&referable_after_free_detected](const std::string &) { referable_after_free_detected = true; });
+
+    // The loads pass the count the word can hold while versions are replaced, the held references keep their versions
+    std::atomic<int> destroyed{0};
+    {
+        na::versioned_referable<config> current{config{0, &destroyed}};
+        std::atomic<bool> stop{false};
+
+        std::thread publisher{[&current, &stop, &destroyed] {
+            for (int generation = 1; !stop.load(std::memory_order_relaxed); ++generation)
+            {
+                current.publish(config{generation, &destroyed});
+            }
+        }};
+
+        std::vector<na::ref_ptr<const config>> refs;
+        for (int i = 0; i < 200000; ++i)
+        {
+            refs.push_back(current.load());
+        }
+
+        stop = true;
+        publisher.join();
+
+        for (const auto &p : refs)
+        {
+            EXPECT_NE(p->destroyed, nullptr);
+        }
+    }
+
+    EXPECT_FALSE(referable_after_free_detected);
+}
+
+TEST(na_ref_ptr_test_suit, referable_array)
+{
+    struct point
+    {
+        int x;
+        int y;
+    };
+
+    na::referable_array<point> points(4, point{1, 2});
+    EXPECT_EQ(points.size(), 4);
+
+    // The elements are packed like a plain array
+    EXPECT_EQ(points.end() - points.begin(), 4);
+    EXPECT_EQ(reinterpret_cast<char *>(&points[1]) - reinterpret_cast<char *>(points.data()), sizeof(point));
+
+    na::ref_ptr<point> p = points.ref(2);
+    p->x = 5;
+    EXPECT_EQ(points[2].x, 5);
+
+    // Member pointers work on element ref_ptrs as on any ref_ptr
+    na::ref_ptr<int> y = na::ref_ptr<int>{p, &point::y};
+    EXPECT_EQ(*y, 2);
+
+    const auto &const_points = points;
+    na::ref_ptr<const point> c = const_points.ref(0);
+    EXPECT_EQ(c->x, 1);
+
+#if defined(na_ref_ptr_counted) || defined(na_ref_ptr_tracked)
+    // All the elements count against the one counter of the array
+    EXPECT_EQ(c.use_count(), 3);
+#endif
+
+    int sum = 0;
+    for (const auto &point : points)
+    {
+        sum += point.x;
+    }
+    EXPECT_EQ(sum, 8);
+
+    na::referable_array<int> ints{1, 2, 3};
+    std::vector<int> values{4, 5};
+    na::referable_array<int> from_range(values.begin(), values.end());
+    EXPECT_EQ(ints[2], 3);
+    EXPECT_EQ(from_range.size(), 2);
+    EXPECT_EQ(*from_range.ref(1).operator->(), 5);
+
+    // The elements of a bool array are addressable bools
+    na::referable_array<bool> flags(3, false);
+    na::ref_ptr<bool> flag = flags.ref(1);
+    *flag = true;
+    EXPECT_TRUE(flags[1]);
+    EXPECT_EQ(flags.data() + 1, &flags[1]);
+}
+
+TEST(na_ref_ptr_test_suit, relocate_range)
+{
+#if defined(na_ref_ptr_tracked)
+    static_assert(!na::is_trivially_relocatable_v<na::ref_ptr<int>>);
+#else
+    static_assert(na::is_trivially_relocatable_v<na::ref_ptr<int>>);
+    static_assert(na::is_trivially_relocatable_v<na::pooled_ref<int>>);
+#endif
+
+    constexpr std::size_t count = 8;
+
+    na::referable<int> values[2] = {{1}, {2}};
+    alignas(na::ref_ptr<int>) unsigned char from_storage[count * sizeof(na::ref_ptr<int>)];
+    alignas(na::ref_ptr<int>) unsigned char to_storage[count * sizeof(na::ref_ptr<int>)];
+    auto *from = reinterpret_cast<na::ref_ptr<int> *>(from_storage);
+    auto *to = reinterpret_cast<na::ref_ptr<int> *>(to_storage);
+
+    for (std::size_t i = 0; i < count; ++i)
+    {
+        std::construct_at(from + i, values[i % 2]);
+    }
+
+    EXPECT_EQ(na::relocate_range(from, from + count, to), to + count);
+    for (std::size_t i = 0; i < count; ++i)
+    {
+        EXPECT_EQ(*to[i], static_cast<int>(i % 2) + 1);
+    }
+
+    // Erases the first two by shifting the others to the left
+    std::destroy_n(to, 2);
+    na::relocate_range(to + 2, to + count, to);
+
+    // Inserts at the front by shifting them to the right
+    na::relocate_range(to, to + count - 2, to + 1);
+    std::construct_at(to, values[1]);
+
+    EXPECT_EQ(*to[0], 2);
+    EXPECT_EQ(*to[1], 1);
+    EXPECT_EQ(*to[6], 2);
+
+#if defined(na_ref_ptr_counted) || defined(na_ref_ptr_tracked)
+    EXPECT_EQ(to[1].use_count(), 3);
+    EXPECT_EQ(to[0].use_count(), 4);
+#endif
+
+    // A shift by zero and an empty range leave the values as they are
+    EXPECT_EQ(na::relocate_range(to, to + count - 1, to), to + count - 1);
+    EXPECT_EQ(na::relocate_range(to + 3, to + 3, to + 5), to + 5);
+    EXPECT_EQ(*to[0], 2);
+    EXPECT_EQ(*to[1], 1);
+    EXPECT_EQ(*to[6], 2);
+
+    std::string names[2] = {"a", "b"};
+    EXPECT_EQ(na::relocate_range(names, names + 2, names), names + 2);
+    EXPECT_EQ(names[1], "b");
+
+    // The reference lists of the tracked implementation point at the new addresses
+    std::destroy_n(to, count - 1);
+
+#if defined(na_ref_ptr_counted) || defined(na_ref_ptr_tracked)
+    EXPECT_EQ(na::ref_ptr<int>{values[0]}.use_count(), 1);
+    EXPECT_EQ(na::ref_ptr<int>{values[1]}.use_count(), 1);
+#endif
+}
+
+TEST(na_ref_ptr_test_suit, relocate_range_in_opposite_orders)
+{
+    constexpr int relocations = 100000;
+
+    na::referable<int> a{1};
+    na::referable<int> b{2};
+
+    // The references are made on this thread so that all of them are in the same shard of their referable
+    struct buffers
+    {
+        alignas(na::ref_ptr<int>) unsigned char storage[2][2 * sizeof(na::ref_ptr<int>)];
+
+        na::ref_ptr<int> *at(int i)
+        {
+            return reinterpret_cast<na::ref_ptr<int> *>(storage[i % 2]);
+        }
+    };
+
+    buffers forward_refs;
+    buffers backward_refs;
+    std::construct_at(forward_refs.at(0), a);
+    std::construct_at(forward_refs.at(0) + 1, b);
+    std::construct_at(backward_refs.at(0), b);
+    std::construct_at(backward_refs.at(0) + 1, a);
+
+    // One thread relocates references to a then b and the other to b then a, so relocating must not hold the lock of
+    // one referable while it waits for the lock of the other
+    std::latch start{2};
+    const auto relocate_back_and_forth = [&start](buffers &refs) {
+        start.arrive_and_wait();
+        for (int i = 0; i < relocations; ++i)
+        {
+            na::relocate_range(refs.at(i), refs.at(i) + 2, refs.at(i + 1));
+        }
+    };
+
+    std::thread forward{relocate_back_and_forth, std::ref(forward_refs)};
+    std::thread backward{relocate_back_and_forth, std::ref(backward_refs)};
+    forward.join();
+    backward.join();
+
+    EXPECT_EQ(*forward_refs.at(relocations)[0], 1);
+    EXPECT_EQ(*backward_refs.at(relocations)[0], 2);
+    std::destroy_n(forward_refs.at(relocations), 2);
+    std::destroy_n(backward_refs.at(relocations), 2);
+
+#if defined(na_ref_ptr_counted) || defined(na_ref_ptr_tracked)
+    EXPECT_EQ(na::ref_ptr<int>{a}.use_count(), 1);
+    EXPECT_EQ(na::ref_ptr<int>{b}.use_count(), 1);
+#endif
+}
+
+namespace
+{
+
+struct message_field
+{
+    int id;
+    int values[4];
+};
+
+struct message
+{
+    message_field header;
+    std::array<message_field, 2> fields;
+    std::vector<int> payload;
+};
+
+} // namespace
+
+TEST(na_ref_ptr_test_suit, sub_object_paths)
+{
+    na::referable<message> r{message{{1, {2, 3, 4, 5}}, {}, {6, 7, 8}}};
+    r->fields[1].values[3] = 9;
+
+    na::ref_ptr<int> value = {r, na::path{&message::header, &message_field::values, na::index{2}}};
+    EXPECT_EQ(*value, 4);
+
+    na::ref_ptr<int> id = {r, na::static_path<&message::header, &message_field::id>{}};
+    EXPECT_EQ(*id, 1);
+
+    na::ref_ptr<int> payload = {r, na::path{&message::payload, na::index{1}}};
+    EXPECT_EQ(*payload, 7);
+
+    // Paths continue from a ref_ptr
+    na::ref_ptr<message> whole = r;
+    na::ref_ptr<int> field_value = {whole, na::path{&message::fields, na::index{1}, &message_field::values, na::index{3}}};
+    EXPECT_EQ(*field_value, 9);
+
+    const na::referable<message> &const_r = r;
+    na::ref_ptr<const int> const_id = {const_r, na::static_path<&message::header, &message_field::id>{}};
+    EXPECT_EQ(*const_id, 1);
+
+#if defined(na_ref_ptr_counted) || defined(na_ref_ptr_tracked)
+    // Each path adds a single reference
+    EXPECT_EQ(whole.use_count(), 6);
+#endif
+
+    na::ref_ptr<int> moved = {std::move(whole), na::path{&message::fields, na::index{0}, &message_field::id}};
+    EXPECT_FALSE(whole);
+    EXPECT_EQ(*moved, 0);
+
+#if defined(na_ref_ptr_counted) || defined(na_ref_ptr_tracked)
+    EXPECT_EQ(moved.use_count(), 6);
+#endif
+
+    // Paths from an empty ref_ptr are empty
+    na::ref_ptr<message> empty;
+    na::ref_ptr<int> from_empty = {empty, na::path{&message::payload, na::index{1}}};
+    na::ref_ptr<int> moved_from_empty = {std::move(empty), na::static_path<&message::header, &message_field::id>{}};
+    EXPECT_FALSE(from_empty);
+    EXPECT_FALSE(moved_from_empty);
+}
+
+namespace
+{
+
+struct shape
+{
+    virtual ~shape() = default;
+    int id = 1;
+};
+
+struct circle : shape
+{
+    double radius = 2.0;
+};
+
+struct square : shape
+{
+};
+
+} // namespace
+
+TEST(na_ref_ptr_test_suit, ref_casts)
+{
+    na::referable<circle> c{circle{}};
+    na::ref_ptr<shape> s = c;
+
+    na::ref_ptr<circle> copied = na::static_ref_cast<circle>(s);
+    EXPECT_EQ(copied->radius, 2.0);
+
+#if defined(na_ref_ptr_counted) || defined(na_ref_ptr_tracked)
+    EXPECT_EQ(s.use_count(), 2);
+#endif
+
+    // Moving the reference into the result does not change the count
+    na::ref_ptr<circle> moved = na::static_ref_cast<circle>(std::move(s));
+    EXPECT_FALSE(s);
+    EXPECT_EQ(moved->radius, 2.0);
+
+#if defined(na_ref_ptr_counted) || defined(na_ref_ptr_tracked)
+    EXPECT_EQ(moved.use_count(), 2);
+#endif
+
+    s = std::move(moved);
+    EXPECT_TRUE(na::dynamic_ref_cast<circle>(s));
+    EXPECT_FALSE(na::dynamic_ref_cast<square>(s));
+
+    // A failed cast leaves the reference with the source
+    na::ref_ptr<square> not_square = na::dynamic_ref_cast<square>(std::move(s));
+    EXPECT_FALSE(not_square);
+    ASSERT_TRUE(s);
+    na::ref_ptr<circle> is_circle = na::dynamic_ref_cast<circle>(std::move(s));
+    EXPECT_FALSE(s);
+    EXPECT_EQ(is_circle->radius, 2.0);
+
+    na::ref_ptr<const circle> const_circle = is_circle;
+    na::ref_ptr<circle> mutable_circle = na::const_ref_cast<circle>(std::move(const_circle));
+    mutable_circle->radius = 3.0;
+    EXPECT_EQ(c->radius, 3.0);
+
+    EXPECT_FALSE(na::static_ref_cast<circle>(na::ref_ptr<shape>{}));
+
+#if defined(na_ref_ptr_counted) || defined(na_ref_ptr_tracked)
+    EXPECT_EQ(copied.use_count(), 3);
+#endif
+}
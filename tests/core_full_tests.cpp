@@ -0,0 +1,37 @@
+// Copyright (c) 2023 Namal Bambarasinghe
+//
+// This software is released under the MIT License.
+// https://opensource.org/licenses/MIT
+
+// The referable after free handler of core_tests is defined in this translation unit
+#define na_ref_ptr_define_handler
+#define na_ref_ptr_tracked
+#include <na/ref_ptr_core.hpp>
+
+#include <gtest/gtest.h>
+
+#include <string>
+
+#if !defined(NA_REF_PTR_HPP)
+#error "na/ref_ptr_core.hpp must include na/ref_ptr.hpp for the tracked implementation"
+#endif
+
+TEST(na_ref_ptr_core_tests, full_header_test)
+{
+    std::string message;
+    na::set_referable_after_free_handler([&message](const std::string &msg) { message = msg; });
+
+    na::ref_ptr<int> p;
+    {
+        na::referable<int> r{1};
+        p = r;
+    }
+
+    EXPECT_NE(message.find("core_full_tests.cpp"), std::string::npos);
+    p.reset();
+
+    // The counted types compiled by the core header in core_tests are the same as the ones here
+    na::basic_referable<int, na::counted> counted{2};
+    na::basic_ref_ptr<int, na::counted> q = counted;
+    EXPECT_EQ(q.use_count(), 1);
+}
@@ -0,0 +1,75 @@
+// Copyright (c) 2023 Namal Bambarasinghe
+//
+// This software is released under the MIT License.
+// https://opensource.org/licenses/MIT
+
+#define na_ref_ptr_counted
+#include <na/ref_ptr_core.hpp>
+
+#include <gtest/gtest.h>
+
+#include <string_view>
+
+#if defined(NA_REF_PTR_HPP)
+#error "na/ref_ptr_core.hpp must not include na/ref_ptr.hpp for the counted implementation"
+#endif
+
+struct point
+{
+    int x;
+    int values[2];
+};
+
+static void set_flag(void *context, std::string_view message)
+{
+    *static_cast<bool *>(context) = message.starts_with("Referable after free detected");
+}
+
+TEST(na_ref_ptr_core_tests, ref_ptr_test)
+{
+    na::referable<point> r{point{1, {2, 3}}};
+    na::ref_ptr<point> p = r;
+    na::ref_ptr<int> x = {r, &point::x};
+    na::ref_ptr<int> last = {r, na::path{&point::values, na::index{1}}};
+
+    EXPECT_EQ(p.use_count(), 3);
+    EXPECT_EQ(*x, 1);
+    EXPECT_EQ(*last, 3);
+    EXPECT_EQ(p.borrow()->values[0], 2);
+
+    na::ref_ptr<const point> c = na::static_ref_cast<const point>(p);
+    EXPECT_EQ(c->x, 1);
+    EXPECT_EQ(p.use_count(), 4);
+
+    // The uncounted ref_ptr does not count
+    na::basic_ref_ptr<point, na::uncounted> u{p};
+    EXPECT_EQ(u->x, 1);
+    EXPECT_EQ(p.use_count(), 4);
+}
+
+TEST(na_ref_ptr_core_tests, enable_ref_from_this_test)
+{
+    struct node : na::enable_ref_from_this<node>
+    {
+        int value = 5;
+    };
+
+    node n;
+    na::ref_ptr<node> p = n;
+    EXPECT_EQ(p->value, 5);
+    EXPECT_EQ(p.use_count(), 1);
+}
+
+TEST(na_ref_ptr_core_tests, referable_after_free_test)
+{
+    bool referable_after_free_detected = false;
+    na::set_referable_after_free_handler(set_flag, &referable_after_free_detected);
+
+    na::ref_ptr<int> p;
+    {
+        na::referable<int> r{1};
+        p = r;
+    }
+
+    EXPECT_EQ(referable_after_free_detected, true);
+}
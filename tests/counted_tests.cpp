@@ -26,4 +26,104 @@ TEST(na_ref_ptr_test_suit, referable_after_free_test)
     make_referable_after_free_counted();
 
     EXPECT_EQ(referable_after_free_detected, true);
-}
\ No newline at end of file
+}
+
+TEST(na_ref_ptr_test_suit, referable_after_free_function_handler_test)
+{
+    bool referable_after_free_detected = false;
+    na::set_referable_after_free_handler(
+        [](void *context, std::string_view message) {
+            *static_cast<bool *>(context) = message.starts_with("Referable after free detected");
+        },
+        &referable_after_free_detected);
+
+    make_referable_after_free_counted();
+
+    EXPECT_EQ(referable_after_free_detected, true);
+}
+
+TEST(na_ref_ptr_test_suit, referable_pool_release_with_refs_test)
+{
+    bool referable_after_free_detected = false;
+    na::set_referable_after_free_handler([&referable_after_free_detected](const std::string &msg) {
+        referable_after_free_detected = true;
+    });
+
+    na::referable_pool<int> pool;
+    auto h = pool.emplace(1);
+    na::pooled_ref<int> p = pool.ref(h);
+    pool.release(h);
+
+    EXPECT_EQ(referable_after_free_detected, true);
+}
+
+TEST(na_ref_ptr_test_suit, draining_referable_timeout_test)
+{
+    bool referable_after_free_detected = false;
+    na::set_referable_after_free_handler([&referable_after_free_detected](const std::string &msg) {
+        referable_after_free_detected = true;
+    });
+
+    na::ref_ptr<int, na::draining_counter> p;
+    {
+        na::draining_referable<int> r{1};
+        r.set_drain_timeout(std::chrono::milliseconds{5});
+        p = r;
+    }
+
+    EXPECT_EQ(referable_after_free_detected, true);
+}
+
+TEST(na_ref_ptr_test_suit, referable_array_after_free_test)
+{
+    bool referable_after_free_detected = false;
+    na::set_referable_after_free_handler([&referable_after_free_detected](const std::string &msg) {
+        referable_after_free_detected = true;
+    });
+
+    na::ref_ptr<int> p;
+    {
+        na::referable_array<int> values(8);
+        p = values.ref(3);
+    }
+
+    EXPECT_EQ(referable_after_free_detected, true);
+}
+
+TEST(na_ref_ptr_test_suit, path_index_out_of_range_test)
+{
+    std::vector<std::string> messages;
+    na::set_referable_after_free_handler([&messages](const std::string &msg) { messages.push_back(msg); });
+
+    struct field
+    {
+        int values[4];
+    };
+
+    na::referable<field> r{field{{1, 2, 3, 4}}};
+    na::ref_ptr<int> in_range = {r, na::path{&field::values, na::index{3}}};
+    EXPECT_TRUE(messages.empty());
+
+    na::referable_array<int> values(2);
+    na::ref_ptr<int> last = values.ref(1);
+    EXPECT_TRUE(messages.empty());
+
+    // The index is reported before the out of range element is used
+    na::ref_ptr<int> past_end = {r, na::path{&field::values, na::index{4}}};
+    na::ref_ptr<int> past_last = values.ref(2);
+    ASSERT_EQ(messages.size(), 2);
+    EXPECT_EQ(messages[0], "Index out of range in a ref_ptr path");
+    EXPECT_EQ(messages[1], "Index out of range in referable_array::ref()");
+
+    // The ref_ptrs to an element out of range are left empty without a reference
+    EXPECT_FALSE(past_end);
+    EXPECT_FALSE(past_last);
+    EXPECT_EQ(in_range.use_count(), 1);
+    EXPECT_EQ(last.use_count(), 1);
+
+    // A ref_ptr moved into an out of range path keeps its reference
+    na::ref_ptr<field> whole = r;
+    na::ref_ptr<int> moved = {std::move(whole), na::path{&field::values, na::index{5}}};
+    EXPECT_FALSE(moved);
+    EXPECT_EQ(whole.use_count(), 2);
+}
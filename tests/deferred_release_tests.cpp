@@ -0,0 +1,196 @@
+// Copyright (c) 2023 Namal Bambarasinghe
+//
+// This software is released under the MIT License.
+// https://opensource.org/licenses/MIT
+
+#define na_ref_ptr_counted
+#include <na/ref_ptr.hpp>
+
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+TEST(na_ref_ptr_deferred_release_tests, releases_are_applied_when_the_scope_ends)
+{
+    na::referable<int> r{1};
+    na::ref_ptr<int> kept = r;
+
+    {
+        na::deferred_release_scope scope;
+        {
+            na::ref_ptr<int> p = r;
+            na::ref_ptr<int> q = p;
+        }
+        EXPECT_EQ(kept.use_count(), 3);
+
+        na::flush_deferred_releases();
+        EXPECT_EQ(kept.use_count(), 1);
+
+        {
+            na::deferred_release_scope nested;
+            na::ref_ptr<int> p = r;
+        }
+        // Only the outermost scope applies the releases
+        EXPECT_EQ(kept.use_count(), 2);
+    }
+    EXPECT_EQ(kept.use_count(), 1);
+
+    // Outside a scope the releases are applied right away
+    {
+        na::ref_ptr<int> p = r;
+    }
+    EXPECT_EQ(kept.use_count(), 1);
+}
+
+TEST(na_ref_ptr_deferred_release_tests, releases_are_applied_at_the_threshold)
+{
+    constexpr std::size_t threshold = na::detail::release_buffer::flush_threshold;
+
+    na::referable<int> r{1};
+    na::ref_ptr<int> kept = r;
+    na::deferred_release_scope scope;
+
+    std::vector<na::ref_ptr<int>> refs(threshold - 1, kept);
+    refs.clear();
+    EXPECT_EQ(kept.use_count(), threshold);
+
+    na::ref_ptr<int>{r};
+    EXPECT_EQ(kept.use_count(), 1);
+}
+
+TEST(na_ref_ptr_deferred_release_tests, releases_to_many_referables)
+{
+    constexpr std::size_t referable_count = 4 * na::detail::release_buffer::slot_count;
+
+    std::vector<std::unique_ptr<na::referable<int>>> referables;
+    std::vector<na::ref_ptr<int>> kept;
+    for (std::size_t i = 0; i < referable_count; ++i)
+    {
+        referables.emplace_back(new na::referable<int>{static_cast<int>(i)});
+        kept.emplace_back(*referables.back());
+    }
+
+    {
+        na::deferred_release_scope scope;
+        for (std::size_t i = 0; i < 3 * referable_count; ++i)
+        {
+            na::ref_ptr<int> p = kept[(i * 7) % referable_count];
+        }
+    }
+
+    for (const auto &p : kept)
+    {
+        EXPECT_EQ(p.use_count(), 1);
+    }
+}
+
+TEST(na_ref_ptr_deferred_release_tests, referable_destroyed_with_releases_pending_on_another_thread)
+{
+    bool referable_after_free_detected = false;
+    na::set_referable_after_free_handler(
+        [&referable_after_free_detected](const std::string &) { referable_after_free_detected = true; });
+
+    auto r = std::make_unique<na::referable<int>>(1);
+    std::atomic_int stage{0};
+
+    std::thread consumer{[&r, &stage] {
+        na::deferred_release_scope scope;
+        {
+            na::ref_ptr<int> p = *r;
+        }
+
+        stage.store(1);
+        stage.notify_one();
+        stage.wait(1);
+    }};
+
+    stage.wait(0);
+    EXPECT_EQ(na::ref_ptr<int>{*r}.use_count(), 2);
+
+    // The destructor applies the release pending in the buffer of the consumer
+    r.reset();
+    EXPECT_EQ(referable_after_free_detected, false);
+
+    stage.store(2);
+    stage.notify_one();
+    consumer.join();
+}
+
+TEST(na_ref_ptr_deferred_release_tests, releases_from_many_threads)
+{
+    constexpr std::size_t thread_count = 8;
+    constexpr std::size_t referable_count = 16;
+    constexpr std::size_t refs_per_thread = 10000;
+
+    bool referable_after_free_detected = false;
+    na::set_referable_after_free_handler(
+        [&referable_after_free_detected](const std::string &) { referable_after_free_detected = true; });
+
+    {
+        std::vector<std::unique_ptr<na::referable<int>>> referables;
+        for (std::size_t i = 0; i < referable_count; ++i)
+        {
+            referables.emplace_back(new na::referable<int>{static_cast<int>(i)});
+        }
+
+        std::vector<std::thread> threads;
+        for (std::size_t t = 0; t < thread_count; ++t)
+        {
+            threads.emplace_back([&referables, t] {
+                na::deferred_release_scope scope;
+                for (std::size_t i = 0; i < refs_per_thread; ++i)
+                {
+                    na::ref_ptr<int> p = *referables[(i + t) % referable_count];
+                    na::ref_ptr<int> copy = p;
+                }
+            });
+        }
+
+        for (auto &thread : threads)
+        {
+            thread.join();
+        }
+
+        for (const auto &r : referables)
+        {
+            EXPECT_EQ(na::ref_ptr<int>{*r}.use_count(), 1);
+        }
+    }
+
+    EXPECT_EQ(referable_after_free_detected, false);
+}
+
+TEST(na_ref_ptr_deferred_release_tests, pooled_refs_are_deferred)
+{
+    na::referable_pool<int> pool;
+    auto h = pool.emplace(1);
+    na::pooled_ref<int> kept = pool.ref(h);
+
+    {
+        na::deferred_release_scope scope;
+        {
+            na::pooled_ref<int> p = kept;
+        }
+        EXPECT_EQ(kept.use_count(), 2);
+    }
+    EXPECT_EQ(kept.use_count(), 1);
+
+    kept.reset();
+    pool.release(h);
+}
+
+TEST(na_ref_ptr_deferred_release_tests, draining_counter_is_not_deferred)
+{
+    na::draining_referable<int> r{1};
+    na::ref_ptr<int, na::draining_counter> kept = r;
+
+    na::deferred_release_scope scope;
+    {
+        na::ref_ptr<int, na::draining_counter> p = r;
+    }
+    EXPECT_EQ(kept.use_count(), 1);
+}
@@ -0,0 +1,50 @@
+// Copyright (c) 2023 Namal Bambarasinghe
+//
+// This software is released under the MIT License.
+// https://opensource.org/licenses/MIT
+
+#define na_ref_ptr_tracked
+#include <na/ref_ptr.hpp>
+
+#include <gtest/gtest.h>
+
+#include <string>
+
+static void append_report(void *context, std::string_view text)
+{
+    static_cast<std::string *>(context)->append(text);
+}
+
+TEST(na_ref_ptr_live_referable_tests, write_live_referables)
+{
+    const auto referable_line = std::to_string(__LINE__ + 1);
+    na::referable<int> r{1};
+    na::ref_ptr<int> p = r;
+    na::ref_ptr<int> q = r;
+
+    std::string report;
+    na::write_live_referables(append_report, &report);
+
+    EXPECT_TRUE(report.starts_with("Live referables:\n"));
+    const auto line = report.find("live_referable_tests.cpp:" + referable_line + " (2 references)\n");
+    ASSERT_NE(line, std::string::npos);
+    EXPECT_EQ(report.find("    "), report.find('\n', line) + 1);
+
+    p.reset();
+    q.reset();
+    report.clear();
+    na::write_live_referables(append_report, &report);
+    EXPECT_NE(report.find("live_referable_tests.cpp:" + referable_line + " (0 references)\n"), std::string::npos);
+}
+
+TEST(na_ref_ptr_live_referable_tests, destroyed_referables_are_not_listed)
+{
+    const auto referable_line = std::to_string(__LINE__ + 2);
+    {
+        na::basic_referable<int, na::sampled> r{1};
+    }
+
+    std::string report;
+    na::write_live_referables(append_report, &report);
+    EXPECT_EQ(report.find("live_referable_tests.cpp:" + referable_line), std::string::npos);
+}
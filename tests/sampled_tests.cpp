@@ -0,0 +1,75 @@
+// Copyright (c) 2023 Namal Bambarasinghe
+//
+// This software is released under the MIT License.
+// https://opensource.org/licenses/MIT
+
+#define na_ref_ptr_sampled
+#define na_ref_ptr_test_suit na_ref_ptr_sampled_tests
+#include "all_tests.inl"
+
+#include <algorithm>
+
+// Sums the reference counts of the locations listed after the heading of a referable after free message
+static std::size_t sum_listed_refs(const std::string &message, std::string_view heading)
+{
+    std::size_t sum = 0;
+    std::size_t line = message.find('\n', message.find(heading));
+
+    while (line != std::string::npos && line + 1 < message.size())
+    {
+        const std::size_t count = message.find(" (", line);
+        line = message.find('\n', line + 1);
+        sum += std::stoul(message.substr(count + 2, line - count - 2));
+    }
+
+    return sum;
+}
+
+void make_referable_after_free_sampled()
+{
+    na::ref_ptr<int> rp;
+    {
+        na::referable<int> r{1};
+        rp = r;
+    }
+}
+
+TEST(na_ref_ptr_test_suit, referable_after_free_test)
+{
+    bool referable_after_free_detected = false;
+    na::set_referable_after_free_handler([&referable_after_free_detected](const std::string &msg) {
+        referable_after_free_detected = true;
+    });
+
+    make_referable_after_free_sampled();
+
+    EXPECT_EQ(referable_after_free_detected, true);
+}
+
+TEST(na_ref_ptr_test_suit, referable_after_free_message_lists_sampled_references)
+{
+    constexpr std::size_t ref_count = 4 * na_ref_ptr_sample_rate;
+
+    std::string message;
+    na::set_referable_after_free_handler([&message](const std::string &msg) { message = msg; });
+
+    std::vector<na::ref_ptr<int>> refs;
+    refs.reserve(ref_count);
+    {
+        na::referable<int> r{1};
+
+        for (std::size_t i = 0; i < ref_count; ++i)
+        {
+            refs.emplace_back(r);
+        }
+
+        EXPECT_EQ(refs.front().use_count(), ref_count);
+    }
+
+    EXPECT_EQ(sum_listed_refs(message, "Sampled active references"), ref_count / na_ref_ptr_sample_rate);
+
+    for (auto &ref : refs)
+    {
+        ref.reset();
+    }
+}
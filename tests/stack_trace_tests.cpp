@@ -0,0 +1,77 @@
+// Copyright (c) 2023 Namal Bambarasinghe
+//
+// This software is released under the MIT License.
+// https://opensource.org/licenses/MIT
+
+#define na_ref_ptr_tracked
+#include <na/ref_ptr.hpp>
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <memory>
+#include <string>
+#include <vector>
+
+// All the references are created at the same source location, only their stack traces tell them apart
+[[gnu::noinline]] na::ref_ptr<int> *make_ref(na::referable<int> &r)
+{
+    return new na::ref_ptr<int>{r};
+}
+
+[[gnu::noinline]] na::ref_ptr<int> *make_ref_from_first_caller(na::referable<int> &r)
+{
+    return make_ref(r);
+}
+
+[[gnu::noinline]] na::ref_ptr<int> *make_ref_from_second_caller(na::referable<int> &r)
+{
+    return make_ref(r);
+}
+
+TEST(na_ref_ptr_stack_trace_tests, referable_after_free_message_lists_stack_traces)
+{
+    std::string message;
+    na::set_referable_after_free_handler([&message](const std::string &msg) { message = msg; });
+
+    std::unique_ptr<na::ref_ptr<int>> first;
+    std::vector<std::unique_ptr<na::ref_ptr<int>>> second;
+    {
+        na::referable<int> r{1};
+        first.reset(make_ref_from_first_caller(r));
+
+        // Created from one call site so that both references have the same trace
+        for (int i = 0; i < 2; ++i)
+        {
+            second.emplace_back(make_ref_from_second_caller(r));
+        }
+    }
+
+    // The references from the same location are grouped by their traces, which start outside the library
+    const auto active_refs = message.substr(message.find("Active references:"));
+    EXPECT_NE(active_refs.find("(2 references)\n    #0 _Z8make_ref"), std::string::npos);
+    EXPECT_NE(active_refs.find("(1 reference)\n    #0 _Z8make_ref"), std::string::npos);
+    EXPECT_NE(active_refs.find("make_ref_from_first_caller"), std::string::npos);
+    EXPECT_NE(active_refs.find("make_ref_from_second_caller"), std::string::npos);
+    EXPECT_EQ(active_refs.find("#0 _ZN2na6detail"), std::string::npos);
+    EXPECT_LT(active_refs.find("make_ref_from_second_caller"), active_refs.find("make_ref_from_first_caller"));
+
+    first.reset();
+    second.clear();
+}
+
+TEST(na_ref_ptr_stack_trace_tests, moved_refs_keep_their_stack_traces)
+{
+    std::string message;
+    na::set_referable_after_free_handler([&message](const std::string &msg) { message = msg; });
+
+    na::ref_ptr<int> moved;
+    {
+        na::referable<int> r{1};
+        std::unique_ptr<na::ref_ptr<int>> made{make_ref_from_first_caller(r)};
+        moved = std::move(*made);
+    }
+
+    EXPECT_NE(message.find("make_ref_from_first_caller"), std::string::npos);
+    moved.reset();
+}
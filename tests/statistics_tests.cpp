@@ -0,0 +1,179 @@
+// Copyright (c) 2023 Namal Bambarasinghe
+//
+// This software is released under the MIT License.
+// https://opensource.org/licenses/MIT
+
+#define na_ref_ptr_counted
+#include <na/ref_ptr.hpp>
+
+#include <gtest/gtest.h>
+
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+namespace
+{
+template <typename implementation> struct statistics_value
+{
+    int i;
+};
+
+template <typename implementation> struct teardown_value
+{
+    int i;
+};
+
+template <typename implementation> struct conversion_base
+{
+    int i;
+};
+
+template <typename implementation> struct conversion_derived : conversion_base<implementation>
+{
+    int j;
+};
+
+template <typename value_type> na::type_statistics find_statistics(const na::statistics_snapshot &snapshot)
+{
+    const auto name = na::detail::statistics_type_name<value_type>();
+    for (const auto &t : snapshot.types)
+    {
+        if (t.type_name == name)
+        {
+            return t;
+        }
+    }
+    return na::type_statistics{};
+}
+
+template <typename implementation> void test_statistics()
+{
+    using value_type = statistics_value<implementation>;
+    constexpr bool counts = std::is_same_v<implementation, na::counted> || std::is_same_v<implementation, na::tracked>;
+
+    {
+        na::basic_referable<value_type, implementation> r1{{1}};
+        na::basic_referable<value_type, implementation> r2{{2}};
+        std::vector<na::basic_ref_ptr<value_type, implementation>> refs(4);
+        // Unqualified so that the make_refs of the implementation is found
+        make_refs(r1, refs.begin(), refs.end());
+        na::basic_ref_ptr<value_type, implementation> p = r2;
+        std::thread{[&p] { na::basic_ref_ptr<value_type, implementation> copy = p; }}.join();
+
+        const auto during = find_statistics<value_type>(na::get_statistics());
+
+        if constexpr (counts)
+        {
+            EXPECT_EQ(during.add_refs, 6);
+            EXPECT_EQ(during.remove_refs, 1);
+            EXPECT_EQ(during.live_refs(), 5);
+            EXPECT_EQ(during.live_referables(), 2);
+        }
+        else
+        {
+            EXPECT_EQ(during.add_refs, 0);
+        }
+    }
+
+    na::statistics_snapshot exported;
+    na::set_statistics_exporter([&exported](const na::statistics_snapshot &s) { exported = s; });
+    na::export_statistics();
+    na::set_statistics_exporter(nullptr);
+
+    const auto after = find_statistics<value_type>(exported);
+
+    if constexpr (counts)
+    {
+        EXPECT_EQ(after.live_refs(), 0);
+        EXPECT_EQ(after.live_referables(), 0);
+        EXPECT_EQ(after.referables_destroyed, 2);
+        EXPECT_EQ(after.max_snapshot_live_refs, 5);
+        EXPECT_EQ(after.max_snapshot_live_referables, 2);
+    }
+
+    EXPECT_GE(exported.total.add_refs, after.add_refs);
+}
+
+template <typename implementation> void test_statistics_in_thread_teardown()
+{
+    using value_type = teardown_value<implementation>;
+
+    static na::basic_referable<value_type, implementation> r{{1}};
+
+    struct holder
+    {
+        na::basic_ref_ptr<value_type, implementation> p;
+    };
+
+    std::thread{[] {
+        // The holder is constructed before the first event of the thread creates its block, so it is destroyed after
+        // the block and counts its removed reference during the teardown of the thread locals
+        thread_local holder h;
+        h.p = r;
+    }}.join();
+
+    const auto stats = find_statistics<value_type>(na::get_statistics());
+    EXPECT_EQ(stats.add_refs, 1);
+    EXPECT_EQ(stats.remove_refs, 1);
+}
+template <typename implementation> void test_statistics_across_conversions()
+{
+    using base = conversion_base<implementation>;
+    using derived = conversion_derived<implementation>;
+
+    na::basic_referable<derived, implementation> r{{{1}, 2}};
+    {
+        na::basic_ref_ptr<base, implementation> b{na::basic_ref_ptr<derived, implementation>{r}};
+        // Unqualified so that the cast of the implementation is found
+        na::basic_ref_ptr<derived, implementation> d = static_ref_cast<derived>(std::move(b));
+        na::basic_ref_ptr<int, implementation> j{std::move(d), &derived::j};
+
+        const auto during = na::get_statistics();
+        EXPECT_EQ(find_statistics<derived>(during).live_refs(), 0);
+        EXPECT_EQ(find_statistics<base>(during).live_refs(), 0);
+        EXPECT_EQ(find_statistics<int>(during).live_refs(), 1);
+
+        na::basic_ref_ptr<base, implementation> assigned;
+        assigned = na::basic_ref_ptr<derived, implementation>{r};
+        EXPECT_EQ(find_statistics<base>(na::get_statistics()).live_refs(), 1);
+    }
+
+    // Each type counts the references it held as removed once they moved on or were destroyed
+    const auto after = na::get_statistics();
+    const auto derived_stats = find_statistics<derived>(after);
+    const auto base_stats = find_statistics<base>(after);
+    EXPECT_EQ(derived_stats.add_refs, 3);
+    EXPECT_EQ(derived_stats.remove_refs, 3);
+    EXPECT_EQ(base_stats.add_refs, 2);
+    EXPECT_EQ(base_stats.remove_refs, 2);
+    EXPECT_EQ(after.total.live_refs(), 0);
+}
+} // namespace
+
+TEST(na_ref_ptr_statistics_tests, counted_statistics)
+{
+    test_statistics<na::counted>();
+}
+
+TEST(na_ref_ptr_statistics_tests, tracked_statistics)
+{
+    test_statistics<na::tracked>();
+}
+
+TEST(na_ref_ptr_statistics_tests, uncounted_statistics)
+{
+    test_statistics<na::uncounted>();
+}
+
+TEST(na_ref_ptr_statistics_tests, events_after_the_thread_block_is_destroyed)
+{
+    test_statistics_in_thread_teardown<na::counted>();
+    test_statistics_in_thread_teardown<na::tracked>();
+}
+
+TEST(na_ref_ptr_statistics_tests, statistics_across_conversions)
+{
+    test_statistics_across_conversions<na::counted>();
+    test_statistics_across_conversions<na::tracked>();
+}
@@ -7,6 +7,26 @@
 #define na_ref_ptr_test_suit na_ref_ptr_tracked_tests
 #include "all_tests.inl"
 
+#include <algorithm>
+#include <memory>
+#include <thread>
+
+// Sums the reference counts of the locations listed after the heading of a referable after free message
+static std::size_t sum_listed_refs(const std::string &message, std::string_view heading)
+{
+    std::size_t sum = 0;
+    std::size_t line = message.find('\n', message.find(heading));
+
+    while (line != std::string::npos && line + 1 < message.size())
+    {
+        const std::size_t count = message.find(" (", line);
+        line = message.find('\n', line + 1);
+        sum += std::stoul(message.substr(count + 2, line - count - 2));
+    }
+
+    return sum;
+}
+
 void make_referable_after_free_tracked()
 {
     na::ref_ptr<int> rp;
@@ -26,4 +46,250 @@ TEST(na_ref_ptr_test_suit, referable_after_free_test)
     make_referable_after_free_tracked();
 
     EXPECT_EQ(referable_after_free_detected, true);
-}
\ No newline at end of file
+}
+
+TEST(na_ref_ptr_test_suit, referable_after_free_message_lists_references_from_all_threads)
+{
+    constexpr std::size_t thread_count = 8;
+    constexpr std::size_t refs_per_thread = 100;
+
+    std::string message;
+    na::set_referable_after_free_handler([&message](const std::string &msg) { message = msg; });
+
+    std::vector<na::ref_ptr<int>> refs(thread_count * refs_per_thread);
+    {
+        na::referable<int> r{1};
+
+        std::vector<std::thread> threads;
+        for (std::size_t t = 0; t < thread_count; ++t)
+        {
+            threads.emplace_back([&r, &refs, t] {
+                for (std::size_t i = 0; i < refs_per_thread; ++i)
+                {
+                    na::ref_ptr<int> p = r;
+                    na::ref_ptr<int> copy = p;
+                    refs[t * refs_per_thread + i] = copy;
+                }
+            });
+        }
+
+        for (auto &thread : threads)
+        {
+            thread.join();
+        }
+
+        EXPECT_EQ(refs.front().use_count(), thread_count * refs_per_thread);
+    }
+
+    // The references are grouped by the location that created them
+    EXPECT_EQ(sum_listed_refs(message, "Active references:"), thread_count * refs_per_thread);
+    EXPECT_NE(message.find("tracked_tests.cpp:"), std::string::npos);
+
+    for (auto &ref : refs)
+    {
+        ref.reset();
+    }
+}
+
+TEST(na_ref_ptr_test_suit, referable_after_free_function_handler_test)
+{
+    bool referable_after_free_detected = false;
+    na::set_referable_after_free_handler(
+        [](void *context, std::string_view message) {
+            *static_cast<bool *>(context) = message.starts_with("Referable after free detected");
+        },
+        &referable_after_free_detected);
+
+    make_referable_after_free_tracked();
+
+    EXPECT_EQ(referable_after_free_detected, true);
+}
+
+TEST(na_ref_ptr_test_suit, ref_view_used_after_reset_test)
+{
+    bool referable_after_free_detected = false;
+    na::set_referable_after_free_handler(
+        [&referable_after_free_detected](const std::string &msg) { referable_after_free_detected = true; });
+
+    na::referable<int> r{1};
+    na::ref_ptr<int> p = r;
+    na::ref_view<int> v = p.borrow();
+    EXPECT_EQ(*v, 1);
+    EXPECT_EQ(referable_after_free_detected, false);
+
+    p.reset();
+    [[maybe_unused]] int &i = *v;
+
+    EXPECT_EQ(referable_after_free_detected, true);
+}
+
+TEST(na_ref_ptr_test_suit, referable_after_free_message_after_moves)
+{
+    constexpr std::size_t ref_count = 100;
+
+    std::string message;
+    na::set_referable_after_free_handler([&message](const std::string &msg) { message = msg; });
+
+    struct entry
+    {
+        int key;
+        na::ref_ptr<int> ref;
+    };
+
+    std::vector<entry> refs;
+    {
+        na::referable<int> r{1};
+
+        // Growing and sorting the vector moves the ref_ptrs around
+        for (std::size_t i = 0; i < ref_count; ++i)
+        {
+            refs.push_back({static_cast<int>((i * 37) % ref_count), r});
+        }
+
+        std::sort(refs.begin(), refs.end(), [](const entry &a, const entry &b) { return a.key < b.key; });
+        EXPECT_EQ(refs.front().ref.use_count(), ref_count);
+    }
+
+    EXPECT_EQ(sum_listed_refs(message, "Active references:"), ref_count);
+
+    for (auto &e : refs)
+    {
+        e.ref.reset();
+    }
+}
+
+TEST(na_ref_ptr_test_suit, referable_pool_release_with_refs_test)
+{
+    std::vector<std::string> messages;
+    na::set_referable_after_free_handler([&messages](const std::string &msg) { messages.push_back(msg); });
+
+    na::referable_pool<int> pool;
+    auto h = pool.emplace(1);
+    na::pooled_ref<int> p = pool.ref(h);
+    na::pooled_ref<int> copy = p;
+    pool.release(h);
+
+    ASSERT_EQ(messages.size(), 1);
+    EXPECT_NE(messages[0].find("The number of references is 2"), std::string::npos);
+    EXPECT_NE(messages[0].find("tracked_tests.cpp"), std::string::npos);
+
+    // Dereferencing a pooled_ref to a released slot is reported too
+    static_cast<void>(p.get());
+    ASSERT_EQ(messages.size(), 2);
+    EXPECT_EQ(messages[1], "pooled_ref used after its slot was released");
+}
+
+TEST(na_ref_ptr_test_suit, referable_array_after_free_test)
+{
+    std::string message;
+    na::set_referable_after_free_handler([&message](const std::string &msg) { message = msg; });
+
+    na::ref_ptr<int> p;
+    na::ref_ptr<int> q;
+    {
+        na::referable_array<int> values(8);
+        p = values.ref(3);
+        q = values.ref(5);
+    }
+
+    // One report for the whole array, listing the references to every element
+    EXPECT_NE(message.find("The number of references is 2"), std::string::npos);
+    p.reset();
+    q.reset();
+}
+
+TEST(na_ref_ptr_test_suit, referable_after_free_message_groups_references_by_location)
+{
+    constexpr std::size_t ref_count = 1000;
+
+    std::string message;
+    na::set_referable_after_free_handler([&message](const std::string &msg) { message = msg; });
+
+    // Allocated separately so that each ref_ptr keeps the location it was created at
+    std::vector<std::unique_ptr<na::ref_ptr<int>>> refs;
+    {
+        na::referable<int> r{1};
+
+        for (std::size_t i = 0; i < ref_count; ++i)
+        {
+            refs.emplace_back(new na::ref_ptr<int>{r});
+        }
+
+        refs.emplace_back(new na::ref_ptr<int>{r});
+    }
+
+    // One line per location, the one with the most references first
+    const auto active_refs = message.substr(message.find("Active references:"));
+    EXPECT_EQ(std::count(active_refs.begin(), active_refs.end(), '\n'), 3);
+    EXPECT_LT(active_refs.find("(1000 references)"), active_refs.find("(1 reference)"));
+
+    refs.clear();
+}
+
+TEST(na_ref_ptr_test_suit, referable_after_free_message_names_where_moved_refs_were_created)
+{
+    std::string message;
+    na::set_referable_after_free_handler([&message](const std::string &msg) { message = msg; });
+
+    na::ref_ptr<int> constructed;
+    na::ref_ptr<int> assigned;
+    std::string first_line;
+    std::string second_line;
+    std::string moved_line;
+    {
+        na::referable<int> r{1};
+
+        first_line = ":" + std::to_string(__LINE__ + 1) + " (1 reference)";
+        na::ref_ptr<int> first = r;
+        second_line = ":" + std::to_string(__LINE__ + 1) + " (1 reference)";
+        na::ref_ptr<int> second = r;
+
+        moved_line = ":" + std::to_string(__LINE__ + 1) + " (";
+        na::ref_ptr<int> moved{std::move(first)};
+        constructed = std::move(moved);
+        assigned = std::move(second);
+    }
+
+    // The references are listed at the lines that created them, not where they were moved to
+    EXPECT_NE(message.find(first_line), std::string::npos) << message;
+    EXPECT_NE(message.find(second_line), std::string::npos) << message;
+    EXPECT_EQ(message.find(moved_line), std::string::npos) << message;
+
+    constructed.reset();
+    assigned.reset();
+}
+
+static void append_report(void *context, std::string_view text)
+{
+    static_cast<std::string *>(context)->append(text);
+}
+
+TEST(na_ref_ptr_test_suit, contention_profile_lists_locations_and_locks)
+{
+    using profiled = na::profiled_counter<>;
+
+    const auto referable_line = std::to_string(__LINE__ + 1);
+    na::referable<int, profiled> r{1};
+    na::ref_ptr<int, profiled> p = r;
+
+    std::thread{[&p] {
+        for (std::size_t i = 0; i < 16 * na_ref_ptr_contention_sample_rate; ++i)
+        {
+            na::ref_ptr<int, profiled> copy = p;
+        }
+    }}.join();
+
+    const auto profile = na::get_contention_profile(1000);
+    const auto record =
+        std::find_if(profile.begin(), profile.end(), [](const na::contention_record &r) { return r.alive; });
+    ASSERT_NE(record, profile.end());
+    EXPECT_EQ(std::to_string(record->location.line()), referable_line);
+
+    // Each copy locks the reference list to add and to remove the reference
+    EXPECT_EQ(record->sampled_locks, 32);
+
+    std::string report;
+    na::write_contention_profile(append_report, &report);
+    EXPECT_NE(report.find("tracked_tests.cpp:" + referable_line + "\n    count updates: "), std::string::npos);
+    EXPECT_NE(report.find("cycles held each\n"), std::string::npos);
+}